@@ -0,0 +1,211 @@
+#include <benchmark/benchmark.h>
+#include <random>
+#include <vector>
+
+#include "../src/include/masstree.h"
+
+// ノード単位の処理(permutation、ノード内の探索、split)と、木の大きさごとのfindBorderのmicro-benchmark
+// 結果をJSONで残す場合: ./bench --benchmark_out=bench.json --benchmark_out_format=json (またはmake bench_json)
+// NOTE: sortとsplitは毎回ノードを作り直すのでPauseTiming/ResumeTimingの分(数百ns)が上乗せされる、絶対値ではなく変化を見ること
+
+// sliceがi * 16のキーを15個持ち、permutationがランダムな順番の満杯のBorderNodeを作る
+static BorderNode *makeFullBorderNode(std::mt19937_64 &rng, std::vector<Value> &values) {
+    BorderNode *node = new BorderNode;
+    std::vector<size_t> order(Node::ORDER - 1);
+    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+    std::shuffle(order.begin(), order.end(), rng);
+    // 物理的な位置はランダムで、permutationを通すと昇順になる
+    Permutation permutation{};
+    for (size_t i = 0; i < order.size(); i++) {
+        size_t trueIndex = order[i];
+        node->setKeyLen(trueIndex, 8);
+        node->setKeySlice(trueIndex, (i + 1) * 16);
+        node->setLV(trueIndex, LinkOrValue(&values[i]));
+        permutation.setKeyIndex(i, trueIndex);
+    }
+    permutation.setNumKeys(Node::ORDER - 1);
+    node->setPermutation(permutation);
+    node->setIsRoot(true);
+    return node;
+}
+
+// 満杯のInteriorNode(sliceがi * 16のseparatorを15個)を作る
+static InteriorNode *makeFullInteriorNode(std::vector<BorderNode> &children) {
+    InteriorNode *node = new InteriorNode;
+    for (size_t i = 0; i < Node::ORDER - 1; i++) node->setKeySlice(i, (i + 1) * 16);
+    for (size_t i = 0; i < Node::ORDER; i++) node->setChild(i, &children[i]);
+    node->setNumKeys(Node::ORDER - 1);
+    return node;
+}
+
+static void BM_PermutationInsert(benchmark::State &state) {
+    size_t num_keys = static_cast<size_t>(state.range(0));
+    Permutation base = Permutation::fromSorted(num_keys);
+    size_t position = 0;
+    for (auto _ : state) {
+        Permutation permutation = base;
+        permutation.insert(position, num_keys);
+        benchmark::DoNotOptimize(permutation);
+        position = (position + 1) % (num_keys + 1);
+    }
+}
+BENCHMARK(BM_PermutationInsert)->Arg(1)->Arg(7)->Arg(14);
+
+static void BM_PermutationRemoveIndex(benchmark::State &state) {
+    size_t num_keys = static_cast<size_t>(state.range(0));
+    Permutation base = Permutation::fromSorted(num_keys);
+    uint8_t trueIndex = 0;
+    for (auto _ : state) {
+        Permutation permutation = base;
+        permutation.removeIndex(trueIndex);
+        benchmark::DoNotOptimize(permutation);
+        trueIndex = static_cast<uint8_t>((trueIndex + 1) % num_keys);
+    }
+}
+BENCHMARK(BM_PermutationRemoveIndex)->Arg(1)->Arg(8)->Arg(15);
+
+static void BM_SearchLinkOrValueWithIndex(benchmark::State &state) {
+    std::mt19937_64 rng{42};
+    std::vector<Value> values(Node::ORDER - 1, Value(0));
+    BorderNode *node = makeFullBorderNode(rng, values);
+    // 存在するキー15個と存在しないキー1個を順に探す
+    std::vector<Key> keys;
+    for (size_t i = 0; i < Node::ORDER; i++) keys.emplace_back(std::vector<uint64_t>{(i + 1) * 16}, 8);
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(node->searchLinkOrValueWithIndex(keys[i]));
+        i = (i + 1) % keys.size();
+    }
+    delete node;
+}
+BENCHMARK(BM_SearchLinkOrValueWithIndex);
+
+static void BM_FindChild(benchmark::State &state) {
+    std::vector<BorderNode> children(Node::ORDER);
+    InteriorNode *node = makeFullInteriorNode(children);
+    uint64_t slice = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(node->findChild(slice));
+        slice = (slice + 7) % (Node::ORDER * 16);
+    }
+    delete node;
+}
+BENCHMARK(BM_FindChild);
+
+static void BM_BorderNodeSort(benchmark::State &state) {
+    std::mt19937_64 rng{42};
+    std::vector<Value> values(Node::ORDER - 1, Value(0));
+    BorderNode *node = makeFullBorderNode(rng, values);
+    node->lock();
+    node->setSplitting(true);
+    for (auto _ : state) {
+        // sortは物理的な位置をpermutationの順に並べ直すので、毎回ランダムな順番に戻してから測る
+        state.PauseTiming();
+        BorderNode *fresh = makeFullBorderNode(rng, values);
+        for (size_t i = 0; i < Node::ORDER - 1; i++) {
+            node->setKeyLen(i, fresh->getKeyLen(i));
+            node->setKeySlice(i, fresh->getKeySlice(i));
+            node->setLV(i, fresh->getLV(i));
+        }
+        node->setPermutation(fresh->getPermutation());
+        delete fresh;
+        state.ResumeTiming();
+        node->sort();
+        benchmark::ClobberMemory();
+    }
+    delete node;
+}
+BENCHMARK(BM_BorderNodeSort);
+
+static void BM_SplitPoint(benchmark::State &state) {
+    std::mt19937_64 rng{42};
+    std::vector<Value> values(Node::ORDER - 1, Value(0));
+    BorderNode *node = makeFullBorderNode(rng, values);
+    std::vector<std::pair<uint64_t, size_t>> table{};
+    std::vector<uint64_t> found{};
+    create_slice_table(node, table, found);
+    uint64_t slice = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(split_point(slice, table, found));
+        slice = (slice + 7) % (Node::ORDER * 16 + 16);
+    }
+    delete node;
+}
+BENCHMARK(BM_SplitPoint);
+
+static void BM_SplitKeysAmongBorder(benchmark::State &state) {
+    std::mt19937_64 rng{42};
+    std::vector<Value> values(Node::ORDER, Value(0));
+    Key key({8 * 16 + 1}, 8);   // 真ん中あたりに入るキー
+    for (auto _ : state) {
+        state.PauseTiming();
+        BorderNode *node = makeFullBorderNode(rng, values);
+        BorderNode *node1 = new BorderNode;
+        node->lock();
+        node->setSplitting(true);
+        node1->lock();
+        node1->setSplitting(true);
+        state.ResumeTiming();
+        split_keys_among(node, node1, key, &values.back());
+        benchmark::ClobberMemory();
+        state.PauseTiming();
+        delete node;
+        delete node1;
+        state.ResumeTiming();
+    }
+}
+BENCHMARK(BM_SplitKeysAmongBorder);
+
+static void BM_SplitKeysAmongInterior(benchmark::State &state) {
+    std::vector<BorderNode> children(Node::ORDER + 1);
+    for (auto _ : state) {
+        state.PauseTiming();
+        InteriorNode *parent = makeFullInteriorNode(children);
+        InteriorNode *parent1 = new InteriorNode;
+        parent->lock();
+        parent->setSplitting(true);
+        parent1->lock();
+        parent1->setSplitting(true);
+        std::optional<uint64_t> k_prime{};
+        state.ResumeTiming();
+        split_keys_among(parent, parent1, 8 * 16 + 1, &children[Node::ORDER], 7, k_prime);
+        benchmark::DoNotOptimize(k_prime);
+        state.PauseTiming();
+        delete parent;
+        delete parent1;
+        state.ResumeTiming();
+    }
+}
+BENCHMARK(BM_SplitKeysAmongInterior);
+
+// num_keys個のランダムな8byteキーを持つ木でfindBorderする
+static void BM_FindBorder(benchmark::State &state) {
+    size_t num_keys = static_cast<size_t>(state.range(0));
+    std::mt19937_64 rng{42};
+    GarbageCollector gc;
+    Node *root = nullptr;
+    std::vector<Key> keys;
+    for (size_t i = 0; i < num_keys; i++) {
+        keys.emplace_back(std::vector<uint64_t>{rng()}, 8);
+        root = masstree_put(root, keys.back(), new Value(static_cast<int>(i)), gc).second;
+        keys.back().reset();
+    }
+    std::shuffle(keys.begin(), keys.end(), rng);
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(findBorder(root, keys[i]));
+        i = (i + 1) % keys.size();
+    }
+    state.counters["keys"] = static_cast<double>(num_keys);
+}
+BENCHMARK(BM_FindBorder)->RangeMultiplier(16)->Range(16, 1 << 20);
+
+// GarbageCollector::addの1回あたりの時間(溜まっている数によらず一定であること)
+// NOTE: benchはNDEBUGなので二重addの検出は無効、同じValueを繰り返しaddする(runしないので解放はされない)
+static void BM_GarbageCollectorAdd(benchmark::State &state) {
+    Value value(0);
+    GarbageCollector gc;
+    for (auto _ : state) gc.add(&value);
+    state.counters["retired"] = static_cast<double>(gc.size());
+}
+BENCHMARK(BM_GarbageCollectorAdd)->Iterations(1 << 22);   // 溜まったchunkのメモリを抑えるため回数を固定する
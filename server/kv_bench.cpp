@@ -0,0 +1,157 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "kv_protocol.h"
+
+// masstree_serverの負荷生成クライアント(end-to-endのスループットを測る)
+// 接続ごとにスレッドを1つ立て、depth個のリクエストを1回のwriteで送ってからdepth個のレスポンスを読む、を繰り返す
+// kv_bench [--unix PATH | --port N] [--connections N] [--depth N] [--seconds N] [--keys N] [--get-ratio R]
+
+struct BenchOptions {
+    std::string unix_path{};
+    uint16_t port = 7700;
+    size_t connections = 4;
+    size_t depth = 32;
+    double seconds = 5.0;
+    uint64_t keys = 1000000;
+    double get_ratio = 0.9;
+};
+
+static int connectTo(const BenchOptions &options) {
+    int fd;
+    if (!options.unix_path.empty()) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, options.unix_path.c_str(), sizeof(addr.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) return -1;
+    } else {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(options.port);
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) return -1;
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+static bool writeAll(int fd, const uint8_t *data, size_t len) {
+    while (len > 0) {
+        ssize_t w = write(fd, data, len);
+        if (w <= 0) return false;
+        data += w;
+        len -= static_cast<size_t>(w);
+    }
+    return true;
+}
+
+static bool readAll(int fd, uint8_t *data, size_t len) {
+    while (len > 0) {
+        ssize_t r = read(fd, data, len);
+        if (r <= 0) return false;
+        data += r;
+        len -= static_cast<size_t>(r);
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    BenchOptions options{};
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        const char *value = argv[i + 1];
+        if (arg == "--unix") {
+            options.unix_path = value;
+        } else if (arg == "--port") {
+            options.port = static_cast<uint16_t>(std::atoi(value));
+        } else if (arg == "--connections") {
+            options.connections = static_cast<size_t>(std::atoi(value));
+        } else if (arg == "--depth") {
+            options.depth = static_cast<size_t>(std::atoi(value));
+        } else if (arg == "--seconds") {
+            options.seconds = std::atof(value);
+        } else if (arg == "--keys") {
+            options.keys = static_cast<uint64_t>(std::atoll(value));
+        } else if (arg == "--get-ratio") {
+            options.get_ratio = std::atof(value);
+        } else {
+            std::cerr << "unknown option " << arg << std::endl;
+            return 2;
+        }
+    }
+
+    std::atomic<bool> done{false};
+    std::atomic<uint64_t> total_ops{0};
+    std::atomic<uint64_t> total_found{0};
+    std::atomic<bool> failed{false};
+    std::vector<std::thread> threads;
+    for (size_t c = 0; c < options.connections; c++) {
+        threads.emplace_back([&, c] {
+            int fd = connectTo(options);
+            if (fd < 0) {
+                failed.store(true);
+                return;
+            }
+            std::mt19937_64 rng{c + 1};
+            std::uniform_int_distribution<uint64_t> key_dist(0, options.keys - 1);
+            std::uniform_real_distribution<double> op_dist(0.0, 1.0);
+            std::vector<uint8_t> requests;
+            std::vector<KVResponse> responses(options.depth);
+            uint64_t ops = 0, found = 0;
+            while (!done.load(std::memory_order_relaxed)) {
+                requests.clear();
+                for (size_t i = 0; i < options.depth; i++) {
+                    uint64_t key = key_dist(rng);
+                    if (op_dist(rng) < options.get_ratio) {
+                        appendKVRequest(requests, KVOp::Get, &key, sizeof(key));
+                    } else {
+                        appendKVRequest(requests, KVOp::Put, &key, sizeof(key), static_cast<int32_t>(key));
+                    }
+                }
+                if (!writeAll(fd, requests.data(), requests.size()) ||
+                    !readAll(fd, reinterpret_cast<uint8_t *>(responses.data()), responses.size() * sizeof(KVResponse))) {
+                    failed.store(true);
+                    break;
+                }
+                for (const KVResponse &response : responses) found += response.status == static_cast<uint8_t>(KVStatus::OK);
+                ops += options.depth;
+            }
+            close(fd);
+            total_ops.fetch_add(ops);
+            total_found.fetch_add(found);
+        });
+    }
+    auto start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.seconds));
+    done.store(true);
+    for (auto &thread : threads) thread.join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (failed.load()) {
+        std::cerr << "kv_bench: connection failed" << std::endl;
+        return 1;
+    }
+    std::printf("connections %zu depth %zu ops %llu ok %llu throughput %.0f ops/s\n",
+                options.connections, options.depth,
+                static_cast<unsigned long long>(total_ops.load()),
+                static_cast<unsigned long long>(total_found.load()),
+                static_cast<double>(total_ops.load()) / elapsed);
+    return 0;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// masstree_serverのバイナリプロトコル
+// リクエストは8byteのKVRequestHeaderとkey_len byteのキー、レスポンスは8byteのKVResponse
+// クライアントはレスポンスを待たずに次のリクエストを送ってよく(pipelining)、レスポンスは接続ごとにリクエストの順に返る
+// NOTE: ループバック(同じマシン)でしか使わないので、数値はホストのバイトオーダーのまま送る
+
+enum class KVOp : uint8_t {
+    Get = 1,
+    Put = 2,        // valueを書き込む(キーが無ければ追加、あれば置き換え)
+    Remove = 3
+};
+
+enum class KVStatus : uint8_t {
+    OK = 0,
+    NotFound = 1,
+    BadRequest = 2  // 知らないopや長さ0のキー(キーの分は読み飛ばすので接続は続けられる)
+};
+
+struct KVRequestHeader {
+    uint8_t op;
+    uint8_t reserved;
+    uint16_t key_len;
+    int32_t value;      // Putのみ
+};
+
+struct KVResponse {
+    uint8_t status;
+    uint8_t reserved[3];
+    int32_t value;      // GetでOKの場合のみ
+};
+
+static_assert(sizeof(KVRequestHeader) == 8, "KVRequestHeader must be 8 bytes");
+static_assert(sizeof(KVResponse) == 8, "KVResponse must be 8 bytes");
+
+// リクエストを1つbufの末尾に追加する(クライアント用)
+inline void appendKVRequest(std::vector<uint8_t> &buf, KVOp op, const void *key, uint16_t key_len, int32_t value = 0) {
+    KVRequestHeader header{static_cast<uint8_t>(op), 0, key_len, value};
+    size_t offset = buf.size();
+    buf.resize(offset + sizeof(header) + key_len);
+    std::memcpy(buf.data() + offset, &header, sizeof(header));
+    std::memcpy(buf.data() + offset + sizeof(header), key, key_len);
+}
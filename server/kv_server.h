@@ -0,0 +1,410 @@
+#pragma once
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../src/include/masstree.h"
+#include "../src/include/masstree_reclaimer.h"
+#include "kv_protocol.h"
+
+constexpr size_t KV_READ_SIZE = 64 * 1024;          // 1回のreadで読む最大のbyte数
+constexpr size_t KV_MAX_PENDING_OUTPUT = 1 << 20;   // 送れていないレスポンスがこれを超えたら、その接続からは読まない
+constexpr size_t KV_MAX_EVENTS = 64;                // 1回のepoll_waitで受け取るイベントの数
+constexpr size_t KV_RETIRE_BATCH = 1024;            // workerのGCにこれだけ溜まったらgrace periodを待つ列に移す
+constexpr int KV_RETIRE_POLL_MS = 10;               // grace periodを待っているものがあるときのepoll_waitのtimeout
+
+struct KVServerOptions {
+    std::string unix_path{};    // 空でなければこのパスのUnix domain socketで待ち受ける
+    uint16_t port = 0;          // unix_pathが空なら127.0.0.1:portで待ち受ける(0なら空いているport)
+    size_t num_workers = 0;     // 0ならコア数
+    bool pin_workers = true;    // worker iをCPU i(を論理コア数で割った余り)に固定する
+    size_t max_batch = 64;      // 続けて届いたGetをまとめてmulti_getする最大の数
+};
+
+// Masstreeをkv_protocol.hのプロトコルで公開するループバック用のサーバ
+// workerはそれぞれepollを持ち、受け付けた接続のreadから木の操作、レスポンスのwriteまでを1つのスレッドで行う(run-to-completion)
+// 待ち受けるsocketは全workerのepollにEPOLLEXCLUSIVEで登録するので、新しい接続は空いているworkerの1つだけが受け付ける
+// 1回のreadで届いたリクエストのうち連続するGetはmulti_getでキーの順に並べてから引き(sorted point gets)、レスポンスはリクエストの順に返す
+//
+// 消したノードや置き換えたValueの解放はquiescent-state based reclamationで行う
+// workerはepollのイベントを処理し終えるたびに木のノードを何も持っていない(quiescent)ので、そのたびにglobal_epochを読んで公開する
+// GCに溜まったものはその時点のepochを付けて列に入れ、全workerがそのepoch以降に進んだらBackgroundReclaimerに渡す
+// epoll_waitで眠っている間はoffline(どのepochも妨げない)にする
+// NOTE: 解放の安全性は木に触るのがworkerだけであることに依っているので、木はKVServerが持ち、start()からstop()の間は外から触らないこと
+class KVServer {
+    public:
+        explicit KVServer(KVServerOptions options_) : options(std::move(options_)) {
+            if (options.num_workers == 0) options.num_workers = std::max(1U, std::thread::hardware_concurrency());
+            if (options.max_batch == 0) options.max_batch = 1;
+        }
+
+        KVServer(const KVServer &other) = delete;
+        KVServer &operator=(const KVServer &other) = delete;
+
+        ~KVServer() {
+            stop();
+        }
+
+        // 待ち受けを始めてworkerを立てる、socketの作成やbindに失敗したらfalseを返す(errnoはそのまま)
+        bool start() {
+            if (!listenSocket()) return false;
+            wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (wake_fd < 0) return false;
+            workers.clear();
+            for (size_t i = 0; i < options.num_workers; i++) workers.emplace_back(std::make_unique<Worker>());
+            for (auto &worker : workers) {
+                worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+                if (worker->epoll_fd < 0) return false;
+                epoll_event listen_event{};
+                listen_event.events = EPOLLIN | EPOLLEXCLUSIVE;
+                listen_event.data.fd = listen_fd;
+                epoll_event wake_event{};
+                wake_event.events = EPOLLIN;
+                wake_event.data.fd = wake_fd;
+                if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, listen_fd, &listen_event) < 0) return false;
+                if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, wake_fd, &wake_event) < 0) return false;
+            }
+            unsigned num_cpus = std::max(1U, std::thread::hardware_concurrency());
+            for (size_t i = 0; i < workers.size(); i++) {
+                Worker &worker = *workers[i];
+                worker.thread = std::thread([this, &worker] { run(worker); });
+                if (options.pin_workers) {
+                    cpu_set_t cpus;
+                    CPU_ZERO(&cpus);
+                    CPU_SET(i % num_cpus, &cpus);
+                    pthread_setaffinity_np(worker.thread.native_handle(), sizeof(cpus), &cpus);
+                }
+            }
+            return true;
+        }
+
+        // workerを止めて全ての接続を閉じる、grace periodを待っていたものもここで解放する
+        void stop() {
+            if (wake_fd >= 0) {
+                stopping.store(true, std::memory_order_release);
+                uint64_t one = 1;
+                [[maybe_unused]] ssize_t written = write(wake_fd, &one, sizeof(one));
+            }
+            for (auto &worker : workers) {
+                if (worker->thread.joinable()) worker->thread.join();
+                if (worker->epoll_fd >= 0) close(worker->epoll_fd);
+            }
+            workers.clear();
+            // 全workerが止まったので、残っているものはすぐに解放できる
+            for (auto &gc : orphans) reclaimer.retire(*gc);
+            orphans.clear();
+            reclaimer.flush();
+            if (listen_fd >= 0) close(listen_fd);
+            if (wake_fd >= 0) close(wake_fd);
+            if (unix_bound) unlink(options.unix_path.c_str());
+            unix_bound = false;
+            listen_fd = -1;
+            wake_fd = -1;
+        }
+
+        // TCPで待ち受けている場合のport(port 0を指定した場合に割り当てられたもの)
+        uint16_t port() const {
+            return bound_port;
+        }
+
+        size_t numWorkers() const {
+            return options.num_workers;
+        }
+
+        // サーバが持つMasstree(start()の前かstop()の後に読むこと)
+        Masstree &getTree() {
+            return tree;
+        }
+
+        // BackgroundReclaimerが解放したノードや値の数
+        uint64_t getFreedObjects() const {
+            return reclaimer.getFreedObjects();
+        }
+
+    private:
+        static constexpr uint64_t OFFLINE = std::numeric_limits<uint64_t>::max();
+
+        struct alignas(64) Worker {
+            std::atomic<uint64_t> epoch{OFFLINE};   // 最後のquiescent pointで読んだglobal_epoch(眠っている間はOFFLINE)
+            int epoll_fd = -1;
+            std::thread thread{};
+        };
+
+        struct Connection {
+            int fd = -1;
+            uint32_t interest = EPOLLIN;    // epollに登録しているイベント
+            bool closed = false;            // 相手がwrite側を閉じた(残りのレスポンスを送ったら閉じる)
+            std::vector<uint8_t> in{};      // 受け取ったがまだ処理していないbyte列
+            std::vector<uint8_t> out{};     // まだ送れていないレスポンス
+            size_t out_pos = 0;
+        };
+
+        // まとめて引くGetとその結果(workerごとに1つ持ち、バッチごとに確保し直さない)
+        struct GetBatch {
+            std::vector<Key> keys{};
+            std::vector<Value *> values{};
+            std::vector<size_t> order{};    // multi_getが並べ替えに使う作業領域
+        };
+
+        // GCの中身とそれを入れたときのepoch(全workerのepochがこれ以上になったら解放できる)
+        struct Retired {
+            uint64_t epoch;
+            std::unique_ptr<GarbageCollector> gc;
+        };
+
+        bool listenSocket() {
+            if (!options.unix_path.empty()) {
+                sockaddr_un addr{};
+                if (options.unix_path.size() >= sizeof(addr.sun_path)) {
+                    errno = ENAMETOOLONG;
+                    return false;
+                }
+                addr.sun_family = AF_UNIX;
+                std::memcpy(addr.sun_path, options.unix_path.c_str(), options.unix_path.size() + 1);
+                // 前回のサーバが残したsocketファイルだけを消す(他の種類のファイルは消さずにbindを失敗させる)
+                struct stat st{};
+                if (stat(options.unix_path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) unlink(options.unix_path.c_str());
+                listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+                if (listen_fd < 0) return false;
+                if (bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) return false;
+                unix_bound = true;
+            } else {
+                sockaddr_in addr{};
+                addr.sin_family = AF_INET;
+                addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                addr.sin_port = htons(options.port);
+                listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+                if (listen_fd < 0) return false;
+                int one = 1;
+                setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+                if (bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) return false;
+                socklen_t len = sizeof(addr);
+                getsockname(listen_fd, reinterpret_cast<sockaddr *>(&addr), &len);
+                bound_port = ntohs(addr.sin_port);
+            }
+            return listen(listen_fd, SOMAXCONN) == 0;
+        }
+
+        // workerの本体
+        void run(Worker &self) {
+            ThreadContext &ctx = tree.registerThread();
+            std::unordered_map<int, Connection> connections;
+            std::deque<Retired> retired;
+            GetBatch batch{};
+            epoll_event events[KV_MAX_EVENTS];
+            while (!stopping.load(std::memory_order_acquire)) {
+                // ここはquiescent point(木のノードを何も持っていない)
+                quiesce(self, ctx.getGC(), retired);
+                self.epoch.store(OFFLINE);
+                int n = epoll_wait(self.epoll_fd, events, KV_MAX_EVENTS, retired.empty() ? -1 : KV_RETIRE_POLL_MS);
+                self.epoch.store(global_epoch.load());
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    break;
+                }
+                for (int i = 0; i < n; i++) {
+                    int fd = events[i].data.fd;
+                    if (fd == wake_fd) continue;
+                    if (fd == listen_fd) {
+                        acceptAll(self, connections);
+                        continue;
+                    }
+                    auto it = connections.find(fd);
+                    if (it == connections.end()) continue;
+                    Connection &conn = it->second;
+                    bool ok = true;
+                    if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) ok = readAndServe(conn, ctx, batch);
+                    if (ok && (events[i].events & EPOLLOUT)) ok = flush(conn);
+                    if (ok) ok = updateInterest(self, conn);
+                    if (!ok || (conn.closed && conn.out_pos == conn.out.size())) {
+                        close(conn.fd);
+                        connections.erase(it);
+                    }
+                }
+            }
+            for (auto &pair : connections) close(pair.first);
+            // 他のworkerはまだ動いているかもしれないので、解放はstop()で全workerが止まってから行う
+            std::lock_guard<std::mutex> lock(orphansMutex);
+            for (Retired &r : retired) orphans.push_back(std::move(r.gc));
+            orphans.push_back(std::make_unique<GarbageCollector>());
+            orphans.back()->swap(ctx.getGC());
+        }
+
+        // GCが溜まっていれば今のepochを付けて列に入れ、全workerが追い越した分をBackgroundReclaimerに渡す
+        void quiesce(Worker &self, GarbageCollector &gc, std::deque<Retired> &retired) {
+            if (gc.size() >= KV_RETIRE_BATCH) {
+                retired.push_back({global_epoch.fetch_add(1) + 1, std::make_unique<GarbageCollector>()});
+                retired.back().gc->swap(gc);
+            }
+            self.epoch.store(global_epoch.load());
+            if (retired.empty()) return;
+            uint64_t safe = OFFLINE;
+            for (auto &worker : workers) safe = std::min(safe, worker->epoch.load());
+            while (!retired.empty() && retired.front().epoch <= safe) {
+                reclaimer.retire(*retired.front().gc);
+                retired.pop_front();
+            }
+        }
+
+        void acceptAll(Worker &self, std::unordered_map<int, Connection> &connections) {
+            while (true) {
+                int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd < 0) {
+                    if (errno == EINTR) continue;
+                    return;     // EAGAIN(他のworkerが受け付けた場合も含む)かエラー
+                }
+                if (options.unix_path.empty()) {
+                    int one = 1;
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                }
+                epoll_event event{};
+                event.events = EPOLLIN;
+                event.data.fd = fd;
+                if (epoll_ctl(self.epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+                    close(fd);
+                    continue;
+                }
+                connections[fd].fd = fd;
+            }
+        }
+
+        // 1回readして、揃っているリクエストを全て処理してレスポンスを送る(送りきれなかった分はEPOLLOUTで送る)
+        // 接続を閉じるべきならfalseを返す
+        bool readAndServe(Connection &conn, ThreadContext &ctx, GetBatch &batch) {
+            if (conn.out.size() - conn.out_pos < KV_MAX_PENDING_OUTPUT && !conn.closed) {
+                size_t old = conn.in.size();
+                conn.in.resize(old + KV_READ_SIZE);
+                ssize_t r = read(conn.fd, conn.in.data() + old, KV_READ_SIZE);
+                conn.in.resize(old + static_cast<size_t>(std::max<ssize_t>(r, 0)));
+                if (r == 0) {
+                    conn.closed = true;
+                } else if (r < 0 && errno != EAGAIN && errno != EINTR) {
+                    return false;
+                }
+            }
+            serve(conn, ctx, batch);
+            return flush(conn);
+        }
+
+        void serve(Connection &conn, ThreadContext &ctx, GetBatch &batch) {
+            size_t pos = 0;
+            while (conn.in.size() - pos >= sizeof(KVRequestHeader)) {
+                KVRequestHeader header;
+                std::memcpy(&header, conn.in.data() + pos, sizeof(header));
+                size_t total = sizeof(header) + header.key_len;
+                if (conn.in.size() - pos < total) break;
+                const uint8_t *key = conn.in.data() + pos + sizeof(header);
+                pos += total;
+                KVOp op = static_cast<KVOp>(header.op);
+                if (op == KVOp::Get && header.key_len > 0) {
+                    batch.keys.push_back(Key::fromBytes(key, header.key_len));
+                    if (batch.keys.size() >= options.max_batch) flushGets(conn, ctx, batch);
+                    continue;
+                }
+                // Get以外はそれまでのGetを先に処理する(同じ接続の中では書き込みの前後関係を保つ)
+                flushGets(conn, ctx, batch);
+                if (header.key_len == 0 || (op != KVOp::Put && op != KVOp::Remove)) {
+                    respond(conn, KVStatus::BadRequest);
+                    continue;
+                }
+                Key k = Key::fromBytes(key, header.key_len);
+                if (op == KVOp::Put) {
+                    tree.put(k, new Value(header.value), ctx);
+                    respond(conn, KVStatus::OK);
+                } else {
+                    Value *taken = tree.take(k, ctx);
+                    if (taken != nullptr) ctx.getGC().add(taken);
+                    respond(conn, taken != nullptr ? KVStatus::OK : KVStatus::NotFound);
+                }
+            }
+            flushGets(conn, ctx, batch);
+            conn.in.erase(conn.in.begin(), conn.in.begin() + static_cast<std::ptrdiff_t>(pos));
+        }
+
+        void flushGets(Connection &conn, ThreadContext &ctx, GetBatch &batch) {
+            if (batch.keys.empty()) return;
+            tree.multi_get(batch.keys, batch.values, batch.order, ctx);
+            for (Value *value : batch.values) {
+                if (value == nullptr) {
+                    respond(conn, KVStatus::NotFound);
+                } else {
+                    respond(conn, KVStatus::OK, value->getBody());
+                }
+            }
+            batch.keys.clear();
+        }
+
+        static void respond(Connection &conn, KVStatus status, int32_t value = 0) {
+            KVResponse response{static_cast<uint8_t>(status), {0, 0, 0}, value};
+            const auto *bytes = reinterpret_cast<const uint8_t *>(&response);
+            conn.out.insert(conn.out.end(), bytes, bytes + sizeof(response));
+        }
+
+        // 送れるだけ送る、接続を閉じるべきならfalseを返す
+        static bool flush(Connection &conn) {
+            while (conn.out_pos < conn.out.size()) {
+                ssize_t w = send(conn.fd, conn.out.data() + conn.out_pos, conn.out.size() - conn.out_pos, MSG_NOSIGNAL);
+                if (w < 0) {
+                    if (errno == EINTR) continue;
+                    if (errno != EAGAIN) return false;
+                    // 送り終えた先頭が半分を超えたら詰める(送りきれない状態が続いてもoutが伸び続けないように)
+                    if (conn.out_pos > conn.out.size() / 2) {
+                        conn.out.erase(conn.out.begin(), conn.out.begin() + static_cast<std::ptrdiff_t>(conn.out_pos));
+                        conn.out_pos = 0;
+                    }
+                    return true;
+                }
+                conn.out_pos += static_cast<size_t>(w);
+            }
+            conn.out.clear();
+            conn.out_pos = 0;
+            return true;
+        }
+
+        // 送れていないレスポンスがあればEPOLLOUTを、溜まりすぎていなければEPOLLINを待つ
+        static bool updateInterest(Worker &self, Connection &conn) {
+            size_t pending = conn.out.size() - conn.out_pos;
+            uint32_t interest = 0;
+            if (pending < KV_MAX_PENDING_OUTPUT && !conn.closed) interest |= EPOLLIN;
+            if (pending > 0) interest |= EPOLLOUT;
+            if (interest == conn.interest) return true;
+            epoll_event event{};
+            event.events = interest;
+            event.data.fd = conn.fd;
+            conn.interest = interest;
+            return epoll_ctl(self.epoll_fd, EPOLL_CTL_MOD, conn.fd, &event) == 0;
+        }
+
+        KVServerOptions options;
+        Masstree tree{};
+        BackgroundReclaimer reclaimer{};
+        std::vector<std::unique_ptr<Worker>> workers{};
+        std::atomic<uint64_t> global_epoch{1};
+        std::atomic<bool> stopping{false};
+        int listen_fd = -1;
+        int wake_fd = -1;
+        uint16_t bound_port = 0;
+        bool unix_bound = false;    // unix_pathにsocketファイルを作った(stop()で消す)
+        std::mutex orphansMutex{};
+        std::vector<std::unique_ptr<GarbageCollector>> orphans{};  // 止まったworkerが残したもの(stop()で解放する)
+};
@@ -0,0 +1,67 @@
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "kv_server.h"
+
+// masstree_server [--unix PATH | --port N] [--workers N] [--no-pin] [--batch N]
+// SIGINTかSIGTERMで止まり、止まるときに操作カウンタを出力する
+static void usage(const char *argv0) {
+    std::cerr << "usage: " << argv0 << " [--unix PATH | --port N] [--workers N] [--no-pin] [--batch N]" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    KVServerOptions options{};
+    options.port = 7700;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--unix" && has_value) {
+            options.unix_path = argv[++i];
+        } else if (arg == "--port" && has_value) {
+            options.port = static_cast<uint16_t>(std::atoi(argv[++i]));
+        } else if (arg == "--workers" && has_value) {
+            options.num_workers = static_cast<size_t>(std::atoi(argv[++i]));
+        } else if (arg == "--batch" && has_value) {
+            options.max_batch = static_cast<size_t>(std::atoi(argv[++i]));
+        } else if (arg == "--no-pin") {
+            options.pin_workers = false;
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    // シグナルはsigwaitで受け取るので、workerを立てる前に全スレッドでブロックしておく
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    KVServer server(options);
+    if (!server.start()) {
+        std::perror("masstree_server: start");
+        return 1;
+    }
+    if (options.unix_path.empty()) {
+        std::cerr << "listening on 127.0.0.1:" << server.port();
+    } else {
+        std::cerr << "listening on " << options.unix_path;
+    }
+    std::cerr << " with " << server.numWorkers() << " workers" << std::endl;
+
+    int signal = 0;
+    sigwait(&signals, &signal);
+    server.stop();
+
+    StatsSnapshot stats = server.getTree().getStats();
+    for (size_t i = 0; i < NUM_STATS_COUNTERS; i++) {
+        StatsCounter counter = static_cast<StatsCounter>(i);
+        if (stats[counter] > 0) std::cerr << statsCounterName(counter) << " " << stats[counter] << std::endl;
+    }
+    std::cerr << "freed_objects " << server.getFreedObjects() << std::endl;
+    return 0;
+}
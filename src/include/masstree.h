@@ -1,25 +1,165 @@
 #pragma once
 
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+
 #include "masstree_put.h"
 #include "masstree_get.h"
+#include "masstree_hot_leaves.h"
+#include "masstree_order.h"
 #include "masstree_remove.h"
 #include "masstree_scan.h"
+#include "masstree_seek.h"
+#include "masstree_thread_context.h"
+#include "masstree_tree_stats.h"
 #include "status.h"
 
 class Masstree {
     public:
-        Value *get(Key &key) {
+        Masstree() = default;
+
+        // PutMode::FlatCombiningなら、lockが取り合いになっているBorderNodeへのputをlockの持ち主にまとめて処理してもらう
+        // (偏ったキーへの書き込みが多いときに、lockを待つスレッドが増えてもスループットが落ちにくい)
+        explicit Masstree(PutMode put_mode_) : put_mode(put_mode_) {}
+
+        Masstree(const Masstree &other) = delete;
+        Masstree &operator=(const Masstree &other) = delete;
+
+        PutMode getPutMode() const {
+            return put_mode;
+        }
+
+        // Masstreeにアクセスするスレッドを登録して、そのスレッド専用のThreadContextを返す
+        // 返ってきたThreadContextはMasstreeが所有しているので、Masstreeより長生きさせないこと
+        ThreadContext &registerThread() {
+            std::lock_guard<std::mutex> lock(contextsMutex);
+            contexts.emplace_back(std::make_unique<ThreadContext>(contexts.size()));
+            return *contexts.back();
+        }
+
+        // 登録済みの全スレッドのカウンタを集計して返す
+        StatsSnapshot getStats() {
+            std::lock_guard<std::mutex> lock(contextsMutex);
+            StatsSnapshot total{};
+            for (auto &ctx : contexts) total.merge(ctx->getStats().snapshot());
+            return total;
+        }
+
+#ifdef MASSTREE_LATENCY_HISTOGRAM
+        // 登録済みの全スレッドのlatency histogramをmergeして返す
+        LatencyReport getLatency() {
+            std::lock_guard<std::mutex> lock(contextsMutex);
+            LatencyReport total{};
+            for (auto &ctx : contexts) total.merge(ctx->getLatency().report());
+            return total;
+        }
+#endif
+
+        // 木全体を走査して、レイヤごとのノード数やメモリ使用量を返す(writerと並行して呼び出せる)
+        TreeStats stats() const {
+            TreeStats result{};
+            collect_tree_stats(root.load(std::memory_order_acquire), result);
+            return result;
+        }
+
+        Value *get(Key &key, ThreadContext &ctx) {
+            MASSTREE_LATENCY_SCOPE(ctx, LatencyOp::Get);
+            return get(key, &ctx.getStats());
+        }
+
+        Value *get(Key &key, OperationStats *stats = nullptr) {
             Node *root_ = root.load(std::memory_order_acquire);
-            Value *v = masstree_get(root_, key);
+            Value *v = masstree_get(root_, key, stats);
             key.reset();
             return v;
         }
 
-        void put(Key &key, Value *value, GarbageCollector &gc) {
+        // latencyはバッチ全体の時間になり、1回のgetとは比べられないので取らない
+        void multi_get(std::vector<Key> &keys, std::vector<Value *> &values, ThreadContext &ctx) {
+            std::vector<size_t> order;
+            multi_get(keys, values, order, &ctx.getStats());
+        }
+
+        void multi_get(std::vector<Key> &keys, std::vector<Value *> &values, std::vector<size_t> &order, ThreadContext &ctx) {
+            multi_get(keys, values, order, &ctx.getStats());
+        }
+
+        void multi_get(std::vector<Key> &keys, std::vector<Value *> &values, OperationStats *stats = nullptr) {
+            std::vector<size_t> order;
+            multi_get(keys, values, order, stats);
+        }
+
+        // keys[i]のValue(なければnullptr)をvalues[i]に入れる
+        // キーの順に並べ替えてから1件ずつgetする(sorted point gets)、探索そのものは共有しないが、
+        // 近いキー同士は直前のgetでcacheに載ったInteriorNodeやBorderNodeを辿ることになる
+        // orderは並べ替えに使う作業領域で、呼び出し側が使い回せばバッチごとに確保しなくて済む
+        void multi_get(std::vector<Key> &keys, std::vector<Value *> &values, std::vector<size_t> &order, OperationStats *stats) {
+            values.assign(keys.size(), nullptr);
+            order.resize(keys.size());
+            for (size_t i = 0; i < order.size(); i++) order[i] = i;
+            std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+                return compare_keys(keys[a], keys[b]) < 0;
+            });
+            for (size_t i : order) {
+                values[i] = masstree_get(root.load(std::memory_order_acquire), keys[i], stats);
+                keys[i].reset();
+            }
+        }
+
+        void put(Key &key, Value *value, ThreadContext &ctx) {
+            MASSTREE_LATENCY_SCOPE(ctx, LatencyOp::Put);
+            put(key, value, ctx.getGC(), &ctx.getStats());
+        }
+
+        // 置き換えた元のValueはgcに入る
+        void put(Key &key, Value *value, GarbageCollector &gc, OperationStats *stats = nullptr) {
+            Value *old_value = exchange(key, value, gc, stats);
+            if (old_value != nullptr) gc.add(old_value);
+        }
+
+        // NOTE: バッチ全体を1回のputとして記録すると分布が歪むのでlatencyは記録しない
+        void put_batch(std::vector<Key> &keys, const std::vector<Value *> &values, ThreadContext &ctx) {
+            put_batch(keys, values, ctx.getGC(), &ctx.getStats());
+        }
+
+        // sortされたkeysにvaluesをまとめてputする(sortされていなければ1件ずつputするのと同じ)
+        // 同じBorderNodeに入るキーは1回の降下とlockで処理し、splitやレイヤの作成が必要なキーだけ1件ずつputする
+        void put_batch(std::vector<Key> &keys, const std::vector<Value *> &values, GarbageCollector &gc, OperationStats *stats = nullptr) {
+            assert(keys.size() == values.size());
+            // sortされていないとput_batch_to_borderが担当外のBorderNodeにキーを入れてしまうので、その場合は全て1件ずつputする
+            bool sorted = std::is_sorted(keys.begin(), keys.end(), [](const Key &a, const Key &b) { return compare_keys(a, b) < 0; });
+            size_t i = 0;
+            while (i < keys.size()) {
+                Node *root_ = root.load(std::memory_order_acquire);
+                size_t next = (root_ == nullptr || !sorted) ? i : put_batch_to_border(root_, keys, values, i, gc, stats);
+                if (next == i) {
+                    put(keys[i], values[i], gc, stats);
+                    next = i + 1;
+                }
+                i = next;
+            }
+        }
+
+        Value *exchange(Key &key, Value *value, ThreadContext &ctx) {
+            MASSTREE_LATENCY_SCOPE(ctx, LatencyOp::Put);
+            return exchange(key, value, ctx.getGC(), &ctx.getStats());
+        }
+
+        // putと同じだが、置き換えた元のValue(insertした場合はnullptr)をgcに入れずに返す
+        // 返ってきたValueは呼び出し側が所有する(他スレッドがまだ読んでいる可能性があるので、解放するならgcに入れること)
+        Value *exchange(Key &key, Value *value, GarbageCollector &gc, OperationStats *stats = nullptr) {
+            Value *old_value = nullptr;
         RETRY:
             Node *old_root = root.load(std::memory_order_acquire);
-            std::pair<PutResult, Node*> resultPair = masstree_put(old_root, key, value, gc);
-            if (resultPair.first == RetryFromUpperLayer) goto RETRY;
+            std::pair<PutResult, Node*> resultPair = (put_mode == PutMode::FlatCombining)
+                ? masstree_put_combining(old_root, key, value, old_value, gc, stats)
+                : masstree_put(old_root, key, value, old_value, gc, stats);
+            if (resultPair.first == RetryFromUpperLayer) {
+                countStats(stats, StatsCounter::PutRetryFromUpperLayer);
+                goto RETRY;
+            }
             Node *new_root = resultPair.second;
 
             key.reset();
@@ -27,11 +167,13 @@ class Masstree {
             if (old_root == nullptr) {
                 bool CAS_success = root.compare_exchange_weak(old_root, new_root);
                 if (CAS_success) {
-                    return;
+                    return nullptr;
                 } else {
                     // ハァ...ハァ...敗北者...?(new_rootを消す)
+                    countStats(stats, StatsCounter::RootCASFailure);
                     assert(new_root != nullptr);
                     assert(new_root->getIsBorder());
+                    new_root->lock();   // setDeletedはlockが前提なので(誰からも見えていないノードなので競合はしない)
                     new_root->setDeleted(true);
                     gc.add(reinterpret_cast<BorderNode*>(new_root));
                     goto RETRY;
@@ -42,23 +184,246 @@ class Masstree {
                 assert(old_root != nullptr);
                 root.store(new_root, std::memory_order_release);
             }
+            return old_value;
+        }
+
+        Value *insert(Key &key, Value *value, ThreadContext &ctx) {
+            MASSTREE_LATENCY_SCOPE(ctx, LatencyOp::Put);
+            return insert(key, value, ctx.getGC(), &ctx.getStats());
+        }
+
+        // keyが無い場合だけvalueをinsertしてnullptrを返す
+        // keyが既にある場合は何もせずに既存のValueを返す(valueの所有権は呼び出し側に残る)
+        Value *insert(Key &key, Value *value, GarbageCollector &gc, OperationStats *stats = nullptr) {
+            assert(value != nullptr);
+            // 既にある場合はlockを取らずに返す
+            Value *existing = get(key, stats);
+            if (existing != nullptr) return existing;
+            upsert(key, [&](Value *current) -> Value * {
+                existing = current;
+                return current == nullptr ? value : nullptr;
+            }, gc, stats);
+            return existing;
+        }
+
+        void upsert(Key &key, const UpsertFunction &fn, ThreadContext &ctx) {
+            MASSTREE_LATENCY_SCOPE(ctx, LatencyOp::Put);
+            upsert(key, fn, ctx.getGC(), &ctx.getStats());
+        }
+
+        // keyに対応するValueをfn(既存のValue or nullptr)の戻り値で置き換える
+        // 探索からBorderNodeのlock中の書き込みまでを1回の降下で行うので、read-modify-writeがatomicになる
+        void upsert(Key &key, const UpsertFunction &fn, GarbageCollector &gc, OperationStats *stats = nullptr) {
+        RETRY:
+            Node *old_root = root.load(std::memory_order_acquire);
+            if (old_root == nullptr) {
+                // 空の木の場合、putのようにValue入りのrootを作るとCASに負けたときにfnを呼び直すことになるので
+                // 先に空のrootを作ってからそこにupsertする(fnは必ずlock中に1回だけ呼ばれる)
+                BorderNode *empty_root = new BorderNode{};
+                empty_root->setIsRoot(true);
+                empty_root->setPermutation(Permutation{});
+                if (!root.compare_exchange_strong(old_root, empty_root)) {
+                    countStats(stats, StatsCounter::RootCASFailure);
+                    delete empty_root;  // 誰からも見えていないので即deleteしてよい
+                }
+                goto RETRY;
+            }
+            Value *old_value = nullptr;
+            std::pair<PutResult, Node*> resultPair = masstree_upsert(old_root, key, fn, old_value, gc, stats);
+            if (resultPair.first == RetryFromUpperLayer) {
+                countStats(stats, StatsCounter::PutRetryFromUpperLayer);
+                goto RETRY;
+            }
+            key.reset();
+            if (old_value != nullptr) gc.add(old_value);
+            // splitでrootが更新された場合Masstree自体のrootを更新する
+            if (old_root != resultPair.second) root.store(resultPair.second, std::memory_order_release);
+        }
+
+        bool compare_and_put(Key &key, Value *expected, Value *desired, ThreadContext &ctx) {
+            MASSTREE_LATENCY_SCOPE(ctx, LatencyOp::Put);
+            return compare_and_put(key, expected, desired, ctx.getGC(), &ctx.getStats());
+        }
+
+        // keyに対応するValueがexpected(ポインタの一致で比較、nullptrはkeyが無いことを表す)の場合だけdesiredを書き込む
+        // 書き込んだ場合trueを返す、置き換えられたexpectedはgcに入る
+        bool compare_and_put(Key &key, Value *expected, Value *desired, GarbageCollector &gc, OperationStats *stats = nullptr) {
+            assert(desired != nullptr);
+            bool success = false;
+            upsert(key, [&](Value *current) -> Value * {
+                if (current != expected) return nullptr;
+                success = true;
+                return desired;
+            }, gc, stats);
+            return success;
+        }
+
+        void remove(Key &key, ThreadContext &ctx) {
+            MASSTREE_LATENCY_SCOPE(ctx, LatencyOp::Remove);
+            remove(key, ctx.getGC(), &ctx.getStats());
+        }
+
+        void remove(Key &key, GarbageCollector &gc, OperationStats *stats = nullptr) {
+            remove_key(key, gc, stats, nullptr);
+        }
+
+        Value *take(Key &key, ThreadContext &ctx) {
+            MASSTREE_LATENCY_SCOPE(ctx, LatencyOp::Remove);
+            return take(key, ctx.getGC(), &ctx.getStats());
         }
 
+        // keyを消して、消したValueをgcに入れずに返す(キーが無ければnullptr)
+        // Valueを別の場所に移す場合に使う(返ったValueの所有権は呼び出し側に移る)
+        Value *take(Key &key, GarbageCollector &gc, OperationStats *stats = nullptr) {
+            Value *taken = nullptr;
+            remove_key(key, gc, stats, &taken);
+            return taken;
+        }
+
+        void scan(Key &left_key,
+                  bool l_exclusive,
+                  Key &right_key,
+                  bool r_exclusive,
+                  std::vector<std::pair<Key, Value*>> &result,
+                  ThreadContext &ctx) {
+            MASSTREE_LATENCY_SCOPE(ctx, LatencyOp::Scan);
+            scan(left_key, l_exclusive, right_key, r_exclusive, result, &ctx.getStats());
+        }
 
         // Scan results will be stored in a vector of <Key, Value> pairs, provided as an argument.
         void scan(Key &left_key,
                   bool l_exclusive,
                   Key &right_key,
                   bool r_exclusive,
-                  std::vector<std::pair<Key, Value*>> &result) {
+                  std::vector<std::pair<Key, Value*>> &result,
+                  OperationStats *stats = nullptr) {
             Node *root_ = root.load(std::memory_order_acquire);
             Key current_key = left_key;
             Status scan_status = Status::OK;
-            masstree_scan(root_, scan_status, current_key, left_key, l_exclusive, right_key, r_exclusive, result);
+            masstree_scan(root_, scan_status, current_key, left_key, l_exclusive, right_key, r_exclusive, result, stats);
             left_key.reset();
             right_key.reset();
         }
 
+        bool scan_prefix(const Key &prefix, const ScanVisitor &visitor, ThreadContext &ctx) {
+            MASSTREE_LATENCY_SCOPE(ctx, LatencyOp::Scan);
+            return scan_prefix(prefix, visitor, &ctx.getStats());
+        }
+
+        // prefixで始まるキーを昇順にvisitorに渡す(結果のコピーは作らない)
+        // visitorがfalseを返したらそこで止めてfalseを返す
+        bool scan_prefix(const Key &prefix, const ScanVisitor &visitor, OperationStats *stats = nullptr) {
+            Node *root_ = root.load(std::memory_order_acquire);
+            return masstree_scan_prefix(root_, prefix, visitor, stats);
+        }
+
+        // [lo, hi)のキーをnthreads個のスレッドで分担してvisitorに渡す(visitorはスレッドセーフであること)
+        // 区間はLayer0のInteriorNodeの境界で分けるので、各スレッドの担当するキーの数はだいたい揃う
+        bool parallel_scan(const Key &lo, const Key &hi, size_t nthreads, const ScanVisitor &visitor) {
+            Node *root_ = root.load(std::memory_order_acquire);
+            return masstree_parallel_scan(root_, lo, hi, nthreads, visitor);
+        }
+
+        SeekResult lower_bound(const Key &key, ThreadContext &ctx) {
+            MASSTREE_LATENCY_SCOPE(ctx, LatencyOp::Get);
+            return lower_bound(key, &ctx.getStats());
+        }
+
+        // key以上の最小のキーとValueを返す(なければstd::nullopt)
+        SeekResult lower_bound(const Key &key, OperationStats *stats = nullptr) {
+            return masstree_seek(root.load(std::memory_order_acquire), &key, true, stats);
+        }
+
+        SeekResult upper_bound(const Key &key, ThreadContext &ctx) {
+            MASSTREE_LATENCY_SCOPE(ctx, LatencyOp::Get);
+            return upper_bound(key, &ctx.getStats());
+        }
+
+        // keyより大きい最小のキーとValueを返す(なければstd::nullopt)
+        SeekResult upper_bound(const Key &key, OperationStats *stats = nullptr) {
+            return masstree_seek(root.load(std::memory_order_acquire), &key, false, stats);
+        }
+
+        SeekResult min(ThreadContext &ctx) {
+            MASSTREE_LATENCY_SCOPE(ctx, LatencyOp::Get);
+            return min(&ctx.getStats());
+        }
+
+        // 最小のキーとValueを返す(空ならstd::nullopt)、scanと違い1回降りるだけで済む
+        SeekResult min(OperationStats *stats = nullptr) {
+            return masstree_seek(root.load(std::memory_order_acquire), nullptr, true, stats);
+        }
+
+        SeekResult max(ThreadContext &ctx) {
+            MASSTREE_LATENCY_SCOPE(ctx, LatencyOp::Get);
+            return max(&ctx.getStats());
+        }
+
+        // 最大のキーとValueを返す(空ならstd::nullopt)
+        SeekResult max(OperationStats *stats = nullptr) {
+            return masstree_seek_last(root.load(std::memory_order_acquire), stats);
+        }
+
+        // [lo, hi)のキーの数を返す、exactでなければサンプリングによるO(log n)の推定値
+        size_t count_range(const Key &lo, const Key &hi, bool exact = false) const {
+            return static_cast<size_t>(masstree_count_range(root.load(std::memory_order_acquire), &lo, &hi, exact) + 0.5);
+        }
+
+        // keyより小さいキーの数を返す、exactでなければサンプリングによるO(log n)の推定値
+        size_t rank(const Key &key, bool exact = false) const {
+            return static_cast<size_t>(masstree_count_range(root.load(std::memory_order_acquire), nullptr, &key, exact) + 0.5);
+        }
+
+        // 小さい方から数えてk番目(0-indexed)のキーを返す、exactでなければ順位がだいたいkのキー
+        std::optional<Key> select(size_t k, bool exact = false) const {
+            return masstree_select(root.load(std::memory_order_acquire), k, exact);
+        }
+
+        // lockの取得が集中しているBorderNodeを、サンプル数の多い順に最大k個返す
+        // NOTE: ThreadContextかOperationStatsを渡した操作のlockだけがLOCK_SAMPLE_INTERVAL回に1回数えられる
+        std::vector<HotLeaf> hottest_leaves(size_t k) const {
+            return masstree_hottest_leaves(root.load(std::memory_order_acquire), k);
+        }
+
+        // 全てのBorderNodeのlockのサンプル数を0に戻す(集計する期間を区切る場合に呼ぶ)
+        void reset_lock_samples() {
+            masstree_reset_lock_samples(root.load(std::memory_order_acquire));
+        }
+
+        // hottest_leaves(k)のうちlock_samplesがmin_samples以上のBorderNodeを、キーの範囲が半分ずつになるようにsplitする
+        // lockを取り合うキーを別々のBorderNodeに分けて、lockの競合を減らすためのもの(定期的に呼ぶ想定)
+        // splitしたBorderNodeの数を返す、splitした2つのノードのサンプル数は0から数え直す
+        size_t split_hot_leaves(size_t k, uint32_t min_samples, OperationStats *stats = nullptr) {
+            size_t num_split = 0;
+            for (const HotLeaf &leaf : hottest_leaves(k)) {
+                if (leaf.lock_samples < min_samples) break;
+                Node *new_root = nullptr;
+                if (!split_leaf(leaf.node, new_root, stats)) continue;
+                leaf.node->resetLockSamples();
+                num_split++;
+                // 下位レイヤのrootが変わった場合は上位レイヤのBorderNodeが付け替えているので、Layer0の場合だけ更新する
+                if (new_root != nullptr && leaf.layer() == 0) root.store(new_root, std::memory_order_release);
+            }
+            return num_split;
+        }
+
     private:
+        // removeとtakeの共通部分(Layer0のrootの付け替えもここで行う)
+        void remove_key(Key &key, GarbageCollector &gc, OperationStats *stats, Value **taken) {
+            Node *old_root = root.load(std::memory_order_acquire);
+            std::pair<RootChange, Node*> resultPair = ::remove(old_root, key, gc, stats, taken);
+            key.reset();
+            if (resultPair.first == NewRoot) {
+                // Layer0のrootが付け替えられた場合
+                root.store(resultPair.second, std::memory_order_release);
+            } else if (resultPair.first == LayerDeleted) {
+                // Layer0が空になった場合、他スレッドが既に新しいrootを作っているかもしれないのでCASでnullptrにする
+                root.compare_exchange_strong(old_root, nullptr);
+            }
+        }
+
+        const PutMode put_mode = PutMode::Locking;
         std::atomic<Node *> root{nullptr};
+        std::mutex contextsMutex{};                             // contextsを保護するmutex(registerThread()でのみ使う)
+        std::deque<std::unique_ptr<ThreadContext>> contexts{};  // registerThread()で登録されたスレッドのThreadContext
 };
\ No newline at end of file
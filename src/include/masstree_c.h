@@ -0,0 +1,92 @@
+#ifndef MASSTREE_C_H
+#define MASSTREE_C_H
+
+/*
+ * libmasstreeのC API
+ * 他の言語からMasstreeを組み込むための薄いラッパで、ハンドルは全て中身の見えないポインタ、
+ * キーやValueは呼び出し側のバッファでやり取りする(ライブラリが確保したメモリを呼び出し側が解放することはない)
+ *
+ * - キーは1byte以上の任意のbyte列、Valueはint32_t
+ * - masstree_thread_register()で得たハンドルは、それを得たスレッドだけが使うこと(ThreadContextと同じ)
+ * - masstree_close()は全スレッドが操作を終えて、cursorを全て閉じてから呼ぶこと、登録したスレッドのハンドルもまとめて解放される
+ * - ABIを保つため、enumの値と構造体のフィールドは末尾に追加するだけで、変更も削除もしない
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__)
+#define MASSTREE_API __attribute__((visibility("default")))
+#else
+#define MASSTREE_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct masstree masstree_t;
+typedef struct masstree_thread masstree_thread_t;
+typedef struct masstree_cursor masstree_cursor_t;
+
+typedef enum masstree_status {
+    MASSTREE_OK = 0,
+    MASSTREE_NOT_FOUND = 1,         /* キーが無い、またはcursorが終端に着いた */
+    MASSTREE_BUFFER_TOO_SMALL = 2,  /* キーのバッファが足りない(必要な長さは*key_lenに入る) */
+    MASSTREE_INVALID_ARGUMENT = 3,  /* NULLのハンドルや長さ0のキーなど */
+    MASSTREE_NO_MEMORY = 4
+} masstree_status_t;
+
+/* masstree_get_stats()の結果 */
+typedef struct masstree_stats {
+    uint64_t keys;              /* Valueを持つキーの数 */
+    uint64_t layers;            /* レイヤの数 */
+    uint64_t border_nodes;
+    uint64_t interior_nodes;
+    uint64_t memory_bytes;      /* 木が使っているおおよそのバイト数 */
+    uint64_t retired_objects;   /* 登録済みスレッドのGCが保持している(まだ解放していない)ノードや値の数 */
+} masstree_stats_t;
+
+/* 空のMasstreeを作る(失敗したらNULL) */
+MASSTREE_API masstree_t *masstree_open(void);
+/* Masstreeと登録されたスレッドのハンドルを解放し、スレッドのGCに溜まっているノードや値も解放する */
+MASSTREE_API void masstree_close(masstree_t *tree);
+
+/* 呼び出したスレッド用のハンドルを返す(失敗したらNULL) */
+MASSTREE_API masstree_thread_t *masstree_thread_register(masstree_t *tree);
+/*
+ * 呼び出したスレッドのGCに溜まっている、putの置き換えやremoveで外れたValueとノードを解放する
+ * 解放したものを他のスレッドが読んでいるかもしれないので、他のスレッドがこの木のmasstree_*関数を実行していないときだけ呼ぶこと
+ * (全スレッドが揃うバリアの後など、cursorは開いたままでいい)
+ * 長く動かし続ける場合はこれを定期的に呼ばないと、外れたValueとノードはmasstree_close()まで解放されない
+ */
+MASSTREE_API masstree_status_t masstree_thread_quiesce(masstree_thread_t *thread);
+
+MASSTREE_API masstree_status_t masstree_get(masstree_thread_t *thread, const void *key, size_t key_len, int32_t *value);
+/* キーが無ければ追加し、あれば置き換える */
+MASSTREE_API masstree_status_t masstree_put(masstree_thread_t *thread, const void *key, size_t key_len, int32_t value);
+/* キーが無ければMASSTREE_NOT_FOUNDを返す */
+MASSTREE_API masstree_status_t masstree_remove(masstree_thread_t *thread, const void *key, size_t key_len);
+
+/*
+ * [lo, hi)のキーを昇順に返すcursorを開く(loがNULLなら最小のキーから、hiがNULLなら最大のキーまで)
+ * cursorは結果を溜めずにnextのたびに直前のキーの次を探すので、並行したput/removeは見えたり見えなかったりする
+ */
+MASSTREE_API masstree_cursor_t *masstree_cursor_open(masstree_thread_t *thread, const void *lo, size_t lo_len, const void *hi, size_t hi_len);
+/*
+ * 次のキーをkey_buf(長さkey_buf_len)に、そのValueを*valueに書いて進む(key_bufとvalueはNULLでもいい)
+ * 終端ならMASSTREE_NOT_FOUND、key_bufが短ければ*key_lenに必要な長さを入れてMASSTREE_BUFFER_TOO_SMALLを返し、進まない
+ */
+MASSTREE_API masstree_status_t masstree_cursor_next(masstree_cursor_t *cursor, void *key_buf, size_t key_buf_len, size_t *key_len, int32_t *value);
+MASSTREE_API void masstree_cursor_close(masstree_cursor_t *cursor);
+
+/* 木を走査して形とメモリ使用量を返す(writerと並行して呼べる) */
+MASSTREE_API masstree_status_t masstree_get_stats(masstree_t *tree, masstree_stats_t *stats);
+/* 登録済みの全スレッドで集計した操作カウンタ(名前は"border_split"などStatsCounterの名前) */
+MASSTREE_API masstree_status_t masstree_get_counter(masstree_t *tree, const char *name, uint64_t *value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MASSTREE_C_H */
@@ -0,0 +1,271 @@
+#pragma once
+
+#include <pthread.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <thread>
+
+#include "masstree.h"
+#include "spsc_queue.h"
+
+constexpr size_t DELEGATION_MAX_CLIENTS = 64;   // registerClient()できるクライアントの最大数
+constexpr size_t DELEGATION_QUEUE_SIZE = 256;   // クライアントとownerの組ごとのリクエストキューの長さ
+constexpr size_t DELEGATION_BATCH_SIZE = 32;    // ownerが1つのキューから続けて処理するリクエストの最大数
+constexpr size_t DELEGATION_IDLE_SPINS = 64;    // ownerがparkする前に、空のキューをyieldしながら見直す回数
+constexpr std::chrono::milliseconds DELEGATION_PARK_TIMEOUT{1}; // parkしたownerが起こされなくてもキューを見直すまでの時間
+
+enum class DelegatedOp : uint8_t {
+    Get,
+    Put,
+    Remove
+};
+
+// リクエストの結果を受け取る場所(クライアント側に置き、ownerが書き込んでdoneを立てる)
+struct DelegatedCompletion {
+    std::atomic<bool> done{false};
+    Value *result = nullptr;
+};
+
+// keyはクライアントのKeyを指す(クライアントはcompletionを待ってから戻るので、ownerが処理するまで生きている)
+// Keyはvectorを持つので、リクエストごとにコピーするとheapの確保が入る
+struct DelegatedRequest {
+    DelegatedOp op = DelegatedOp::Get;
+    Key *key = nullptr;
+    Value *value = nullptr;
+    DelegatedCompletion *completion = nullptr;
+};
+
+using DelegationQueue = SpscQueue<DelegatedRequest, DELEGATION_QUEUE_SIZE>;
+
+// キーの範囲で分けたパーティションをそれぞれ1つのownerスレッドが持ち、他のスレッドはSPSCキューでget/put/removeを依頼する
+// パーティションのMasstreeに触るのはownerだけなので、ノードのlockは競合せず、ノードのcache lineも1つのコアに留まる
+// 書き込みの偏ったワークロードで、lockを取り合って共有するよりもスケールする
+// ownerはキューが空の間しばらくyieldしながらpollし、それでも来なければクライアントにnotifyされるまでparkする
+// NOTE: poll中のownerはコアを使うので、パーティションの数はコアの数以下にすること
+class DelegatedMasstree {
+    public:
+        // 1つのスレッドからだけ使うこと(キューはクライアントとownerの組ごとのSPSCなので)
+        class Client {
+            public:
+                Client(const Client &other) = delete;
+                Client &operator=(const Client &other) = delete;
+
+                Value *get(Key &key) {
+                    DelegatedCompletion completion{};
+                    send({DelegatedOp::Get, &key, nullptr, &completion});
+                    return wait(completion);
+                }
+
+                // 置き換えた元のValueはownerのgcに入る
+                void put(Key &key, Value *value) {
+                    DelegatedCompletion completion{};
+                    send({DelegatedOp::Put, &key, value, &completion});
+                    wait(completion);
+                }
+
+                void remove(Key &key) {
+                    DelegatedCompletion completion{};
+                    send({DelegatedOp::Remove, &key, nullptr, &completion});
+                    wait(completion);
+                }
+
+                // keysを全て送ってから結果を待つ(ownerはキューに溜まった分をまとめて処理する)
+                // get()と同じくkeysのcursorは戻してから返る
+                std::vector<Value *> multi_get(std::vector<Key> &keys) {
+                    std::vector<DelegatedCompletion> completions(keys.size());
+                    for (size_t i = 0; i < keys.size(); i++) send({DelegatedOp::Get, &keys[i], nullptr, &completions[i]});
+                    std::vector<Value *> results(keys.size());
+                    for (size_t i = 0; i < keys.size(); i++) results[i] = wait(completions[i]);
+                    return results;
+                }
+
+            private:
+                friend class DelegatedMasstree;
+
+                Client(DelegatedMasstree &tree_, size_t num_partitions) : tree(tree_) {
+                    for (size_t i = 0; i < num_partitions; i++) queues.emplace_back(std::make_unique<DelegationQueue>());
+                }
+
+                void send(DelegatedRequest &&request) {
+                    size_t i = tree.partitionOf(*request.key);
+                    // キューが満杯ならownerが処理するのを待つ
+                    while (!queues[i]->push(std::move(request))) std::this_thread::yield();
+                    tree.wakeOwner(*tree.partitions[i]);
+                }
+
+                static Value *wait(DelegatedCompletion &completion) {
+                    while (!completion.done.load(std::memory_order_acquire)) std::this_thread::yield();
+                    return completion.result;
+                }
+
+                DelegatedMasstree &tree;
+                std::vector<std::unique_ptr<DelegationQueue>> queues{};    // ownerごとのリクエストキュー
+        };
+
+        // boundaries(昇順のLayer0のslice)でboundaries.size() + 1個のパーティションに分け、それぞれにownerスレッドを立てる
+        // pin_threadsならowner iをCPU i(を論理コア数で割った余り)に固定する
+        explicit DelegatedMasstree(const std::vector<uint64_t> &boundaries, bool pin_threads = false) {
+            assert(std::is_sorted(boundaries.begin(), boundaries.end()));
+            partitions.emplace_back(std::make_unique<Partition>());
+            for (uint64_t boundary : boundaries) {
+                partitions.emplace_back(std::make_unique<Partition>());
+                partitions.back()->lower = boundary;
+            }
+            unsigned num_cpus = std::max(1U, std::thread::hardware_concurrency());
+            for (size_t i = 0; i < partitions.size(); i++) {
+                Partition &partition = *partitions[i];
+                partition.owner = std::thread([this, &partition] { run(partition); });
+                if (pin_threads) {
+                    cpu_set_t cpus;
+                    CPU_ZERO(&cpus);
+                    CPU_SET(i % num_cpus, &cpus);
+                    pthread_setaffinity_np(partition.owner.native_handle(), sizeof(cpus), &cpus);
+                }
+            }
+        }
+
+        DelegatedMasstree(const DelegatedMasstree &other) = delete;
+        DelegatedMasstree &operator=(const DelegatedMasstree &other) = delete;
+
+        // 処理中のリクエストが全て終わってからownerを止める(クライアントは先に操作を終えていること)
+        ~DelegatedMasstree() {
+            stopping.store(true, std::memory_order_seq_cst);
+            for (auto &partition : partitions) {
+                std::lock_guard<std::mutex> lock(partition->parkMutex);
+                partition->wake.notify_one();
+            }
+            for (auto &partition : partitions) partition->owner.join();
+        }
+
+        // 呼び出したスレッド専用のClientを返す(DelegatedMasstreeが所有している)
+        Client &registerClient() {
+            std::lock_guard<std::mutex> lock(clientsMutex);
+            assert(clients.size() < DELEGATION_MAX_CLIENTS);
+            clients.emplace_back(new Client(*this, partitions.size()));
+            size_t id = clients.size() - 1;
+            // ownerはnum_clientsを読んでからqueuesを読むので、キューを置いてからnum_clientsを増やす
+            for (size_t i = 0; i < partitions.size(); i++) {
+                partitions[i]->queues[id].store(clients.back()->queues[i].get(), std::memory_order_release);
+                partitions[i]->num_clients.store(id + 1, std::memory_order_release);
+            }
+            return *clients.back();
+        }
+
+        size_t numPartitions() const {
+            return partitions.size();
+        }
+
+        // keyを担当するパーティションの番号
+        size_t partitionOf(const Key &key) const {
+            auto it = std::upper_bound(partitions.begin() + 1, partitions.end(), key.slices[0], [](uint64_t slice, const auto &partition) {
+                return slice < partition->lower;
+            });
+            return static_cast<size_t>(it - partitions.begin()) - 1;
+        }
+
+        // パーティションのMasstree(統計を取るなどの読み取り用)
+        const Masstree &partition(size_t i) const {
+            return partitions[i]->tree;
+        }
+
+        // 全ownerの操作カウンタを集計して返す
+        StatsSnapshot getStats() {
+            StatsSnapshot total{};
+            for (auto &partition_ : partitions) total.merge(partition_->tree.getStats());
+            return total;
+        }
+
+    private:
+        struct alignas(64) Partition {
+            uint64_t lower = 0;                                                         // 担当する最小のslice
+            Masstree tree{};
+            std::thread owner{};
+            std::array<std::atomic<DelegationQueue *>, DELEGATION_MAX_CLIENTS> queues{};  // クライアントごとのこのowner宛てのキュー
+            std::atomic<size_t> num_clients{0};
+            std::atomic<bool> parked{false};                                            // ownerがwakeで待っている(待とうとしている)
+            std::mutex parkMutex{};
+            std::condition_variable wake{};
+        };
+
+        // ownerスレッドの本体: 全クライアントのキューを順に見て、溜まっているリクエストをまとめて処理する
+        void run(Partition &partition) {
+            ThreadContext &ctx = partition.tree.registerThread();
+            DelegatedRequest request{};
+            size_t idle_rounds = 0;
+            while (true) {
+                bool idle = true;
+                size_t num_clients = partition.num_clients.load(std::memory_order_acquire);
+                for (size_t i = 0; i < num_clients; i++) {
+                    DelegationQueue *queue = partition.queues[i].load(std::memory_order_acquire);
+                    for (size_t n = 0; n < DELEGATION_BATCH_SIZE && queue->pop(request); n++) {
+                        apply(partition.tree, request, ctx);
+                        idle = false;
+                    }
+                }
+                if (!idle) {
+                    idle_rounds = 0;
+                    continue;
+                }
+                if (stopping.load(std::memory_order_acquire)) return;
+                if (++idle_rounds < DELEGATION_IDLE_SPINS) {
+                    std::this_thread::yield();
+                } else {
+                    park(partition);
+                    idle_rounds = 0;
+                }
+            }
+        }
+
+        // クライアントがnotifyするか、DELEGATION_PARK_TIMEOUTが過ぎるまで眠る
+        // parkedを立ててからキューを見直すので、その前にpushしたリクエストは見落とさず、後にpushしたクライアントはwakeOwner()で起こしてくれる
+        void park(Partition &partition) {
+            std::unique_lock<std::mutex> lock(partition.parkMutex);
+            partition.parked.store(true, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!hasRequests(partition) && !stopping.load(std::memory_order_seq_cst)) {
+                partition.wake.wait_for(lock, DELEGATION_PARK_TIMEOUT);
+            }
+            partition.parked.store(false, std::memory_order_relaxed);
+        }
+
+        static bool hasRequests(Partition &partition) {
+            size_t num_clients = partition.num_clients.load(std::memory_order_acquire);
+            for (size_t i = 0; i < num_clients; i++) {
+                if (partition.queues[i].load(std::memory_order_acquire)->size() > 0) return true;
+            }
+            return false;
+        }
+
+        // pushした後に呼ぶ、ownerがparkしていれば起こす
+        static void wakeOwner(Partition &partition) {
+            // push(release)とparkedの読み込みが入れ替わると、parkしたownerを起こし損ねる
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!partition.parked.load(std::memory_order_relaxed)) return;
+            std::lock_guard<std::mutex> lock(partition.parkMutex);
+            partition.wake.notify_one();
+        }
+
+        static void apply(Masstree &tree, DelegatedRequest &request, ThreadContext &ctx) {
+            Value *result = nullptr;
+            switch (request.op) {
+                case DelegatedOp::Get:
+                    result = tree.get(*request.key, ctx);
+                    break;
+                case DelegatedOp::Put:
+                    tree.put(*request.key, request.value, ctx);
+                    break;
+                case DelegatedOp::Remove:
+                    tree.remove(*request.key, ctx);
+                    break;
+            }
+            request.completion->result = result;
+            request.completion->done.store(true, std::memory_order_release);
+        }
+
+        std::vector<std::unique_ptr<Partition>> partitions{};
+        std::atomic<bool> stopping{false};
+        std::mutex clientsMutex{};
+        std::deque<std::unique_ptr<Client>> clients{};
+};
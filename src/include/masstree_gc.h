@@ -1,7 +1,132 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <unordered_set>
+
 #include "masstree_node.h"
 
+// 同じポインタを2回addしていないかをハッシュ表で確認するかどうか
+// 既定ではNDEBUGでなければ有効、-DMASSTREE_GC_DOUBLE_RETIRE_CHECK=1/0で明示的に切り替えられる
+#ifndef MASSTREE_GC_DOUBLE_RETIRE_CHECK
+#ifdef NDEBUG
+#define MASSTREE_GC_DOUBLE_RETIRE_CHECK 0
+#else
+#define MASSTREE_GC_DOUBLE_RETIRE_CHECK 1
+#endif
+#endif
+
+// GarbageCollectorが保持するものの種類(種類ごとのカウンタの添字)
+enum class RetiredType : uint8_t {
+    Border,
+    Interior,
+    Value,
+    Suffix,
+    NumTypes
+};
+
+constexpr size_t NUM_RETIRED_TYPES = static_cast<size_t>(RetiredType::NumTypes);
+
+// RetiredTypeの名前を返す(出力用)
+inline const char *retiredTypeName(RetiredType type) {
+    static constexpr std::array<const char *, NUM_RETIRED_TYPES> names = {
+        "border",
+        "interior",
+        "value",
+        "suffix",
+    };
+    return names[static_cast<size_t>(type)];
+}
+
+// 1つのchunkに入るポインタの数(chunk全体で1KBになる)
+constexpr size_t RETIRE_CHUNK_SIZE = 126;
+
+// 削除されたT *を溜めておくchunkのリスト
+// vectorと違って伸ばすときに中身をコピーしないので、addは常に定数時間で、溜まっている数によってlatencyが跳ねない
+// 解放は新しいchunkから行い、空になったchunkを1つだけ手元に残して次のaddで使い回す
+template <typename T>
+class RetireBuffer {
+    public:
+        RetireBuffer() = default;
+        RetireBuffer(const RetireBuffer &other) = delete;
+        RetireBuffer &operator=(const RetireBuffer &other) = delete;
+
+        // chunkだけを解放する(中身はrun()しない限り解放しない)
+        ~RetireBuffer() {
+            while (head != nullptr) {
+                Chunk *next = head->next;
+                delete head;
+                head = next;
+            }
+            delete spare;
+        }
+
+        void push(T *item) {
+            if (head == nullptr || head->count == RETIRE_CHUNK_SIZE) {
+                Chunk *chunk = (spare != nullptr) ? spare : new Chunk;
+                spare = nullptr;
+                chunk->count = 0;
+                chunk->next = head;
+                head = chunk;
+            }
+            head->items[head->count++] = item;
+            total++;
+        }
+
+        size_t size() const {
+            return total;
+        }
+
+        // 中身をotherと入れ替える(手元に残しているchunkは入れ替えない)
+        void swap(RetireBuffer &other) {
+            std::swap(head, other.head);
+            std::swap(total, other.total);
+        }
+
+        bool contains(const T *item) const {
+            for (Chunk *chunk = head; chunk != nullptr; chunk = chunk->next) {
+                if (std::find(chunk->items.begin(), chunk->items.begin() + chunk->count, item) != chunk->items.begin() + chunk->count) return true;
+            }
+            return false;
+        }
+
+        // 新しい方から最大limit個を取り出してfnに渡し、渡した数を返す
+        template <typename Fn>
+        size_t pop(size_t limit, Fn &&fn) {
+            size_t n = 0;
+            while (n < limit && head != nullptr) {
+                while (n < limit && head->count > 0) {
+                    fn(head->items[--head->count]);
+                    n++;
+                }
+                if (head->count > 0) break;
+                Chunk *next = head->next;
+                if (spare == nullptr) {
+                    spare = head;
+                } else {
+                    delete head;
+                }
+                head = next;
+            }
+            total -= n;
+            return n;
+        }
+
+    private:
+        struct Chunk {
+            std::array<T *, RETIRE_CHUNK_SIZE> items;
+            size_t count = 0;
+            Chunk *next = nullptr;
+        };
+
+        Chunk *head = nullptr;      // 一番新しいchunk(addはここに追記する)
+        Chunk *spare = nullptr;     // 空になったchunk(次にchunkが必要になったときに使う)
+        size_t total = 0;
+};
+
 class GarbageCollector {
     public:
         // コンストラクタ
@@ -13,60 +138,138 @@ class GarbageCollector {
         GarbageCollector &operator=(const GarbageCollector &other) = delete;
         // BorderNodeをGCに追加
         void add(BorderNode *borderNode) {
-            assert(!contain(borderNode));
             assert(borderNode->getDeleted());
-            borders.push_back(borderNode);
+            track(borderNode);
+            borders.push(borderNode);
+            count(retired, RetiredType::Border, 1);
         }
         // InteriorNodeをGCに追加
         void add(InteriorNode *interiorNode) {
-            assert(!contain(interiorNode));
             assert(interiorNode->getDeleted());
-            interiors.push_back(interiorNode);
+            track(interiorNode);
+            interiors.push(interiorNode);
+            count(retired, RetiredType::Interior, 1);
         }
         // ValueをGCに追加
         void add(Value *value) {
-            assert(!contain(value));
-            values.push_back(value);
+            track(value);
+            values.push(value);
+            count(retired, RetiredType::Value, 1);
         }
         // BigSuffixをGCに追加
         void add(BigSuffix *suffix) {
-            assert(!contain(suffix));
-            suffixes.push_back(suffix);
+            track(suffix);
+            suffixes.push(suffix);
+            count(retired, RetiredType::Suffix, 1);
         }
         // 指定したBorderNodeが格納されているか確認
-        bool contain(BorderNode const *borderNode) {
-            return std::find(borders.begin(), borders.end(), borderNode) != borders.end();
+        bool contain(BorderNode const *borderNode) const {
+            return contain(borders, borderNode);
         }
         // 指定したInteriorNodeが格納されているか確認
-        bool contain(InteriorNode const *interiorNode) {
-            return std::find(interiors.begin(), interiors.end(), interiorNode) != interiors.end();
+        bool contain(InteriorNode const *interiorNode) const {
+            return contain(interiors, interiorNode);
         }
         // 指定したValueが格納されているか確認
-        bool contain(Value const *value) {
-            return std::find(values.begin(), values.end(), value) != values.end();
+        bool contain(Value const *value) const {
+            return contain(values, value);
         }
         // 指定したBigSuffixが格納されているか確認
         bool contain(BigSuffix const *suffix) const {
-            return std::find(suffixes.begin(), suffixes.end(), suffix) != suffixes.end();
+            return contain(suffixes, suffix);
+        }
+        // 保持しているノードや値の数
+        size_t size() const {
+            return borders.size() + interiors.size() + values.size() + suffixes.size();
+        }
+        bool empty() const {
+            return size() == 0;
+        }
+        // 保持しているノードや値のおおよそのバイト数(BorderNodeが持つsuffixの表などは含まない)
+        size_t bytes() const {
+            return borders.size() * sizeof(BorderNode) + interiors.size() * sizeof(InteriorNode)
+                + values.size() * sizeof(Value) + suffixes.size() * sizeof(BigSuffix);
+        }
+        // これまでにaddされたtypeの数(持ち主以外のスレッドからも読める)
+        uint64_t getRetired(RetiredType type) const {
+            return retired[static_cast<size_t>(type)].load(std::memory_order_relaxed);
+        }
+        // これまでにこのGarbageCollectorのrun()で解放したtypeの数(持ち主以外のスレッドからも読める)
+        uint64_t getFreed(RetiredType type) const {
+            return freed[static_cast<size_t>(type)].load(std::memory_order_relaxed);
+        }
+        // 中身をotherと入れ替える(chunkのリストの入れ替えだけなので要素の数によらない、カウンタは入れ替えない)
+        void swap(GarbageCollector &other) {
+            borders.swap(other.borders);
+            interiors.swap(other.interiors);
+            values.swap(other.values);
+            suffixes.swap(other.suffixes);
+#if MASSTREE_GC_DOUBLE_RETIRE_CHECK
+            tracked.swap(other.tracked);
+#endif
+        }
+        // 保持しているノードや値を最大limit個解放して、解放した数を返す(少しずつ解放する場合に使う)
+        size_t run(size_t limit) {
+            size_t n = 0;
+            n += release(borders, RetiredType::Border, limit - n);
+            n += release(interiors, RetiredType::Interior, limit - n);
+            n += release(values, RetiredType::Value, limit - n);
+            n += release(suffixes, RetiredType::Suffix, limit - n);
+            return n;
         }
         // 保持している全てのノードや値を解放する
         void run() {
-            for (auto &borderNode : borders) delete borderNode;
-            borders.clear();
+            run(SIZE_MAX);
+        }
 
-            for (auto &interiorNode: interiors) delete interiorNode;
-            interiors.clear();
+    private:
+        template <typename T>
+        bool contain(const RetireBuffer<T> &buffer, const T *item) const {
+#if MASSTREE_GC_DOUBLE_RETIRE_CHECK
+            (void)buffer;
+            return tracked.count(item) != 0;
+#else
+            return buffer.contains(item);
+#endif
+        }
 
-            for (auto &value : values) delete value;
-            values.clear();
+        // 二重にaddされたらabortする(NDEBUGでも有効にできるよう、assertではなく直接止める)
+        void track([[maybe_unused]] const void *item) {
+#if MASSTREE_GC_DOUBLE_RETIRE_CHECK
+            if (!tracked.insert(item).second) {
+                std::fprintf(stderr, "GarbageCollector: %p was retired twice\n", item);
+                std::abort();
+            }
+#endif
+        }
 
-            for (auto &suffix : suffixes) delete suffix;
-            suffixes.clear();
+        // bufferの新しい方から最大limit個を解放する
+        template <typename T>
+        size_t release(RetireBuffer<T> &buffer, RetiredType type, size_t limit) {
+            size_t n = buffer.pop(limit, [&](T *item) {
+#if MASSTREE_GC_DOUBLE_RETIRE_CHECK
+                // 解放したアドレスは再利用されて、またaddされうる
+                tracked.erase(item);
+#endif
+                delete item;
+            });
+            count(freed, type, n);
+            return n;
         }
 
-    private:
-        std::vector<BorderNode *> borders{};        // 削除されたBorderNodeを格納するvector
-        std::vector<InteriorNode *> interiors{};    // 削除されたInteriorNodeを格納するvector
-        std::vector<Value *> values{};              // 削除されたValueを格納するvector
-        std::vector<BigSuffix *> suffixes{};        // 削除されたBigSuffixを格納するvector
-};
\ No newline at end of file
+        // 書き込むのは持ち主のスレッドだけなので、OperationStatsと同じくrelaxedなload/storeで足す
+        static void count(std::array<std::atomic<uint64_t>, NUM_RETIRED_TYPES> &counters, RetiredType type, uint64_t n) {
+            std::atomic<uint64_t> &c = counters[static_cast<size_t>(type)];
+            c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+
+        RetireBuffer<BorderNode> borders{};         // 削除されたBorderNode
+        RetireBuffer<InteriorNode> interiors{};     // 削除されたInteriorNode
+        RetireBuffer<Value> values{};               // 削除されたValue
+        RetireBuffer<BigSuffix> suffixes{};         // 削除されたBigSuffix
+#if MASSTREE_GC_DOUBLE_RETIRE_CHECK
+        std::unordered_set<const void *> tracked{}; // 保持している全てのポインタ(二重addの検出とcontainに使う)
+#endif
+        std::array<std::atomic<uint64_t>, NUM_RETIRED_TYPES> retired{};
+        std::array<std::atomic<uint64_t>, NUM_RETIRED_TYPES> freed{};
+};
@@ -2,4 +2,4 @@
 
 #include "masstree_node.h"
 
-Value *masstree_get(Node *root, Key &key);
\ No newline at end of file
+Value *masstree_get(Node *root, Key &key, OperationStats *stats = nullptr);
\ No newline at end of file
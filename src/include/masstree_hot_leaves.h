@@ -0,0 +1,28 @@
+#pragma once
+
+#include <optional>
+#include <vector>
+
+#include "masstree_scan.h"
+
+// lockの取得が集中しているBorderNode(hot leaf)の情報
+struct HotLeaf {
+    BorderNode *node = nullptr;
+    std::vector<uint64_t> prefix{};         // nodeのレイヤまでの上位レイヤのslice(Layer0なら空)
+    uint64_t lowest_slice = 0;              // 担当範囲の下限(親のInteriorNodeのseparatorで決まる、左端なら0)
+    std::optional<uint64_t> next_slice{};   // 担当範囲の上限(その値は含まない、findBorderのupper_boundと同じ、右端ならstd::nullopt)
+    size_t num_keys = 0;
+    uint32_t lock_samples = 0;              // サンプリングしたlockの取得回数(LOCK_SAMPLE_INTERVAL回に1回数えている)
+    uint32_t contended_samples = 0;         // そのうちlockが取れずに待った回数
+
+    size_t layer() const {
+        return prefix.size();
+    }
+};
+
+// rootから辿れるBorderNodeのうち、lock_samplesが多い順に最大k個を返す(lock_samplesが0のものは返さない)
+// NOTE: writerと並行して呼び出せるが、ノード単位で一貫した値を読んでいるだけなので、全体としては近似値になる
+std::vector<HotLeaf> masstree_hottest_leaves(Node *root, size_t k);
+
+// rootから辿れる全てのBorderNodeのlockのサンプル数を0に戻す
+void masstree_reset_lock_samples(Node *root);
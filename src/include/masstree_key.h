@@ -32,6 +32,23 @@ class Key {
         Key(std::vector<uint64_t> slices_, size_t lastSliceSize_) : slices(std::move(slices_)), lastSliceSize(lastSliceSize_) {
             assert(1 <= lastSliceSize && lastSliceSize <= 8);
         }
+        // byte列(len >= 1)から作る、sliceには先頭のbyteから上位bitに詰める(最後のスライスの残りは0埋め)
+        static Key fromBytes(const void *bytes, size_t len) {
+            assert(len >= 1);
+            const auto *p = static_cast<const uint8_t *>(bytes);
+            std::vector<uint64_t> slices_((len + 7) / 8, 0);
+            for (size_t i = 0; i < len; i++) slices_[i / 8] |= static_cast<uint64_t>(p[i]) << ((7 - i % 8) * 8);
+            return Key(std::move(slices_), len - (slices_.size() - 1) * 8);
+        }
+        // キー全体のbyte数
+        size_t length() const {
+            return (slices.size() - 1) * 8 + lastSliceSize;
+        }
+        // fromBytesの逆、bufにlength() byteを書く
+        void toBytes(void *buf) const {
+            auto *p = static_cast<uint8_t *>(buf);
+            for (size_t i = 0; i < length(); i++) p[i] = static_cast<uint8_t>(slices[i / 8] >> ((7 - i % 8) * 8));
+        }
         // 次のスライスが存在するかどうかを確認する
         bool hasNext() const {
             if (slices.size() == cursor + 1) return false;
@@ -0,0 +1,229 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+// 計測対象の操作
+enum class LatencyOp : uint8_t {
+    Get,
+    Put,
+    Scan,
+    Remove,
+    NumOps
+};
+
+constexpr size_t NUM_LATENCY_OPS = static_cast<size_t>(LatencyOp::NumOps);
+
+inline const char *latencyOpName(LatencyOp op) {
+    static constexpr std::array<const char *, NUM_LATENCY_OPS> names = {"get", "put", "scan", "remove"};
+    return names[static_cast<size_t>(op)];
+}
+
+/*
+ * HDR Histogramと同じlog-linearなbucket
+ * - 16未満の値はそのままbucket[value]に入る
+ * - 16以上の値は最上位bitの位置(2の冪)ごとに16個のsub-bucketに分ける
+ * そのため、どの値でも相対誤差は1/16(6.25%)以下になる
+ */
+struct LatencyBuckets {
+    static constexpr size_t SUB_BUCKET_BITS = 4;
+    static constexpr size_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static constexpr size_t NUM_BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    // 値(ns)が入るbucketのindexを返す
+    static constexpr size_t indexOf(uint64_t value) {
+        if (value < SUB_BUCKETS) return value;
+        size_t msb = 63 - __builtin_clzll(value);
+        size_t shift = msb - SUB_BUCKET_BITS;
+        size_t sub = (value >> shift) & (SUB_BUCKETS - 1);
+        return (shift + 1) * SUB_BUCKETS + sub;
+    }
+    // bucketに入る値の最小値
+    static constexpr uint64_t lowerBound(size_t index) {
+        if (index < SUB_BUCKETS) return index;
+        size_t shift = index / SUB_BUCKETS - 1;
+        size_t sub = index % SUB_BUCKETS;
+        return (SUB_BUCKETS + sub) << shift;
+    }
+    // bucketに入る値の最大値
+    static constexpr uint64_t upperBound(size_t index) {
+        if (index < SUB_BUCKETS) return index;
+        size_t shift = index / SUB_BUCKETS - 1;
+        return lowerBound(index) + ((uint64_t(1) << shift) - 1);
+    }
+};
+
+// 集計済みのhistogram(LatencyHistogramのスナップショット)、スレッド間でmergeできる
+struct LatencySnapshot {
+    std::array<uint64_t, LatencyBuckets::NUM_BUCKETS> buckets{};
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+
+    void merge(const LatencySnapshot &other) {
+        for (size_t i = 0; i < LatencyBuckets::NUM_BUCKETS; i++) buckets[i] += other.buckets[i];
+        count += other.count;
+        sum += other.sum;
+        if (other.max > max) max = other.max;
+    }
+
+    uint64_t mean() const {
+        return count == 0 ? 0 : sum / count;
+    }
+
+    // q(0.0~1.0)分位点の値を返す、bucketの上限を返すので実際の値以上になる
+    uint64_t percentile(double q) const {
+        if (count == 0) return 0;
+        uint64_t target = static_cast<uint64_t>(q * count);
+        if (target == 0) target = 1;
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < LatencyBuckets::NUM_BUCKETS; i++) {
+            cumulative += buckets[i];
+            if (cumulative >= target) return std::min(LatencyBuckets::upperBound(i), max);
+        }
+        return max;
+    }
+};
+
+// スレッドごとに持つhistogram
+// NOTE: OperationStatsと同じく書き込むのは持ち主のスレッドだけなので、relaxedなload/storeで更新する
+class LatencyHistogram {
+    public:
+        LatencyHistogram() = default;
+        // コピーコンストラクタと代入演算子の削除
+        LatencyHistogram(LatencyHistogram &&other) = delete;
+        LatencyHistogram(const LatencyHistogram &other) = delete;
+        LatencyHistogram &operator=(LatencyHistogram &&other) = delete;
+        LatencyHistogram &operator=(const LatencyHistogram &other) = delete;
+
+        inline void record(uint64_t nanoseconds) {
+            increment(buckets[LatencyBuckets::indexOf(nanoseconds)], 1);
+            increment(count, 1);
+            increment(sum, nanoseconds);
+            if (nanoseconds > max.load(std::memory_order_relaxed)) max.store(nanoseconds, std::memory_order_relaxed);
+        }
+
+        LatencySnapshot snapshot() const {
+            LatencySnapshot s{};
+            for (size_t i = 0; i < LatencyBuckets::NUM_BUCKETS; i++) s.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+            s.count = count.load(std::memory_order_relaxed);
+            s.sum = sum.load(std::memory_order_relaxed);
+            s.max = max.load(std::memory_order_relaxed);
+            return s;
+        }
+
+    private:
+        static inline void increment(std::atomic<uint64_t> &c, uint64_t n) {
+            c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+
+        std::array<std::atomic<uint64_t>, LatencyBuckets::NUM_BUCKETS> buckets{};
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sum{0};
+        std::atomic<uint64_t> max{0};
+};
+
+// 全操作分のhistogramのスナップショット、text/JSONで出力できる
+struct LatencyReport {
+    std::array<LatencySnapshot, NUM_LATENCY_OPS> ops{};
+
+    const LatencySnapshot &operator[](LatencyOp op) const {
+        return ops[static_cast<size_t>(op)];
+    }
+
+    void merge(const LatencyReport &other) {
+        for (size_t i = 0; i < NUM_LATENCY_OPS; i++) ops[i].merge(other.ops[i]);
+    }
+
+    // 1行1操作で出力する(単位はns)
+    std::string toText() const {
+        std::ostringstream out;
+        for (size_t i = 0; i < NUM_LATENCY_OPS; i++) {
+            const LatencySnapshot &s = ops[i];
+            out << latencyOpName(static_cast<LatencyOp>(i))
+                << " count=" << s.count
+                << " mean=" << s.mean()
+                << " p50=" << s.percentile(0.5)
+                << " p90=" << s.percentile(0.9)
+                << " p99=" << s.percentile(0.99)
+                << " p99.9=" << s.percentile(0.999)
+                << " max=" << s.max << "\n";
+        }
+        return out.str();
+    }
+
+    // 空でないbucketも含めてJSONで出力する(単位はns)
+    std::string toJSON() const {
+        std::ostringstream out;
+        out << "{";
+        for (size_t i = 0; i < NUM_LATENCY_OPS; i++) {
+            const LatencySnapshot &s = ops[i];
+            if (i != 0) out << ",";
+            out << "\"" << latencyOpName(static_cast<LatencyOp>(i)) << "\":{"
+                << "\"count\":" << s.count
+                << ",\"mean\":" << s.mean()
+                << ",\"p50\":" << s.percentile(0.5)
+                << ",\"p90\":" << s.percentile(0.9)
+                << ",\"p99\":" << s.percentile(0.99)
+                << ",\"p99.9\":" << s.percentile(0.999)
+                << ",\"max\":" << s.max
+                << ",\"buckets\":[";
+            bool first = true;
+            for (size_t b = 0; b < LatencyBuckets::NUM_BUCKETS; b++) {
+                if (s.buckets[b] == 0) continue;
+                if (!first) out << ",";
+                out << "[" << LatencyBuckets::lowerBound(b) << "," << s.buckets[b] << "]";
+                first = false;
+            }
+            out << "]}";
+        }
+        out << "}";
+        return out.str();
+    }
+};
+
+// スレッドごとに持つ、全操作分のhistogram
+class LatencyRecorder {
+    public:
+        inline LatencyHistogram &operator[](LatencyOp op) {
+            return histograms[static_cast<size_t>(op)];
+        }
+
+        LatencyReport report() const {
+            LatencyReport r{};
+            for (size_t i = 0; i < NUM_LATENCY_OPS; i++) r.ops[i] = histograms[i].snapshot();
+            return r;
+        }
+
+    private:
+        std::array<LatencyHistogram, NUM_LATENCY_OPS> histograms{};
+};
+
+// スコープの開始から終了までの時間をhistogramに記録する
+class LatencyTimer {
+    public:
+        explicit LatencyTimer(LatencyHistogram &histogram_) : histogram(histogram_), start(std::chrono::steady_clock::now()) {}
+        ~LatencyTimer() {
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+        }
+        LatencyTimer(const LatencyTimer &other) = delete;
+        LatencyTimer &operator=(const LatencyTimer &other) = delete;
+
+    private:
+        LatencyHistogram &histogram;
+        std::chrono::steady_clock::time_point start;
+};
+
+// MASSTREE_LATENCY_HISTOGRAMが定義されていない場合は計測処理自体を消す
+#ifdef MASSTREE_LATENCY_HISTOGRAM
+#define MASSTREE_LATENCY_SCOPE(ctx, op) LatencyTimer masstree_latency_timer_((ctx).getLatency()[op])
+#else
+#define MASSTREE_LATENCY_SCOPE(ctx, op)
+#endif
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <atomic>
 #include <tuple>
 #include <cassert>
@@ -12,11 +13,25 @@
 #include "masstree_version.h"
 #include "masstree_value.h"
 #include "masstree_key.h"
+#include "masstree_stats.h"
 #include "permutation.h"
 
 class InteriorNode;
 class BorderNode;
 
+// lockを持ったwriterがinserting/splittingを立てた後にフィールドを書き換えるときのmemory order
+// readerは version(acquire) -> 各フィールド(acquire) -> version(acquire) の順に読んで、versionが変わっていたらやり直す
+// writerは inserting/splittingを立てる -> Node::beginLockedWrites()(release fence) -> フィールド(relaxed) -> unlock(release)
+// の順に書けば、readerがrelaxedで書かれた新しい値を1つでも読んだ場合、その値を書く前のfenceとreaderのacquire loadが同期して、
+// 後から読むversionには必ずinserting/splittingが見える(やり直しになる)。新しい値を1つも読んでいなければ古い一貫した内容を読んでいる
+// fenceより前に作ったノードやBigSuffix、Valueもfenceで公開されるので、フィールドに入れる時点でreleaseにする必要はない
+// NOTE: TSANはfenceを扱えない(同期として見ない)ので、TSANでビルドするときはreleaseのままにしておく
+#if defined(__SANITIZE_THREAD__)
+constexpr std::memory_order LOCKED_WRITE_ORDER = std::memory_order_release;
+#else
+constexpr std::memory_order LOCKED_WRITE_ORDER = std::memory_order_relaxed;
+#endif
+
 class Node {
     public:
         static constexpr size_t ORDER = 16;
@@ -36,17 +51,41 @@ class Node {
             return v;
         }
         // ロックを取得する
-        void lock() {
+        // statsが渡された場合はロックが取れずに回った回数を数える
+        void lock(OperationStats *stats = nullptr) {
             Version expected, desired;
+            uint64_t spin = 0;
             for (;;) {
                 expected = getVersion();
                 if (!expected.locked) { // ロックが取れる場合
                     desired = expected;
                     desired.locked = true;
-                    if (version.compare_exchange_weak(expected, desired)) return;
+                    if (version.compare_exchange_weak(expected, desired)) break;
                 }
+                spin++;
+            }
+            if (spin != 0) countStats(stats, StatsCounter::LockSpin, spin);
+            // BorderNodeのlockの取得をサンプリングして、どのBorderNodeにlockが集中しているかを数える
+            if (stats != nullptr && desired.is_border && stats->sampleLock()) {
+                lock_samples.store(lock_samples.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                if (spin != 0) contended_samples.store(contended_samples.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
             }
         }
+        // ロックが取れなければ待たずにfalseを返す
+        bool tryLock() {
+            Version expected = getVersion();
+            if (expected.locked) return false;
+            Version desired = expected;
+            desired.locked = true;
+            return version.compare_exchange_strong(expected, desired);
+        }
+        // inserting/splittingを立てた後、LOCKED_WRITE_ORDERでフィールドを書き始める前に呼ぶ
+        // それまでのstore(inserting/splittingや、書き込むノード・Suffixの中身)が後のrelaxed storeより先に見えるようにする
+        static inline void beginLockedWrites() {
+#if !defined(__SANITIZE_THREAD__)
+            std::atomic_thread_fence(std::memory_order_release);
+#endif
+        }
         // ロックを解除する
         void unlock() {
             Version v = getVersion();
@@ -156,10 +195,10 @@ class Node {
         }
 
         // 親ノードのロックを取得する
-        InteriorNode *lockedParent() const {
+        InteriorNode *lockedParent(OperationStats *stats = nullptr) const {
         RETRY:
             Node *p = reinterpret_cast<Node *>(getParent());
-            if (p != nullptr) p->lock();
+            if (p != nullptr) p->lock(stats);
             // pのロック中にpの親が変わってないかの確認((T1)getParent -> (T2)setParent -> (T1)locked)
             if (p != reinterpret_cast<Node *>(getParent())) {
                 assert(p != nullptr);
@@ -169,10 +208,10 @@ class Node {
             return reinterpret_cast<InteriorNode *>(p);
         }
         // UpperLayer(上層ノード)のロックを取得する
-        BorderNode *lockedUpperNode() const {
+        BorderNode *lockedUpperNode(OperationStats *stats = nullptr) const {
         RETRY:
             Node *p = reinterpret_cast<Node *>(getUpperLayer());
-            if (p != nullptr) p->lock();
+            if (p != nullptr) p->lock(stats);
             // pのロック中にpのUpperLayerが変わってないかの確認((T1)getUpperLayer -> (T2)setUpperLayer -> (T1)locked)
             if (p != reinterpret_cast<Node *>(getUpperLayer())) {
                 assert(p != nullptr);
@@ -190,11 +229,28 @@ class Node {
         inline bool isUnlocked() const {
             return !isLocked();
         }
+
+        // サンプリングしたlockの取得回数と、そのうちlockが取れずに待った回数
+        inline uint32_t getLockSamples() const {
+            return lock_samples.load(std::memory_order_relaxed);
+        }
+
+        inline uint32_t getContendedSamples() const {
+            return contended_samples.load(std::memory_order_relaxed);
+        }
+
+        // NOTE: lockを取らずに書くので、並行してlockを取ったスレッドの分が消えることがある(サンプルなので気にしない)
+        inline void resetLockSamples() {
+            lock_samples.store(0, std::memory_order_relaxed);
+            contended_samples.store(0, std::memory_order_relaxed);
+        }
     
     private:
         std::atomic<Version> version = {};
         std::atomic<InteriorNode *> parent;
         std::atomic<BorderNode *> upperLayer;
+        std::atomic<uint32_t> lock_samples{0};          // lockの持ち主だけが書く(resetLockSamplesを除く)
+        std::atomic<uint32_t> contended_samples{0};
 };
 
 class InteriorNode : public Node {
@@ -208,6 +264,17 @@ class InteriorNode : public Node {
             }
             return getChild(num_keys);
         }
+        // findChildと同じだが、返す子ノードの右側にseparatorがあればそれをupper_boundに入れる(無ければupper_boundはそのまま)
+        Node *findChild(uint64_t slice, std::optional<uint64_t> &upper_bound) {
+            uint8_t num_keys = getNumKeys();
+            for (size_t i = 0; i < num_keys; i++) {
+                if (slice < key_slice[i]) {
+                    upper_bound = key_slice[i];
+                    return getChild(i);
+                }
+            }
+            return getChild(num_keys);
+        }
         // ノードが満杯でないか確認
         inline bool isNotFull() const {
             return (getNumKeys() != ORDER - 1);
@@ -238,17 +305,18 @@ class InteriorNode : public Node {
             return n_keys.load(std::memory_order_acquire);
         }
 
-        inline void setNumKeys(uint8_t nKeys) {
+        inline void setNumKeys(uint8_t nKeys, std::memory_order order = std::memory_order_release) {
             // storeRelease(n_keys, nKeys);    // TODO: wrapperの作成
-            n_keys.store(nKeys, std::memory_order_release);
+            n_keys.store(nKeys, order);
         }
 
-        inline void incNumKeys() {
-            n_keys.fetch_add(1);
+        // n_keysを書くのはlockを持ったwriterだけなので、RMWにせずにloadとstoreで足りる
+        inline void incNumKeys(std::memory_order order = std::memory_order_release) {
+            n_keys.store(n_keys.load(std::memory_order_relaxed) + 1, order);
         }
 
-        inline void decNumKeys() {
-            n_keys.fetch_sub(1);
+        inline void decNumKeys(std::memory_order order = std::memory_order_release) {
+            n_keys.store(n_keys.load(std::memory_order_relaxed) - 1, order);
         }
 
         inline uint64_t getKeySlice(size_t index) const {
@@ -256,13 +324,13 @@ class InteriorNode : public Node {
             return key_slice[index].load(std::memory_order_acquire);
         }
 
-        void resetKeySlices() {
-            for (size_t i = 0; i < ORDER - 1; i++) setKeySlice(i, 0);
+        void resetKeySlices(std::memory_order order = std::memory_order_release) {
+            for (size_t i = 0; i < ORDER - 1; i++) setKeySlice(i, 0, order);
         }
 
-        inline void setKeySlice(size_t index, const uint64_t &slice) {
+        inline void setKeySlice(size_t index, const uint64_t &slice, std::memory_order order = std::memory_order_release) {
             // storeRelease(key_slice[index], slice);  // TODO: wrapperの作成
-            key_slice[index].store(slice, std::memory_order_release);
+            key_slice[index].store(slice, order);
         }
 
         inline Node *getChild(size_t index) const {
@@ -270,15 +338,15 @@ class InteriorNode : public Node {
             return child[index].load(std::memory_order_acquire);
         }
 
-        inline void setChild(size_t index, Node *c) {
+        inline void setChild(size_t index, Node *c, std::memory_order order = std::memory_order_release) {
             assert(0 <= index && index <= 15);
             // storeRelease(child[index], child);  // TODO: wrapperの作成
-            child[index].store(c, std::memory_order_release);
+            child[index].store(c, order);
         }
         // bool debug_contain_child
 
-        void resetChildren() {
-            for (size_t i = 0; i < ORDER; i++) setChild(i, nullptr);
+        void resetChildren(std::memory_order order = std::memory_order_release) {
+            for (size_t i = 0; i < ORDER; i++) setChild(i, nullptr, order);
         }
 
     private:
@@ -362,6 +430,19 @@ public:
         return true;
     }
 
+    // 中身を変えずに、残りのスライスをkeyの後ろに付け足す(scanでキーを組み立てる用)
+    void appendTo(Key &key) {
+        std::lock_guard<std::mutex> lock(suffixMutex);
+        key.slices.insert(key.slices.end(), slices.begin(), slices.end());
+        key.lastSliceSize = lastSliceSize;
+    }
+
+    // このBigSuffixが使っているメモリ量(byte)を返す
+    size_t bytes() {
+        std::lock_guard<std::mutex> lock(suffixMutex);
+        return sizeof(BigSuffix) + slices.capacity() * sizeof(uint64_t);
+    }
+
     // 指定したキーと開始位置から新しいBigSuffixを作成
     static BigSuffix *from(const Key &key, size_t from) {
         std::vector<uint64_t> temp{};
@@ -379,24 +460,40 @@ private:
 
 // KeySuffixはBorderNode内のすべてのkeyのSuffixへの参照を一元管理する
 // 各SuffixはBigSuffixオブジェクトへのポインタとして保持される
+// NOTE: 8byte以下のキーしか持たないBorderNodeではSuffixを使わないので、ポインタ配列(SuffixTable)は最初にSuffixをセットするタイミングで確保する
 class KeySuffix {
 public:
     KeySuffix() = default;
+    // SuffixTableはKeySuffixが所有している(BigSuffix自体はGCが解放するのでここでは消さない)
+    ~KeySuffix() {
+        delete table.load(std::memory_order_acquire);
+    }
+    // コピーコンストラクタと代入演算子の削除
+    KeySuffix(const KeySuffix &other) = delete;
+    KeySuffix &operator=(const KeySuffix &other) = delete;
+    KeySuffix(KeySuffix &&other) = delete;
+    KeySuffix &operator=(KeySuffix &&other) = delete;
     
     // 指定されたインデックス位置に、指定されたkeyから取得したSuffixをセットする
     inline void set(size_t i, const Key &key, size_t from) {
-        // storeRelease(suffixes[i], BigSuffix::from(key, from));   // TODO: wrapperの作成
-        suffixes[i].store(BigSuffix::from(key, from), std::memory_order_release);
+        set(i, BigSuffix::from(key, from));
     }
     // 指定されたインデックス位置にBigSuffixへのポインタをセットする
     inline void set(size_t i, BigSuffix *const &ptr) {
+        SuffixTable *t = table.load(std::memory_order_acquire);
+        if (t == nullptr) {
+            if (ptr == nullptr) return; // 未確保ならnullptrをセットする必要はない
+            t = allocateTable();
+        }
         // storeRelease(suffixes[i], ptr); // TODO: wrapperの作成
-        suffixes[i].store(ptr, std::memory_order_release);
+        (*t)[i].store(ptr, std::memory_order_release);
     }
     // 指定されたインデックスのBigSuffixへのポインタを取得する
     inline BigSuffix *get(size_t i) const {
         // loadAcquire(suffixes[i]);    // TODO: wrapperの作成
-        return suffixes[i].load(std::memory_order_acquire);
+        SuffixTable *t = table.load(std::memory_order_acquire);
+        if (t == nullptr) return nullptr;
+        return (*t)[i].load(std::memory_order_acquire);
     }
     // 指定されたインデックス(=suffixes[i])のSuffixへの参照を外す
     void unreferenced(size_t i) {
@@ -412,20 +509,47 @@ public:
     }
     // すべてのSuffixを削除する
     void delete_all() {
+        if (!isAllocated()) return;
         for (size_t i = 0; i < Node::ORDER - 1; i++) {
             BigSuffix *ptr = get(i);
             if (ptr != nullptr) delete_ptr(i);
         }
     }
     // suffixes配列をリセットする(全てnullptrで初期化する)、主にsplit操作などで使用される
+    // NOTE: split後もsuffixを持つキーが入る可能性が高いので、確保済みのSuffixTableは解放せずに使い回す
     void reset() {
-        std::fill(suffixes.begin(), suffixes.end(), nullptr);
+        SuffixTable *t = table.load(std::memory_order_acquire);
+        if (t == nullptr) return;
+        for (auto &suffix : *t) suffix.store(nullptr, std::memory_order_release);
+    }
+    // SuffixTableが確保済みかを返す
+    inline bool isAllocated() const {
+        return table.load(std::memory_order_acquire) != nullptr;
     }
 
 private:
-    // BigSuffixへのポインタを保持する配列
-    // BorderNode内のすべてのkeyのSuffixを一元管理するためのデータ構造
-    std::array<std::atomic<BigSuffix*>, Node::ORDER - 1> suffixes = {};
+    using SuffixTable = std::array<std::atomic<BigSuffix*>, Node::ORDER - 1>;
+
+public:
+    // 確保したSuffixTable1つあたりのサイズ(byte)
+    static constexpr size_t TABLE_BYTES = sizeof(SuffixTable);
+
+private:
+    // SuffixTableを確保する
+    // 基本的にはBorderNodeのlockを持っているwriterしか呼ばないけど、lock無しでsetするパスもあるのでCASで競争に負けたら捨てる
+    SuffixTable *allocateTable() {
+        SuffixTable *desired = new SuffixTable{};
+        SuffixTable *expected = nullptr;
+        if (table.compare_exchange_strong(expected, desired, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            return desired;
+        }
+        delete desired;
+        return expected;
+    }
+
+    // BigSuffixへのポインタを保持する配列(SuffixTable)へのポインタ
+    // BorderNode内のすべてのkeyのSuffixを一元管理するためのデータ構造、Suffixが1つもない間はnullptr
+    std::atomic<SuffixTable*> table{nullptr};
 };
 
 enum SearchResult: uint8_t {
@@ -435,6 +559,23 @@ enum SearchResult: uint8_t {
     UNSTABLE
 };
 
+enum class CombiningState : uint8_t {
+    Pending,    // まだlockの持ち主に処理されていない
+    Done,       // lockの持ち主が代わりにputした
+    Retry       // lockの持ち主が処理できなかった(依頼した側が通常のputでやり直す)
+};
+
+// BorderNodeのlockを待っている間に、lockの持ち主にputを代わりにやってもらうためのリクエスト(flat combining)
+// 依頼した側のスタックに置き、stateがPendingでなくなるまで依頼した側は触らない
+struct CombiningRequest {
+    Key *key = nullptr;                 // BorderNodeのレイヤにcursorがあるキー
+    Value *value = nullptr;
+    Version version{};                  // 依頼した側がfindBorderでBorderNodeを見つけたときのversion
+    Value *old_value = nullptr;         // Doneのとき、置き換えられた元のValue(insertした場合はnullptr)
+    CombiningRequest *next = nullptr;   // BorderNodeに積まれているリクエストのリスト
+    std::atomic<CombiningState> state{CombiningState::Pending};
+};
+
 class BorderNode : public Node {
     public:
         // キーの長さや状態を示すための特殊な値
@@ -478,7 +619,7 @@ class BorderNode : public Node {
                 for (size_t i = 0; i < permutation.getNumKeys(); i++) {
                     uint8_t trueIndex = permutation(i);
                     if (getKeySlice(trueIndex) == current.slice && getKeyLen(trueIndex) == current.size) {
-                        return std::make_tuple(VALUE, getLV(trueIndex), trueIndex);
+                        return valueOrUnstable(trueIndex);
                     }
                 }
             } else {    // 次のスライスがある場合(current layerにはvalueがないので下位ノードを辿るためのLinkを探す)
@@ -489,7 +630,7 @@ class BorderNode : public Node {
                             // suffixの中を見る
                             BigSuffix *suffix = getKeySuffixes().get(trueIndex);
                             if (suffix != nullptr && suffix->isSame(key, key.cursor + 1)) {
-                                return std::make_tuple(VALUE, getLV(trueIndex), trueIndex);
+                                return valueOrUnstable(trueIndex);
                             }
                         }
 
@@ -505,10 +646,22 @@ class BorderNode : public Node {
             return std::make_tuple(NOTFOUND, LinkOrValue{}, 0);
         }
 
+        // VALUEのスロットがnullptrなのは、lockを持ったwriterがtakeLVでValueを取り出している最中なのでUNSTABLEとして扱う
+        inline std::tuple<SearchResult, LinkOrValue, size_t> valueOrUnstable(size_t trueIndex) const {
+            LinkOrValue lv_ = getLV(trueIndex);
+            if (lv_.value == nullptr) return std::make_tuple(UNSTABLE, LinkOrValue{}, 0);
+            return std::make_tuple(VALUE, lv_, trueIndex);
+        }
+
         // BorderNode内のキーの中で、最小のキーを返す。
+        // NOTE: split中のノードはkey_sliceを一度リセットしてから書き直すので、安定したversionの間に読めた値だけを返す
         uint64_t lowestKey() const {
+        RETRY:
+            Version version = stableVersion();
             Permutation permutation = getPermutation();
-            return getKeySlice(permutation(0));
+            uint64_t lowest = getKeySlice(permutation(0));
+            if ((getVersion() ^ version) > Version::has_locked) goto RETRY;
+            return lowest;
         }
 
         // このBorderNodeを削除する前に呼び出す、前後のBorderNodeのリンクをつなぐ
@@ -575,14 +728,16 @@ class BorderNode : public Node {
                 uint8_t trueIndex = permutation(i);
                 temp_key_len[i] = getKeyLen(trueIndex);
                 temp_key_slice[i] = getKeySlice(trueIndex);
-                temp_lv[i] = getLV(trueIndex);
+                temp_lv[i] = takeLV(trueIndex);
                 temp_suffix[i] = getKeySuffixes().get(trueIndex);
             }
             // forが2回入っていて冗長に見えるけど全部そろえてからpermutationをいじった方が整合性保証的な意味で良い気がする
+            // splittingが立っているので、並べ直す間はrelaxedで書いてsetPermutation(とunlock)のreleaseでまとめて公開する
+            beginLockedWrites();
             for (size_t i = 0; i < ORDER - 1; i++) {
-                setKeyLen(i, temp_key_len[i]);
-                setKeySlice(i, temp_key_slice[i]);
-                setLV(i, temp_lv[i]);
+                setKeyLen(i, temp_key_len[i], LOCKED_WRITE_ORDER);
+                setKeySlice(i, temp_key_slice[i], LOCKED_WRITE_ORDER);
+                setLV(i, temp_lv[i], LOCKED_WRITE_ORDER);
                 getKeySuffixes().set(i, temp_suffix[i]);
             }
             setPermutation(Permutation::fromSorted(ORDER - 1));
@@ -619,12 +774,12 @@ class BorderNode : public Node {
         }
         
         // key_len[i]にkeyの長さをセットする
-        inline void setKeyLen(size_t i, const uint8_t &len) {
-            key_len[i].store(len, std::memory_order_release);
+        inline void setKeyLen(size_t i, const uint8_t &len, std::memory_order order = std::memory_order_release) {
+            key_len[i].store(len, order);
         }
 
-        void resetKeyLen() {
-            for (size_t i = 0; i < ORDER - 1; i++) setKeyLen(i, 0);
+        void resetKeyLen(std::memory_order order = std::memory_order_release) {
+            for (size_t i = 0; i < ORDER - 1; i++) setKeyLen(i, 0, order);
         }
         
         inline uint64_t getKeySlice(size_t i) const {
@@ -632,12 +787,12 @@ class BorderNode : public Node {
             return key_slice[i].load(std::memory_order_acquire); 
         }
         
-        inline void setKeySlice(size_t i, const uint64_t &slice) {
-            key_slice[i].store(slice, std::memory_order_release);   // TODO: wrapperの作成
+        inline void setKeySlice(size_t i, const uint64_t &slice, std::memory_order order = std::memory_order_release) {
+            key_slice[i].store(slice, order);   // TODO: wrapperの作成
         }
 
-        void resetKeySlice() {
-            for (size_t i = 0; i < ORDER - 1; i++) setKeySlice(i, 0);
+        void resetKeySlice(std::memory_order order = std::memory_order_release) {
+            for (size_t i = 0; i < ORDER - 1; i++) setKeySlice(i, 0, order);
         }
         
         inline LinkOrValue getLV(size_t i) const {
@@ -645,12 +800,24 @@ class BorderNode : public Node {
             return lv[i].load(std::memory_order_acquire); 
         }
         // lv[i]に指定されたLinkOrValueをセットする
-        inline void setLV(size_t i, const LinkOrValue &lv_) {
-            lv[i].store(lv_, std::memory_order_release);    // TODO: wrapperの作成
+        inline void setLV(size_t i, const LinkOrValue &lv_, std::memory_order order = std::memory_order_release) {
+            lv[i].store(lv_, order);    // TODO: wrapperの作成
+        }
+
+        // lv[i]を空にして中身を返す
+        // lock-freeなupdate(compareExchangeLV)と競合しないように、lockを持ったwriterがValueを移動・破棄するときは必ずこれで取り出す
+        inline LinkOrValue takeLV(size_t i) {
+            assert(isLocked());
+            return lv[i].exchange(LinkOrValue{}, std::memory_order_acq_rel);
+        }
+
+        // lv[i]がexpectedのままならdesiredに置き換える(lockを取らない既存キーのupdate用)
+        inline bool compareExchangeLV(size_t i, LinkOrValue expected, const LinkOrValue &desired) {
+            return lv[i].compare_exchange_strong(expected, desired, std::memory_order_acq_rel, std::memory_order_acquire);
         }
 
-        void resetLVs() {
-            for (size_t i = 0; i < ORDER - 1; i++) setLV(i, LinkOrValue{});
+        void resetLVs(std::memory_order order = std::memory_order_release) {
+            for (size_t i = 0; i < ORDER - 1; i++) setLV(i, LinkOrValue{}, order);
         }
 
         inline BorderNode *getNext() const {
@@ -686,6 +853,20 @@ class BorderNode : public Node {
             permutation.store(p, std::memory_order_release);
         }
 
+        // lockを待っているputのリクエストを積む(lockを持っていなくても呼べる)
+        void publishCombining(CombiningRequest *request) {
+            CombiningRequest *head = combining.load(std::memory_order_relaxed);
+            do {
+                request->next = head;
+            } while (!combining.compare_exchange_weak(head, request, std::memory_order_release, std::memory_order_relaxed));
+        }
+
+        // 積まれているリクエストを全て取り出す(後から積まれたものが先頭)
+        CombiningRequest *takeCombining() {
+            assert(isLocked());
+            return combining.exchange(nullptr, std::memory_order_acquire);
+        }
+
 
 
     private:
@@ -697,6 +878,12 @@ class BorderNode : public Node {
         std::atomic<BorderNode*> next{nullptr};                         // 隣接するBorderNodeへのリンク(next)
         std::atomic<BorderNode*> prev{nullptr};                         // 隣接するBorderNodeへのリンク(previous)
         KeySuffix key_suffixes = {};                                    // BorderNode内のすべてのキーのSuffixを一元管理するKeySuffixオブジェクト
+        std::atomic<CombiningRequest*> combining{nullptr};              // lockの持ち主に処理してもらうのを待っているputのリクエスト
 };
 
-std::pair<BorderNode*, Version> findBorder(Node *root, const Key &key);
\ No newline at end of file
+std::pair<BorderNode*, Version> findBorder(Node *root, const Key &key, OperationStats *stats = nullptr);
+
+// findBorderと同じだが、降りてきたInteriorNodeのseparatorから見つけたBorderNodeが担当するsliceの上限(その値は含まない)をupper_boundに入れる
+// 右端のBorderNodeならstd::nullopt、返したversionからsplitしていなければ上限はこの値より小さくならない
+// NOTE: nextの最小のキーはremoveで大きくなるので上限には使えない
+std::pair<BorderNode*, Version> findBorder(Node *root, const Key &key, std::optional<uint64_t> &upper_bound, OperationStats *stats = nullptr);
\ No newline at end of file
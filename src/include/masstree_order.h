@@ -0,0 +1,19 @@
+#pragma once
+
+#include <optional>
+
+#include "masstree_scan.h"
+
+// 近似値を求めるときに、1回の推定で木を降りる回数
+constexpr size_t ORDER_STATS_SAMPLES = 32;
+
+// [lo, hi)のキーの数を返す(lo/hiがnullptrならその側は無制限)
+// exactならBorderNodeを全て数える(O(n))、そうでなければ推定をORDER_STATS_SAMPLES回平均して返す
+// 推定は範囲に全て含まれる部分木では各段で子をランダムに1つ選び、子の数を掛けながら降りる(Knuthの推定量、1本の降下でO(log n))
+// 範囲の端(lo/hiを含む子)は範囲付きで降り、その途中の各段で間の子に1本ずつ降下するので、1回あたりO(log^2 n)のノードを読む
+// (端の最下段では高々ORDER個のBorderNodeを全て数える、下位レイヤに降りる場合はそのレイヤの高さの分だけ増える)
+double masstree_count_range(Node *root, const Key *lo, const Key *hi, bool exact);
+
+// 小さい方から数えてk番目(0-indexed)のキーを返す、kがキーの数以上ならstd::nullopt
+// exactでない場合は各段で全ての子のキーの数を推定しながら降りるので(O(ORDER * log^2 n))、返るキーの順位も近似になる
+std::optional<Key> masstree_select(Node *root, size_t k, bool exact);
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <functional>
+
 #include "masstree_node.h"
 #include "masstree_gc.h"
 
@@ -8,11 +10,17 @@ enum PutResult : uint8_t {
     RetryFromUpperLayer
 };
 
+// Masstree::putがBorderNodeのlockをどう取るか
+enum class PutMode : uint8_t {
+    Locking,        // lockが取れるまで待つ
+    FlatCombining   // lockが取れなければリクエストをBorderNodeに積み、lockの持ち主にまとめて処理してもらう
+};
+
 BorderNode *start_new_tree(const Key &key, Value *value);
 
 ssize_t check_break_invariant(BorderNode *const borderNode, const Key &key);
 
-void handle_break_invariant(BorderNode *node, Key &key, size_t old_index, GarbageCollector &gc);
+void handle_break_invariant(BorderNode *node, Key &key, size_t old_index, GarbageCollector &gc, OperationStats *stats = nullptr);
 
 void insert_to_border(BorderNode *border, const Key &key, Value *value, GarbageCollector &gc);
 
@@ -32,6 +40,48 @@ InteriorNode *create_root_with_children(Node *left, uint64_t slice, Node *right)
 
 void insert_into_parent(InteriorNode *parent, Node *node1, uint64_t slice, size_t node_index);
 
-Node *split(Node *node, const Key &key, Value *value);
+Node *split(Node *node, const Key &key, Value *value, OperationStats *stats = nullptr);
+
+// BorderNodeのnodeを分割して作ったnode1を親に入れる(親が一杯なら親もsplitして上に辿る)
+// nodeとnode1のlockを持って呼び、全てのlockを外して返る、新しいrootができた場合はそれを返す(それ以外はnullptr)
+Node *insert_split_sibling(Node *node, Node *node1, OperationStats *stats = nullptr);
+
+// 満杯でないBorderNodeを、キーの数がだいたい半分になる(同じsliceのキーは分けない)ところで2つに分ける
+// nodeが消去済みか、sliceが1種類しかなくて分けられない場合はfalseを返す
+// 新しいrootができた場合はnew_rootに入る(それ以外はnullptr、nodeが下位レイヤならそのレイヤのroot)
+bool split_leaf(BorderNode *node, Node *&new_root, OperationStats *stats = nullptr);
+
+// sortされたkeys[begin...]のうち、keys[begin]と同じBorderNodeに入るものを1回のfindBorderとlockでまとめてputする
+// 処理できた次のindexを返す、レイヤの作成・下位レイヤ・splitが必要なキーに当たった場合はそこで止まる(beginを返すこともある)
+size_t put_batch_to_border(Node *root, std::vector<Key> &keys, const std::vector<Value *> &values, size_t begin, GarbageCollector &gc, OperationStats *stats = nullptr);
+
+// 既存キーのValueをlockを取らずにlvのCASで置き換える、置き換えられなかった場合(キーが無い、競合した)はfalseを返す
+// 置き換えた元のValueはold_valueに入る(gcには入れない)
+bool update_in_place(Node *root, Key &key, Value *value, Value *&old_value, OperationStats *stats = nullptr);
+
+// 置き換えた元のValueはgcに入れる
+std::pair<PutResult, Node*> masstree_put(Node *root, Key &key, Value *value, GarbageCollector &gc, OperationStats *stats = nullptr);
+
+// 置き換えた元のValue(insertした場合はnullptr)をold_valueに入れて返す、gcには入れないので呼び出し側が所有する
+std::pair<PutResult, Node*> masstree_put(Node *root, Key &key, Value *value, Value *&old_value, GarbageCollector &gc, OperationStats *stats = nullptr);
+
+// flat combiningでリクエストを積んだ後、yieldせずにlockが空くのを待つ回数
+constexpr size_t COMBINING_SPINS = 64;
+
+// nodeのlockを持っているスレッドが、nodeに積まれているputのリクエストを全て処理してからunlockする
+// nodeに入れられないキー(依頼した後にnodeがsplitされた、レイヤの作成や下位レイヤが必要)のリクエストはRetryにする
+// 空きが足りなければ最後に1件だけsplitして入れる、splitで新しいrootができた場合はそれを返す(それ以外はnullptr)
+Node *combine_puts(BorderNode *node, GarbageCollector &gc, OperationStats *stats = nullptr);
+
+// masstree_putと同じだが、BorderNodeのlockが取れなければリクエストを積んで、lockの持ち主に代わりにputしてもらう
+// lockが空いたら自分がlockを取って、積まれているリクエストをまとめて処理する(自分のリクエストも積まれている)
+std::pair<PutResult, Node*> masstree_put_combining(Node *root, Key &key, Value *value, Value *&old_value, GarbageCollector &gc, OperationStats *stats = nullptr);
+
+// upsertに渡す関数: 既存のValue(keyが無ければnullptr)を受け取り、新しく格納するValueを返す
+// nullptrか既存のValueと同じものを返した場合は何も書き込まない
+// BorderNodeのlockを持ったまま1回だけ呼ばれるので、中でMasstreeにアクセスしないこと
+using UpsertFunction = std::function<Value *(Value *)>;
 
-std::pair<PutResult, Node*> masstree_put(Node *root, Key &key, Value *value, GarbageCollector &gc);
\ No newline at end of file
+// rootはnullptrであってはいけない(空の木に対してはMasstree::upsertが先に空のrootを作る)
+// fnの戻り値で置き換えられた元のValueはold_valueに入る(gcには入れない)
+std::pair<PutResult, Node*> masstree_upsert(Node *root, Key &key, const UpsertFunction &fn, Value *&old_value, GarbageCollector &gc, OperationStats *stats = nullptr);
\ No newline at end of file
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include "masstree_gc.h"
+
+struct ReclaimerOptions {
+    size_t high_water_bytes = 64 << 20;             // 解放待ちのバイト数がこれを超えるとretire()が待たされる(0なら上限なし)
+    size_t burst_size = 256;                        // 解放スレッドが続けてdeleteする最大の数
+    std::chrono::microseconds burst_pause{0};       // burstごとに休む時間(0ならyieldだけ)、deleteの速さを抑えたい場合に使う
+    std::chrono::milliseconds idle_wait{10};        // 解放するものが無いときに眠る最大の時間
+};
+
+// ワーカースレッドのGarbageCollectorの中身をまとめて受け取り、専用のスレッドで解放する
+// 何千ものノードを一度にdeleteするとrun()を呼んだスレッドの操作のlatencyが跳ねるので、deleteをワーカーの外に追い出す
+// 受け渡しはCASだけのstack(retire()はvectorの入れ替えとpush 1回で済む)、解放スレッドはstackを丸ごと取ってburst_size個ずつ解放する
+// 解放待ちがhigh_water_bytesを超えるとretire()したスレッドは解放が追いつくまで待つ(メモリが際限なく増えないようにするため)
+// NOTE: retire()したものはすぐに解放されうるので、渡すタイミングはrun()を呼ぶ場合と同じく他スレッドが読んでいないときに限る
+class BackgroundReclaimer {
+    public:
+        explicit BackgroundReclaimer(ReclaimerOptions options_ = {}) : options(options_) {
+            reclaimer = std::thread([this] { loop(); });
+        }
+
+        BackgroundReclaimer(const BackgroundReclaimer &other) = delete;
+        BackgroundReclaimer &operator=(const BackgroundReclaimer &other) = delete;
+
+        // 渡された分を全て解放してからスレッドを止める
+        ~BackgroundReclaimer() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping.store(true, std::memory_order_release);
+            }
+            wake.notify_one();
+            reclaimer.join();
+        }
+
+        // gcの中身を解放スレッドに渡す(gcは空になる)、複数スレッドから同時に呼べる
+        void retire(GarbageCollector &gc) {
+            if (gc.empty()) return;
+            Batch *batch = new Batch;
+            batch->gc.swap(gc);
+            size_t bytes = batch->gc.bytes();
+            throttle(bytes);
+            pending_objects.fetch_add(batch->gc.size(), std::memory_order_relaxed);
+            pending_bytes.fetch_add(bytes, std::memory_order_relaxed);
+            batch->next = head.load(std::memory_order_relaxed);
+            while (!head.compare_exchange_weak(batch->next, batch, std::memory_order_release, std::memory_order_relaxed)) {}
+            // 解放スレッドがheadを見てから眠るまでの間にpushした場合に起こし損ねないよう、mutexを通してから起こす
+            { std::lock_guard<std::mutex> lock(mutex); }
+            wake.notify_one();
+        }
+
+        // それまでにretire()された分が全て解放されるまで待つ
+        void flush() {
+            std::unique_lock<std::mutex> lock(mutex);
+            waiters.fetch_add(1);
+            drained.wait(lock, [&] { return pending_objects.load() == 0; });
+            waiters.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        // 解放待ちのおおよそのバイト数
+        size_t getPendingBytes() const {
+            return pending_bytes.load(std::memory_order_relaxed);
+        }
+
+        // これまでに解放したノードや値の数
+        uint64_t getFreedObjects() const {
+            return freed_objects.load(std::memory_order_relaxed);
+        }
+
+        // これまでに解放したtypeの数
+        uint64_t getFreed(RetiredType type) const {
+            return freed_by_type[static_cast<size_t>(type)].load(std::memory_order_relaxed);
+        }
+
+        // high_water_bytesを超えてretire()が待たされた回数
+        uint64_t getThrottledRetires() const {
+            return throttled_retires.load(std::memory_order_relaxed);
+        }
+
+    private:
+        struct Batch {
+            GarbageCollector gc{};
+            Batch *next = nullptr;
+        };
+
+        // bytesを足すとhigh_water_bytesを超える場合は、解放が追いつくまで待つ
+        // (解放待ちが空なら1つのbatchが上限より大きくても通す)
+        void throttle(size_t bytes) {
+            if (options.high_water_bytes == 0) return;
+            auto below = [&] {
+                size_t pending = pending_bytes.load();
+                return pending == 0 || pending + bytes <= options.high_water_bytes;
+            };
+            if (below()) return;
+            throttled_retires.fetch_add(1, std::memory_order_relaxed);
+            std::unique_lock<std::mutex> lock(mutex);
+            waiters.fetch_add(1);
+            drained.wait(lock, below);
+            waiters.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        // 解放スレッドの本体: stackを丸ごと取り、古い順にburst_size個ずつ解放する
+        void loop() {
+            while (true) {
+                Batch *batches = head.exchange(nullptr, std::memory_order_acquire);
+                if (batches == nullptr) {
+                    if (stopping.load(std::memory_order_acquire)) return;
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wake.wait_for(lock, options.idle_wait, [&] {
+                        return stopping.load(std::memory_order_acquire) || head.load(std::memory_order_acquire) != nullptr;
+                    });
+                    continue;
+                }
+                // stackは新しい順なので、retire()された順に並べ直す
+                Batch *oldest = nullptr;
+                while (batches != nullptr) {
+                    Batch *next = batches->next;
+                    batches->next = oldest;
+                    oldest = batches;
+                    batches = next;
+                }
+                while (oldest != nullptr) {
+                    Batch *next = oldest->next;
+                    release(*oldest);
+                    delete oldest;
+                    oldest = next;
+                }
+            }
+        }
+
+        void release(Batch &batch) {
+            while (!batch.gc.empty()) {
+                size_t bytes = batch.gc.bytes();
+                std::array<uint64_t, NUM_RETIRED_TYPES> before{};
+                for (size_t t = 0; t < NUM_RETIRED_TYPES; t++) before[t] = batch.gc.getFreed(static_cast<RetiredType>(t));
+                size_t freed = batch.gc.run(options.burst_size);
+                for (size_t t = 0; t < NUM_RETIRED_TYPES; t++) {
+                    freed_by_type[t].fetch_add(batch.gc.getFreed(static_cast<RetiredType>(t)) - before[t], std::memory_order_relaxed);
+                }
+                freed_objects.fetch_add(freed, std::memory_order_relaxed);
+                // 待つ側はwaitersを増やしてからpendingを読むので、pendingを減らしてからwaitersを読む(どちらもseq_cst)
+                pending_bytes.fetch_sub(bytes - batch.gc.bytes());
+                pending_objects.fetch_sub(freed);
+                if (waiters.load() > 0) {
+                    { std::lock_guard<std::mutex> lock(mutex); }
+                    drained.notify_all();
+                }
+                if (options.burst_pause.count() > 0) {
+                    std::this_thread::sleep_for(options.burst_pause);
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        const ReclaimerOptions options;
+        std::atomic<Batch *> head{nullptr};         // retire()されたbatchのstack(新しい順)
+        std::atomic<size_t> pending_bytes{0};
+        std::atomic<size_t> pending_objects{0};
+        std::atomic<uint64_t> freed_objects{0};
+        std::array<std::atomic<uint64_t>, NUM_RETIRED_TYPES> freed_by_type{};
+        std::atomic<uint64_t> throttled_retires{0};
+        std::atomic<size_t> waiters{0};             // drainedで待っているスレッドの数(0なら通知しない)
+        std::atomic<bool> stopping{false};
+        std::mutex mutex{};
+        std::condition_variable wake{};             // retire()されたことを解放スレッドに知らせる
+        std::condition_variable drained{};          // 解放が進んだことをthrottle()/flush()で待つスレッドに知らせる
+        std::thread reclaimer{};
+};
@@ -9,10 +9,10 @@ enum RootChange : uint8_t {
     LayerDeleted
 };
 
-void handle_delete_layer_in_remove(BorderNode *borderNode, GarbageCollector &gc);
+void handle_delete_layer_in_remove(BorderNode *borderNode, GarbageCollector &gc, OperationStats *stats = nullptr);
 
 std::pair<RootChange, Node*> delete_borderNode_in_remove(BorderNode *borderNode, GarbageCollector &gc);
 
-std::pair<RootChange, Node*> remove(Node *root, Key &key, GarbageCollector &gc);
+std::pair<RootChange, Node*> remove(Node *root, Key &key, GarbageCollector &gc, OperationStats *stats = nullptr, Value **taken = nullptr);
 
-Node *remove_at_layer0(Node *root, Key &key, GarbageCollector &gc);
\ No newline at end of file
+Node *remove_at_layer0(Node *root, Key &key, GarbageCollector &gc, OperationStats *stats = nullptr);
\ No newline at end of file
@@ -1,13 +1,52 @@
-#pragma once
-
-#include "masstree_node.h"
-#include "status.h"
-
-void masstree_scan(Node* root,
-                   Status &scan_status,
-                   Key &current_key,
-                   Key &left_key,
-                   bool l_exclusive,
-                   Key &right_key,
-                   bool r_exclusive,
-                   std::vector<std::pair<Key, Value*>> &result);
\ No newline at end of file
+#pragma once
+
+#include <functional>
+
+#include "masstree_node.h"
+#include "status.h"
+
+void masstree_scan(Node* root,
+                   Status &scan_status,
+                   Key &current_key,
+                   Key &left_key,
+                   bool l_exclusive,
+                   Key &right_key,
+                   bool r_exclusive,
+                   std::vector<std::pair<Key, Value*>> &result,
+                   OperationStats *stats = nullptr);
+
+// scanで1つのBorderNodeから読み出したエントリ
+struct ScanEntry {
+    uint64_t slice;
+    uint8_t key_len;
+    LinkOrValue lv;
+    BigSuffix *suffix;
+};
+
+// BorderNodeのエントリとnextを安定した状態で読み出して、キー順(同じsliceなら短いキー -> suffix -> layer)に並べる
+Version read_entries(BorderNode *node, std::vector<ScanEntry> &entries, BorderNode *&next);
+
+// レイヤの中でsliceを担当するBorderNodeを探してエントリを読み出す、レイヤが消えていた場合はnullptrを返す
+BorderNode *find_entries(Node *root, uint64_t slice, std::vector<ScanEntry> &entries, BorderNode *&next, OperationStats *stats = nullptr);
+
+// InteriorNodeのseparatorと子ノードを安定した状態で読み出す
+Version read_interior(InteriorNode *node, std::vector<uint64_t> &slices, std::vector<Node *> &children);
+
+// keyのバイト列を辞書順で比較する(a < bなら負、a == bなら0、a > bなら正)
+int compare_keys(const Key &a, const Key &b);
+
+// scan_prefixに渡す関数: 見つかったキーとValueを受け取り、falseを返すとそこでscanを止める
+// keyはscan側が使い回すバッファなので、呼び出しの外に持ち出す場合はコピーすること
+using ScanVisitor = std::function<bool(const Key &key, Value *value)>;
+
+// prefixで始まるキーを昇順にvisitorに渡す、visitorがfalseを返して止まった場合はfalseを返す
+// prefixの途中までのレイヤは上位レイヤのBorderNodeを辿らずに直接降りる
+bool masstree_scan_prefix(Node *root, const Key &prefix, const ScanVisitor &visitor, OperationStats *stats = nullptr);
+
+// 上位レイヤ(Layer0)のInteriorNodeのseparatorを使って、sliceの範囲[lo, hi]を最大parts個の区間に分ける
+// 各区間の開始sliceを昇順で返す(先頭は必ずlo)
+std::vector<uint64_t> scan_partitions(Node *root, uint64_t lo, uint64_t hi, size_t parts);
+
+// [lo, hi)のキーを、scan_partitionsで分けた区間ごとに最大nthreads個のスレッドでscanする
+// visitorは複数のスレッドから同時に呼ばれる(区間の中では昇順)、どれかでfalseを返すと全スレッドが止まってfalseを返す
+bool masstree_parallel_scan(Node *root, const Key &lo, const Key &hi, size_t nthreads, const ScanVisitor &visitor);
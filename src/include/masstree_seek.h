@@ -0,0 +1,15 @@
+#pragma once
+
+#include <optional>
+
+#include "masstree_scan.h"
+
+// seekで見つかったキーとValue
+using SeekResult = std::optional<std::pair<Key, Value *>>;
+
+// targetより大きい(inclusiveならtarget以上の)最小のキーを返す、targetがnullptrなら木の最小のキー
+// 見つかるまでfindBorderで1回降りてnextを辿るだけなので、scanのように結果のvectorは作らない
+SeekResult masstree_seek(Node *root, const Key *target, bool inclusive, OperationStats *stats = nullptr);
+
+// 木の最大のキーを返す(右端のBorderNodeから、空ならprevを辿って探す)
+SeekResult masstree_seek_last(Node *root, OperationStats *stats = nullptr);
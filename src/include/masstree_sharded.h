@@ -0,0 +1,245 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <shared_mutex>
+#include <type_traits>
+
+#include "masstree.h"
+
+// ShardedMasstreeのキーの振り分け方
+enum class ShardingMode : uint8_t {
+    Range,  // Layer0のsliceの範囲で分ける(scanは担当範囲が重なるshardを順に見るだけでいい)
+    Hash    // キーのハッシュで分ける(点アクセスのみのテーブル向け、scanは全shardの結果をマージする)
+};
+
+// 複数の独立したMasstreeにキーを振り分けて、1つのMasstreeとして見せる
+// shardごとにrootのCASやsplitが独立するので、書き込みの偏った負荷を複数のshard(ソケット)に分散できる
+// NOTE: Rangeモードの境界はrebalance()で動かせる、各操作はshardのmigration lockを共有で取り、rebalanceは排他で取る
+//       (Hashモードは境界が動かないのでlockを取らない)
+class ShardedMasstree {
+    public:
+        // Rangeモードではsliceの空間をnum_shards等分し、Hashモードではハッシュでnum_shards個に分ける
+        ShardedMasstree(ShardingMode mode_, size_t num_shards) : mode(mode_) {
+            assert(num_shards >= 1);
+            std::vector<uint64_t> lowers(num_shards);
+            for (size_t i = 0; i < num_shards; i++) {
+                lowers[i] = static_cast<uint64_t>((static_cast<unsigned __int128>(1) << 64) * i / num_shards);
+            }
+            init(lowers);
+        }
+
+        // boundaries(昇順のLayer0のslice)で分けたboundaries.size() + 1個のshardを持つRangeモード
+        // shard iは[boundaries[i - 1], boundaries[i])のsliceで始まるキーを担当する
+        explicit ShardedMasstree(const std::vector<uint64_t> &boundaries) : mode(ShardingMode::Range) {
+            assert(std::is_sorted(boundaries.begin(), boundaries.end()));
+            std::vector<uint64_t> lowers{0};
+            lowers.insert(lowers.end(), boundaries.begin(), boundaries.end());
+            init(lowers);
+        }
+
+        ShardedMasstree(const ShardedMasstree &other) = delete;
+        ShardedMasstree &operator=(const ShardedMasstree &other) = delete;
+
+        // ShardedMasstreeにアクセスするスレッドを登録する(全shardで同じThreadContextを使う)
+        ThreadContext &registerThread() {
+            std::lock_guard<std::mutex> lock(contextsMutex);
+            contexts.emplace_back(std::make_unique<ThreadContext>(contexts.size()));
+            return *contexts.back();
+        }
+
+        StatsSnapshot getStats() {
+            std::lock_guard<std::mutex> lock(contextsMutex);
+            StatsSnapshot total{};
+            for (auto &ctx : contexts) total.merge(ctx->getStats().snapshot());
+            return total;
+        }
+
+        ShardingMode getMode() const {
+            return mode;
+        }
+
+        size_t numShards() const {
+            return shards.size();
+        }
+
+        // keyを担当するshardの番号(rebalanceと並行して呼んだ場合は呼んだ時点の値)
+        size_t shardOf(const Key &key) const {
+            if (mode == ShardingMode::Hash) return hashKey(key) % shards.size();
+            size_t lo = 0, hi = shards.size();
+            while (hi - lo > 1) {
+                size_t mid = (lo + hi) / 2;
+                if (key.slices[0] >= lower(mid)) {
+                    lo = mid;
+                } else {
+                    hi = mid;
+                }
+            }
+            return lo;
+        }
+
+        // shard iが担当する最小のslice(Rangeモードのみ)
+        uint64_t lower(size_t i) const {
+            return shards[i]->lower.load(std::memory_order_acquire);
+        }
+
+        // shard iのMasstree(統計を取るなどの読み取り用)
+        const Masstree &shard(size_t i) const {
+            return shards[i]->tree;
+        }
+
+        Value *get(Key &key, ThreadContext &ctx) {
+            return withShard(key, [&](Masstree &tree) { return tree.get(key, ctx); });
+        }
+
+        Value *get(Key &key, OperationStats *stats = nullptr) {
+            return withShard(key, [&](Masstree &tree) { return tree.get(key, stats); });
+        }
+
+        void put(Key &key, Value *value, ThreadContext &ctx) {
+            withShard(key, [&](Masstree &tree) { tree.put(key, value, ctx); });
+        }
+
+        void put(Key &key, Value *value, GarbageCollector &gc, OperationStats *stats = nullptr) {
+            withShard(key, [&](Masstree &tree) { tree.put(key, value, gc, stats); });
+        }
+
+        void remove(Key &key, ThreadContext &ctx) {
+            withShard(key, [&](Masstree &tree) { tree.remove(key, ctx); });
+        }
+
+        void remove(Key &key, GarbageCollector &gc, OperationStats *stats = nullptr) {
+            withShard(key, [&](Masstree &tree) { tree.remove(key, gc, stats); });
+        }
+
+        void scan(Key &left_key,
+                  bool l_exclusive,
+                  Key &right_key,
+                  bool r_exclusive,
+                  std::vector<std::pair<Key, Value*>> &result,
+                  ThreadContext &ctx) {
+            MASSTREE_LATENCY_SCOPE(ctx, LatencyOp::Scan);
+            scan(left_key, l_exclusive, right_key, r_exclusive, result, &ctx.getStats());
+        }
+
+        // 範囲が重なるshardを全て(Hashモードなら全shard)scanして、結果をキー順に並べてresultに入れる
+        // Rangeモードでは範囲の途中でrebalanceされないように、対象のshardのmigration lockを番号順に全て取ってからscanする
+        void scan(Key &left_key,
+                  bool l_exclusive,
+                  Key &right_key,
+                  bool r_exclusive,
+                  std::vector<std::pair<Key, Value*>> &result,
+                  OperationStats *stats = nullptr) {
+            std::vector<std::shared_lock<std::shared_mutex>> locks;
+            size_t first = 0, last = shards.size() - 1;
+            if (mode == ShardingMode::Range) {
+            RETRY:
+                locks.clear();
+                first = shardOf(left_key);
+                last = std::max(first, shardOf(right_key));
+                for (size_t i = first; i <= last; i++) locks.emplace_back(shards[i]->migration);
+                // lockを取る前に境界が動いていた場合
+                if (first != shardOf(left_key) || last != std::max(first, shardOf(right_key))) goto RETRY;
+            }
+            size_t begin = result.size();
+            for (size_t i = first; i <= last; i++) {
+                shards[i]->tree.scan(left_key, l_exclusive, right_key, r_exclusive, result, stats);
+            }
+            if (mode == ShardingMode::Hash) {
+                std::sort(result.begin() + static_cast<std::ptrdiff_t>(begin), result.end(), [](const auto &a, const auto &b) {
+                    return compare_keys(a.first, b.first) < 0;
+                });
+            }
+        }
+
+        // shard iとi + 1の境界をboundaryに動かし、担当が変わるキーを移す(Rangeモードのみ)
+        // boundaryがshard iの下限以下かshard i + 1の上限以上ならfalseを返して何もしない
+        // NOTE: 移している間は2つのshardへの操作が止まる、移すキーが多いと長くなるので少しずつ動かすこと
+        bool rebalance(size_t i, uint64_t boundary, GarbageCollector &gc) {
+            assert(mode == ShardingMode::Range);
+            assert(i + 1 < shards.size());
+            std::unique_lock<std::shared_mutex> left_lock(shards[i]->migration);
+            std::unique_lock<std::shared_mutex> right_lock(shards[i + 1]->migration);
+            uint64_t current = lower(i + 1);
+            bool has_upper = i + 2 < shards.size();
+            if (boundary <= lower(i) || (has_upper && boundary >= lower(i + 2))) return false;
+            if (boundary == current) return true;
+            // 境界を左に動かすなら[boundary, current)をiからi + 1へ、右に動かすなら[current, boundary)をi + 1からiへ移す
+            Masstree &from = (boundary < current) ? shards[i]->tree : shards[i + 1]->tree;
+            Masstree &to = (boundary < current) ? shards[i + 1]->tree : shards[i]->tree;
+            Key lo({std::min(boundary, current)}, 1);
+            Key hi({std::max(boundary, current)}, 1);
+            std::vector<std::pair<Key, Value *>> moving;
+            from.parallel_scan(lo, hi, 1, [&](const Key &key, Value *value) {
+                moving.emplace_back(key, value);
+                return true;
+            });
+            for (auto &pair : moving) {
+                to.put(pair.first, pair.second, gc);
+                from.take(pair.first, gc);
+            }
+            shards[i + 1]->lower.store(boundary, std::memory_order_release);
+            return true;
+        }
+
+        // shard iとi + 1のキーの数が揃うように境界を動かす(キーの数はcount_range/selectの推定値を使う)
+        // 境界を動かした場合trueを返す
+        bool balance(size_t i, GarbageCollector &gc) {
+            assert(mode == ShardingMode::Range);
+            assert(i + 1 < shards.size());
+            size_t left = shards[i]->tree.rank(Key({std::numeric_limits<uint64_t>::max()}, 8));
+            size_t right = shards[i + 1]->tree.rank(Key({std::numeric_limits<uint64_t>::max()}, 8));
+            size_t target = (left + right) / 2;
+            std::optional<Key> middle{};
+            if (left > target + 1) {
+                middle = shards[i]->tree.select(target);
+            } else if (right > target + 1) {
+                middle = shards[i + 1]->tree.select(right - target);
+            }
+            if (!middle.has_value() || middle->slices[0] == lower(i + 1)) return false;
+            return rebalance(i, middle->slices[0], gc);
+        }
+
+    private:
+        struct alignas(64) Shard {
+            Masstree tree{};
+            std::atomic<uint64_t> lower{0};     // 担当する最小のslice(Rangeモード)
+            std::shared_mutex migration{};      // rebalanceでキーを移している間は排他で取られる
+        };
+
+        void init(const std::vector<uint64_t> &lowers) {
+            for (uint64_t lower_ : lowers) {
+                shards.emplace_back(std::make_unique<Shard>());
+                shards.back()->lower.store(lower_, std::memory_order_relaxed);
+            }
+        }
+
+        // キーの全スライスと長さを混ぜる(連番のキーも散らばるようにsplitmix64の最後の混ぜ方を使う)
+        static uint64_t hashKey(const Key &key) {
+            uint64_t hash = key.lastSliceSize;
+            for (uint64_t slice : key.slices) {
+                hash ^= slice + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+                hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+                hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+                hash ^= hash >> 31;
+            }
+            return hash;
+        }
+
+        // keyを担当するshardでfnを呼ぶ、Rangeモードではshardのmigration lockを共有で取る
+        // lockを取る前にrebalanceで境界が動いていたら、担当するshardを探し直す
+        template <typename Fn>
+        std::invoke_result_t<Fn, Masstree &> withShard(const Key &key, Fn &&fn) {
+            if (mode == ShardingMode::Hash) return fn(shards[shardOf(key)]->tree);
+            while (true) {
+                size_t i = shardOf(key);
+                std::shared_lock<std::shared_mutex> lock(shards[i]->migration);
+                if (shardOf(key) == i) return fn(shards[i]->tree);
+            }
+        }
+
+        const ShardingMode mode;
+        std::vector<std::unique_ptr<Shard>> shards{};
+        std::mutex contextsMutex{};
+        std::deque<std::unique_ptr<ThreadContext>> contexts{};
+};
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Masstreeの各操作で発生したretryやsplitなどを数えるカウンタの種類
+enum class StatsCounter : uint8_t {
+    FindBorderRetry,            // findBorderでv_splitが変わっていたのでRootからやり直した回数
+    GetRetry,                   // masstree_getで消去済みのノードを見てRETRYした回数
+    GetForward,                 // masstree_getでversionの変化を検知してFORWARDした回数
+    GetUnstable,                // masstree_getでkey_len_unstableを見てFORWARDした回数
+    PutRetry,                   // masstree_putで消去済みのノードを見てRETRYした回数
+    PutForward,                 // masstree_putでfindBorder→lockの間のsplitを検知してFORWARDした回数
+    PutRetryFromUpperLayer,     // 下位レイヤのRootが消去されていたので上位レイヤからやり直した回数
+    PutInPlace,                 // 既存キーのValueをlockを取らずにCASで置き換えた回数
+    RootCASFailure,             // Masstree::putでrootのCASに負けた回数
+    RemoveRetry,                // removeで消去済みのノードを見てRETRYした回数
+    RemoveForward,              // removeでfindBorder→lockの間のsplitを検知してFORWARDした回数
+    LockSpin,                   // Node::lock()でロックが取れずに回った回数
+    BorderSplit,                // BorderNodeのsplit回数
+    InteriorSplit,              // InteriorNodeのsplit回数
+    LayerCreate,                // handle_break_invariantで新しいレイヤを作った回数
+    LayerDelete,                // removeでレイヤを消去した回数
+    PutCombined,                // flat combiningで他スレッドのputを代わりに処理した回数
+    PutCombineRetry,            // flat combiningで依頼したputが処理されず、通常のputでやり直した回数
+    NumCounters
+};
+
+constexpr size_t NUM_STATS_COUNTERS = static_cast<size_t>(StatsCounter::NumCounters);
+
+// BorderNodeのlockの取得を何回に1回サンプリングするか(hot leafの検出用)
+constexpr uint32_t LOCK_SAMPLE_INTERVAL = 16;
+
+// StatsCounterの名前を返す(出力用)
+inline const char *statsCounterName(StatsCounter counter) {
+    static constexpr std::array<const char *, NUM_STATS_COUNTERS> names = {
+        "find_border_retry",
+        "get_retry",
+        "get_forward",
+        "get_unstable",
+        "put_retry",
+        "put_forward",
+        "put_retry_from_upper_layer",
+        "put_in_place",
+        "root_cas_failure",
+        "remove_retry",
+        "remove_forward",
+        "lock_spin",
+        "border_split",
+        "interior_split",
+        "layer_create",
+        "layer_delete",
+        "put_combined",
+        "put_combine_retry",
+    };
+    return names[static_cast<size_t>(counter)];
+}
+
+// 集計済みのカウンタ(OperationStatsのスナップショット)
+struct StatsSnapshot {
+    std::array<uint64_t, NUM_STATS_COUNTERS> counters{};
+
+    uint64_t operator[](StatsCounter counter) const {
+        return counters[static_cast<size_t>(counter)];
+    }
+
+    void merge(const StatsSnapshot &other) {
+        for (size_t i = 0; i < NUM_STATS_COUNTERS; i++) counters[i] += other.counters[i];
+    }
+};
+
+// スレッドごとに持つカウンタ
+// NOTE: 書き込むのは持ち主のスレッドだけなので、RMWではなくrelaxedなload/storeでインクリメントする
+//       (集計するスレッドが並行して読むのでatomicにはしておく)
+class OperationStats {
+    public:
+        OperationStats() = default;
+        // コピーコンストラクタと代入演算子の削除
+        OperationStats(OperationStats &&other) = delete;
+        OperationStats(const OperationStats &other) = delete;
+        OperationStats &operator=(OperationStats &&other) = delete;
+        OperationStats &operator=(const OperationStats &other) = delete;
+
+        inline void increment(StatsCounter counter, uint64_t n = 1) {
+            std::atomic<uint64_t> &c = counters[static_cast<size_t>(counter)];
+            c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+
+        inline uint64_t get(StatsCounter counter) const {
+            return counters[static_cast<size_t>(counter)].load(std::memory_order_relaxed);
+        }
+
+        StatsSnapshot snapshot() const {
+            StatsSnapshot s{};
+            for (size_t i = 0; i < NUM_STATS_COUNTERS; i++) s.counters[i] = counters[i].load(std::memory_order_relaxed);
+            return s;
+        }
+
+        // LOCK_SAMPLE_INTERVAL回に1回trueを返す(持ち主のスレッドだけが呼ぶ)
+        inline bool sampleLock() {
+            if (++lock_sample_tick < LOCK_SAMPLE_INTERVAL) return false;
+            lock_sample_tick = 0;
+            return true;
+        }
+
+    private:
+        std::array<std::atomic<uint64_t>, NUM_STATS_COUNTERS> counters{};
+        uint32_t lock_sample_tick = 0;
+};
+
+// statsがnullptr(カウンタを取らない呼び出し)の場合は何もしない
+inline void countStats(OperationStats *stats, StatsCounter counter, uint64_t n = 1) {
+    if (stats != nullptr) stats->increment(counter, n);
+}
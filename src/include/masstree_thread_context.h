@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+
+#include "masstree_gc.h"
+#include "masstree_latency.h"
+#include "masstree_stats.h"
+
+// ThreadContextはMasstreeにアクセスするスレッドごとの状態をまとめたもの
+// Masstree::registerThread()で取得して、そのスレッドからの各操作(get/put/scan/remove)に渡す
+// NOTE: 1つのThreadContextを複数スレッドで同時に使ってはいけない(中身は全てスレッドローカルな前提)
+class ThreadContext {
+    public:
+        explicit ThreadContext(size_t thread_id_) : thread_id(thread_id_) {}
+        // コピーコンストラクタと代入演算子の削除
+        ThreadContext(ThreadContext &&other) = delete;
+        ThreadContext(const ThreadContext &other) = delete;
+        ThreadContext &operator=(ThreadContext &&other) = delete;
+        ThreadContext &operator=(const ThreadContext &other) = delete;
+
+        // registerThread()した順番に振られるID
+        inline size_t getThreadId() const {
+            return thread_id;
+        }
+        // このスレッドが消去したノードや値を保持するGarbageCollector
+        inline GarbageCollector &getGC() {
+            return gc;
+        }
+        // このスレッドの操作カウンタ(retry/split/lock spinなど)
+        inline OperationStats &getStats() {
+            return stats;
+        }
+#ifdef MASSTREE_LATENCY_HISTOGRAM
+        // このスレッドの操作ごとのlatency histogram
+        inline LatencyRecorder &getLatency() {
+            return latency;
+        }
+#endif
+
+    private:
+        const size_t thread_id;
+        GarbageCollector gc{};
+        OperationStats stats{};
+#ifdef MASSTREE_LATENCY_HISTOGRAM
+        LatencyRecorder latency{};
+#endif
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+#include "masstree_node.h"
+
+// レイヤごとのノード数と高さ
+struct LayerStats {
+    size_t trees = 0;           // このレイヤにある木の数(Layer0なら1、それ以降は上位レイヤのkey_len_layerの数)
+    size_t border_nodes = 0;    // BorderNodeの数
+    size_t interior_nodes = 0;  // InteriorNodeの数
+    size_t max_height = 0;      // このレイヤの木の高さの最大値(BorderNodeだけなら1)
+};
+
+// Masstree全体の形とメモリ使用量
+struct TreeStats {
+    std::vector<LayerStats> layers{};                       // layers[i]はLayer iの統計
+    std::array<size_t, Node::ORDER> fill_histogram{};       // fill_histogram[n]はキーをn個持つBorderNodeの数
+    size_t keys = 0;                                        // Valueを持つキーの数
+    size_t tombstones = 0;                                  // 消去済み(isKeyRemoved)のスロット数
+    size_t suffixes = 0;                                    // BigSuffixの数
+    size_t suffix_tables = 0;                               // 確保済みのSuffixTableの数
+
+    // カテゴリごとのメモリ使用量(byte)
+    size_t border_bytes = 0;
+    size_t interior_bytes = 0;
+    size_t suffix_table_bytes = 0;
+    size_t suffix_bytes = 0;
+    size_t value_bytes = 0;
+
+    size_t totalBytes() const {
+        return border_bytes + interior_bytes + suffix_table_bytes + suffix_bytes + value_bytes;
+    }
+};
+
+void collect_tree_stats(Node *root, TreeStats &stats, size_t layer = 0);
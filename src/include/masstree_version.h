@@ -1,17 +1,23 @@
 #pragma once
 
+#include <cassert>
 #include <cstdint>
 
 struct Version {
-    static constexpr uint32_t has_locked = 0;
+    static constexpr uint64_t has_locked = 0;
 
+    static constexpr uint8_t v_insert_bits = 32;
+    static constexpr uint8_t v_split_bits = 26;
+
+    // NOTE: v_splitは一周するとafter < beforeになりうるので、大小ではなく一致で比べる
     static bool splitHappened(const Version &before, const Version &after) {
-        assert(after.v_split >= before.v_split);
         return before.v_split != after.v_split;
     }
 
+    // 64bitを全てフラグとカウンタに使う(v_insertは2^32回、v_splitは2^26回のinsert/splitで一周する)
+    // readerがその回数だけ待たされない限り、XORで変更を見逃す(ABA)ことはない
     union {
-        uint32_t body;
+        uint64_t body;
         struct {
             bool locked :       1;
             bool inserting :    1;
@@ -19,9 +25,8 @@ struct Version {
             bool deleted :      1;
             bool is_root :      1;
             bool is_border :    1;
-            uint16_t v_insert : 16;
-            uint8_t v_split :   8;
-            bool unused :       2;
+            uint64_t v_insert : v_insert_bits;
+            uint64_t v_split :  v_split_bits;
         };
     };
 
@@ -37,7 +42,9 @@ struct Version {
     {}
 
     // Versionが変更されているかをXORで確認する(0x0ならOK)
-    uint32_t operator ^(const Version &right) const {
+    uint64_t operator ^(const Version &right) const {
         return (body ^ right.body);
     }
-};
\ No newline at end of file
+};
+
+static_assert(sizeof(Version) == sizeof(uint64_t), "Version must fit in one 64-bit word");
\ No newline at end of file
@@ -12,99 +12,105 @@ struct Permutation {
     */
     uint64_t body = 0;
 
-    Permutation() = default;
-    Permutation(const Permutation &other) = default;
-    Permutation &operator=(const Permutation &other) = default;
+    constexpr Permutation() = default;
+    constexpr Permutation(const Permutation &other) = default;
+    constexpr Permutation &operator=(const Permutation &other) = default;
+
+    // 各nibbleの最下位bitが立ったマスク(nibble単位の並列演算に使う)
+    static constexpr uint64_t nibble_ones = 0x1111'1111'1111'1111ULL;
+
+    // permutationIndex以降(permutationIndexを含む)のnibbleを取り出すマスク(下位4bitのkeysは含む)
+    static constexpr uint64_t maskFrom(size_t permutationIndex) {
+        return ~0ULL >> (permutationIndex * 4);
+    }
 
     // Keyの数(下位4ビット)を取得する
-    inline uint8_t getNumKeys() const {
+    constexpr uint8_t getNumKeys() const {
         return body & 0b1111LLU;
     }
 
     // keyの数(下位4ビット)をセットする
-    inline void setNumKeys(size_t num) {
-        assert(0 <= num && num <= 15);
-        uint64_t temp_num = body >> 4LU;    // 4bit右シフトで消去
-        temp_num = temp_num << 4LU;         // 4bit左シフトで残りのデータを元の位置に戻す
-        body = temp_num | num;              // ORで結合
+    constexpr void setNumKeys(size_t num) {
+        assert(num <= 15);
+        body = (body & ~0b1111LLU) | num;
     }
 
     // Keys++
-    inline void incrementNumKeys() {
+    constexpr void incrementNumKeys() {
         assert(getNumKeys() <= 14);
-        setNumKeys(getNumKeys() + 1);
+        body++;
     }
 
     // Keys--
-    inline void decrementNumKeys() {
+    constexpr void decrementNumKeys() {
         assert(1 <= getNumKeys());
-        setNumKeys(getNumKeys() - 1);
+        body--;
     }
-    
+
     // 指定したpermutationIndexのtrueIndexを取得する
-    inline uint8_t getKeyIndex(size_t index) const {
-        assert(0 <= index && index < getNumKeys());
-        uint64_t Rshift = body >> (15 - index)*4;   // 欲しいindexの位置まで右シフト
-        uint8_t result = Rshift & 0b1111LLU;        // 0b1111でANDして取り出す
-        assert(0 <= result && result <= 14);
-        return result;
+    constexpr uint8_t getKeyIndex(size_t index) const {
+        assert(index < getNumKeys());
+        return (body >> (15 - index) * 4) & 0b1111LLU;
     }
 
     // 指定したpermutationIndexのtrueIndexをセットする
-    inline void setKeyIndex(size_t permutationIndex, size_t trueIndex) {
-        assert(0 <= permutationIndex && permutationIndex <= 14);
-        assert(0 <= trueIndex && trueIndex <= 14);
-        uint64_t left   = permutationIndex == 0 ? 0 : (body >> (16 - permutationIndex)*4) << (16 - permutationIndex)*4; // Rshift -> Lshiftで左側の欲しい部分だけ取得
-        uint64_t right  = body & ((1LLU << ((15 - permutationIndex)*4)) - 1);                                           // 1LLUをLshiftして-1することでマスクを作ってAND(ex. 0b0100 -> 0b0011)
-        uint64_t middle = trueIndex * (1LLU << (15 - permutationIndex)*4);                                              // 1LLUをセットしたいtrueIndexの位置までLshiftして、trueIndexを乗算することで指定した位置にtrueIndexを設定
-        body = left | middle | right;
-        assert(0 <= ((body >> (15 - permutationIndex)*4) & 0b1111LLU) && ((body >> (15 - permutationIndex)*4) & 0b1111LLU) <= 14);    // 0 <= permutationIndex <= 14
-    }
-
-    // 指定したpermutationIndexのtrueIndexを消す
-    // CHECK: MasstreeってtrueIndexを消した後左シフトするんだっけ？あとpermutationの操作はinsertingとかのdirtyフラグがたってるからatomicに処理する必要がないってこと？
-    inline void removeIndex(uint8_t trueIndex) {
-        // 指定されたtrueIndexを探して消去する
-        uint8_t permutationIndex;
-        for (uint8_t i = 0; i < getNumKeys(); i++) {
-            if (getKeyIndex(i) == trueIndex) {
-                permutationIndex = i;
-                break;
-            }
-        }
-        // permutationIndexより後ろのkeysIndexを1つ左シフトする、ケツのやつは重複するけどdecrementNumKeys()するから無視される
-        for (uint8_t target = permutationIndex; target + 1 <= getNumKeys() - 1; target++) {
-            setKeyIndex(target, getKeyIndex(target + 1));
-        }
-        decrementNumKeys();
+    constexpr void setKeyIndex(size_t permutationIndex, size_t trueIndex) {
+        assert(permutationIndex <= 14);
+        assert(trueIndex <= 14);
+        size_t shift = (15 - permutationIndex) * 4;
+        body = (body & ~(0b1111LLU << shift)) | (static_cast<uint64_t>(trueIndex) << shift);
+    }
+
+    // trueIndexが入っているpermutationIndexを返す(無ければgetNumKeys())
+    // 全nibbleをtrueIndexとXORして、有効な範囲で0になったnibbleを探す
+    // NOTE: (x & 0x7) + 0x7はnibbleの外に繰り上がらないので、隣のnibbleの影響を受けずに0のnibbleを判定できる
+    constexpr uint8_t indexOf(uint8_t trueIndex) const {
+        uint8_t num_keys = getNumKeys();
+        uint64_t x = body ^ (trueIndex * nibble_ones);
+        x |= maskFrom(num_keys);    // keysと使っていないnibbleは0にならないようにする
+        uint64_t low3 = 0x7777'7777'7777'7777ULL;
+        uint64_t zero = ~(((x & low3) + low3) | x) & (nibble_ones << 3);
+        if (zero == 0) return num_keys;
+        return static_cast<uint8_t>(__builtin_clzll(zero) / 4);
+    }
+
+    // 指定したtrueIndexを消して、それより後ろのtrueIndexを1つ左に詰める
+    // 後ろの部分をまとめて4bit左シフトするので、keysの数によらず一定の命令数で済む
+    constexpr void removeIndex(uint8_t trueIndex) {
+        uint8_t permutationIndex = indexOf(trueIndex);
+        assert(permutationIndex < getNumKeys());
+        uint64_t tail = body & maskFrom(permutationIndex + 1) & ~0b1111LLU;
+        body = (body & ~maskFrom(permutationIndex)) | (tail << 4) | (getNumKeys() - 1);
     }
 
     // Equivalent to calling p.getKeyIndex(2);
     // 指定したpermutationIndexのtrueIndexを取得する
-    uint8_t operator() (size_t i) const {
+    constexpr uint8_t operator() (size_t i) const {
         return getKeyIndex(i);
     }
 
-    bool isNotFull() const {
+    constexpr bool isNotFull() const {
         uint8_t num = getNumKeys();
         return num != 15;
     }
 
-    bool isFull() const {
+    constexpr bool isFull() const {
         return !isNotFull();
     }
 
-    void insert(size_t permutationIndex, size_t trueIndex) {
-        // permutationIndexで指定されたpermutation slotを開けるために、それより後を右シフト
-        for (size_t i = getNumKeys(); i > permutationIndex; i--) {
-            setKeyIndex(i, getKeyIndex(i - 1));
-        }
-        // 突っ込む
-        setKeyIndex(permutationIndex, trueIndex);
-        incrementNumKeys();
+    // permutationIndexから後ろをまとめて4bit右シフトして空けた場所にtrueIndexを入れる
+    // 右端(permutationIndex = 15)に押し出されたnibbleはkeysの位置なので捨てる
+    constexpr void insert(size_t permutationIndex, size_t trueIndex) {
+        assert(permutationIndex <= getNumKeys() && getNumKeys() <= 14);
+        assert(trueIndex <= 14);
+        uint64_t tail = (body & maskFrom(permutationIndex) & ~0b1111LLU) >> 4;
+        body = (body & ~maskFrom(permutationIndex))
+             | (tail & ~0b1111LLU)
+             | (static_cast<uint64_t>(trueIndex) << (15 - permutationIndex) * 4)
+             | (getNumKeys() + 1);
     }
 
-    static Permutation sizeOne() {
+    static constexpr Permutation sizeOne() {
         Permutation p{};
         p.setNumKeys(1);
         p.setKeyIndex(0, 0);
@@ -112,7 +118,7 @@ struct Permutation {
     }
 
     // NodeをSortするタイミングでpermutationもSortするときに呼ばれる
-    static Permutation fromSorted(size_t n_keys) {
+    static constexpr Permutation fromSorted(size_t n_keys) {
         Permutation permutation{};
         for (size_t i = 0; i < n_keys; i++) {
             permutation.setKeyIndex(i, i);
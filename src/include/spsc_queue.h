@@ -0,0 +1,63 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+// 1つのproducerと1つのconsumerだけが使う、容量固定のlock-freeなリングバッファ
+// producerはtailだけ、consumerはheadだけを書くので、どちらもCASなしのload/storeだけで済む
+// 相手側のindexは手元にcacheしておき、満杯/空に見えたときだけ読み直す(相手のcache lineを毎回読まないため)
+// NOTE: Tはdefault constructibleでmove assignableであること、Capacityは2の累乗であること
+template <typename T, size_t Capacity>
+class SpscQueue {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+    public:
+        SpscQueue() = default;
+        // コピーコンストラクタと代入演算子の削除
+        SpscQueue(SpscQueue &&other) = delete;
+        SpscQueue(const SpscQueue &other) = delete;
+        SpscQueue &operator=(SpscQueue &&other) = delete;
+        SpscQueue &operator=(const SpscQueue &other) = delete;
+
+        // producerのみ呼べる、満杯ならfalseを返してitemには触らない
+        bool push(T &&item) {
+            size_t tail_ = tail.load(std::memory_order_relaxed);
+            if (tail_ - head_cache == Capacity) {
+                head_cache = head.load(std::memory_order_acquire);
+                if (tail_ - head_cache == Capacity) return false;
+            }
+            buffer[tail_ & (Capacity - 1)] = std::move(item);
+            tail.store(tail_ + 1, std::memory_order_release);
+            return true;
+        }
+
+        // consumerのみ呼べる、空ならfalseを返す
+        bool pop(T &item) {
+            size_t head_ = head.load(std::memory_order_relaxed);
+            if (head_ == tail_cache) {
+                tail_cache = tail.load(std::memory_order_acquire);
+                if (head_ == tail_cache) return false;
+            }
+            item = std::move(buffer[head_ & (Capacity - 1)]);
+            head.store(head_ + 1, std::memory_order_release);
+            return true;
+        }
+
+        // おおよその要素数(相手側が並行して動いているので呼んだ時点の値)
+        size_t size() const {
+            return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+        }
+
+        static constexpr size_t capacity() {
+            return Capacity;
+        }
+
+    private:
+        alignas(64) std::atomic<size_t> head{0};    // consumerが次に読む位置
+        size_t tail_cache{0};                       // consumerが最後に読んだtail
+        alignas(64) std::atomic<size_t> tail{0};    // producerが次に書く位置
+        size_t head_cache{0};                       // producerが最後に読んだhead
+        alignas(64) std::array<T, Capacity> buffer{};
+};
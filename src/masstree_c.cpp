@@ -0,0 +1,184 @@
+#include "include/masstree_c.h"
+
+#include <cstring>
+#include <new>
+
+#include "include/masstree.h"
+
+struct masstree_thread {
+    masstree_t *tree;
+    ThreadContext *ctx;
+};
+
+struct masstree {
+    Masstree tree{};
+    std::mutex threadsMutex{};
+    std::deque<std::unique_ptr<masstree_thread>> threads{};    // masstree_thread_register()で渡したハンドル
+};
+
+struct masstree_cursor {
+    masstree_thread_t *thread;
+    std::optional<Key> lo{};
+    std::optional<Key> hi{};
+    std::optional<Key> last{};      // 最後に返したキー(次はこれより大きいキーを探す)
+    SeekResult pending{};           // バッファが足りずに返せなかったキー(次のnextでもう一度返す)
+    int32_t pending_value = 0;      // pendingのValueの中身(masstree_thread_quiesceで解放されてもいいようにコピーしておく)
+    bool done = false;
+};
+
+// C++の例外をCの呼び出し側に漏らさないように、bad_allocはMASSTREE_NO_MEMORYにする
+template <typename Fn>
+static masstree_status_t guarded(Fn &&fn) {
+    try {
+        return fn();
+    } catch (const std::bad_alloc &) {
+        return MASSTREE_NO_MEMORY;
+    }
+}
+
+masstree_t *masstree_open(void) {
+    return new (std::nothrow) masstree;
+}
+
+void masstree_close(masstree_t *tree) {
+    if (tree == nullptr) return;
+    // 他のスレッドはもう触っていないので、溜まっているノードや値はここで解放できる
+    for (auto &thread : tree->threads) thread->ctx->getGC().run();
+    delete tree;
+}
+
+masstree_thread_t *masstree_thread_register(masstree_t *tree) {
+    if (tree == nullptr) return nullptr;
+    try {
+        ThreadContext &ctx = tree->tree.registerThread();
+        std::lock_guard<std::mutex> lock(tree->threadsMutex);
+        tree->threads.emplace_back(new masstree_thread{tree, &ctx});
+        return tree->threads.back().get();
+    } catch (const std::bad_alloc &) {
+        return nullptr;
+    }
+}
+
+masstree_status_t masstree_thread_quiesce(masstree_thread_t *thread) {
+    if (thread == nullptr) return MASSTREE_INVALID_ARGUMENT;
+    thread->ctx->getGC().run();
+    return MASSTREE_OK;
+}
+
+masstree_status_t masstree_get(masstree_thread_t *thread, const void *key, size_t key_len, int32_t *value) {
+    if (thread == nullptr || key == nullptr || key_len == 0) return MASSTREE_INVALID_ARGUMENT;
+    return guarded([&] {
+        Key k = Key::fromBytes(key, key_len);
+        Value *v = thread->tree->tree.get(k, *thread->ctx);
+        if (v == nullptr) return MASSTREE_NOT_FOUND;
+        if (value != nullptr) *value = v->getBody();
+        return MASSTREE_OK;
+    });
+}
+
+masstree_status_t masstree_put(masstree_thread_t *thread, const void *key, size_t key_len, int32_t value) {
+    if (thread == nullptr || key == nullptr || key_len == 0) return MASSTREE_INVALID_ARGUMENT;
+    return guarded([&] {
+        Key k = Key::fromBytes(key, key_len);
+        thread->tree->tree.put(k, new Value(value), *thread->ctx);
+        return MASSTREE_OK;
+    });
+}
+
+masstree_status_t masstree_remove(masstree_thread_t *thread, const void *key, size_t key_len) {
+    if (thread == nullptr || key == nullptr || key_len == 0) return MASSTREE_INVALID_ARGUMENT;
+    return guarded([&] {
+        Key k = Key::fromBytes(key, key_len);
+        Value *taken = thread->tree->tree.take(k, *thread->ctx);
+        if (taken == nullptr) return MASSTREE_NOT_FOUND;
+        thread->ctx->getGC().add(taken);
+        return MASSTREE_OK;
+    });
+}
+
+masstree_cursor_t *masstree_cursor_open(masstree_thread_t *thread, const void *lo, size_t lo_len, const void *hi, size_t hi_len) {
+    if (thread == nullptr || (lo != nullptr && lo_len == 0) || (hi != nullptr && hi_len == 0)) return nullptr;
+    try {
+        auto *cursor = new masstree_cursor{thread};
+        if (lo != nullptr) cursor->lo = Key::fromBytes(lo, lo_len);
+        if (hi != nullptr) cursor->hi = Key::fromBytes(hi, hi_len);
+        return cursor;
+    } catch (const std::bad_alloc &) {
+        return nullptr;
+    }
+}
+
+masstree_status_t masstree_cursor_next(masstree_cursor_t *cursor, void *key_buf, size_t key_buf_len, size_t *key_len, int32_t *value) {
+    if (cursor == nullptr) return MASSTREE_INVALID_ARGUMENT;
+    return guarded([&] {
+        if (cursor->done) return MASSTREE_NOT_FOUND;
+        if (!cursor->pending.has_value()) {
+            Masstree &tree = cursor->thread->tree->tree;
+            ThreadContext &ctx = *cursor->thread->ctx;
+            if (cursor->last.has_value()) {
+                cursor->pending = tree.upper_bound(*cursor->last, ctx);
+            } else if (cursor->lo.has_value()) {
+                cursor->pending = tree.lower_bound(*cursor->lo, ctx);
+            } else {
+                cursor->pending = tree.min(ctx);
+            }
+            if (!cursor->pending.has_value() || (cursor->hi.has_value() && compare_keys(cursor->pending->first, *cursor->hi) >= 0)) {
+                cursor->pending.reset();
+                cursor->done = true;
+                return MASSTREE_NOT_FOUND;
+            }
+            cursor->pending_value = cursor->pending->second->getBody();
+        }
+        const Key &found = cursor->pending->first;
+        size_t len = found.length();
+        if (key_len != nullptr) *key_len = len;
+        if (key_buf != nullptr) {
+            if (key_buf_len < len) return MASSTREE_BUFFER_TOO_SMALL;
+            found.toBytes(key_buf);
+        }
+        if (value != nullptr) *value = cursor->pending_value;
+        cursor->last = std::move(cursor->pending->first);
+        cursor->pending.reset();
+        return MASSTREE_OK;
+    });
+}
+
+void masstree_cursor_close(masstree_cursor_t *cursor) {
+    delete cursor;
+}
+
+masstree_status_t masstree_get_stats(masstree_t *tree, masstree_stats_t *stats) {
+    if (tree == nullptr || stats == nullptr) return MASSTREE_INVALID_ARGUMENT;
+    return guarded([&] {
+        TreeStats tree_stats = tree->tree.stats();
+        *stats = masstree_stats_t{};
+        stats->keys = tree_stats.keys;
+        stats->layers = tree_stats.layers.size();
+        for (const LayerStats &layer : tree_stats.layers) {
+            stats->border_nodes += layer.border_nodes;
+            stats->interior_nodes += layer.interior_nodes;
+        }
+        stats->memory_bytes = tree_stats.totalBytes();
+        // GarbageCollectorの中身は持ち主しか触れないので、atomicな種類ごとのカウンタの差で数える
+        std::lock_guard<std::mutex> lock(tree->threadsMutex);
+        for (auto &thread : tree->threads) {
+            GarbageCollector &gc = thread->ctx->getGC();
+            for (size_t t = 0; t < NUM_RETIRED_TYPES; t++) {
+                stats->retired_objects += gc.getRetired(static_cast<RetiredType>(t)) - gc.getFreed(static_cast<RetiredType>(t));
+            }
+        }
+        return MASSTREE_OK;
+    });
+}
+
+masstree_status_t masstree_get_counter(masstree_t *tree, const char *name, uint64_t *value) {
+    if (tree == nullptr || name == nullptr || value == nullptr) return MASSTREE_INVALID_ARGUMENT;
+    for (size_t i = 0; i < NUM_STATS_COUNTERS; i++) {
+        StatsCounter counter = static_cast<StatsCounter>(i);
+        if (std::strcmp(statsCounterName(counter), name) == 0) {
+            *value = tree->tree.getStats()[counter];
+            return MASSTREE_OK;
+        }
+    }
+    return MASSTREE_NOT_FOUND;
+}
@@ -1,9 +1,9 @@
 #include "include/masstree_get.h"
 
-Value *masstree_get(Node *root, Key &key) {
+Value *masstree_get(Node *root, Key &key, OperationStats *stats) {
     if (root == nullptr) return nullptr;    // Layer0がemptyの状態でgetが来た場合
 RETRY:
-    std::pair<BorderNode*, Version> node_version = findBorder(root, key);
+    std::pair<BorderNode*, Version> node_version = findBorder(root, key, stats);
     BorderNode *node = node_version.first;
     Version version = node_version.second;
 FORWARD:
@@ -11,6 +11,7 @@ FORWARD:
         if (version.is_root) {
             return nullptr; // Layer0がemptyにされた or 下位レイヤに移った場合
         } else {
+            countStats(stats, StatsCounter::GetRetry);
             goto RETRY;
         }
     }
@@ -18,6 +19,7 @@ FORWARD:
     SearchResult result = result_lv.first;
     LinkOrValue lv = result_lv.second;
     if ((node->getVersion() ^ version) > Version::has_locked) {
+        countStats(stats, StatsCounter::GetForward);
         version = node->stableVersion();
         BorderNode *next = node->getNext();
         while (!version.deleted && next != nullptr && key.getCurrentSlice().slice >= next->lowestKey()) {
@@ -36,6 +38,7 @@ FORWARD:
         goto RETRY;
     } else {
         assert(result == UNSTABLE);
+        countStats(stats, StatsCounter::GetUnstable);
         goto FORWARD;
     }
 }
\ No newline at end of file
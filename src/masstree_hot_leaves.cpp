@@ -0,0 +1,80 @@
+#include "include/masstree_hot_leaves.h"
+
+#include <algorithm>
+
+// 古いrootを渡された場合は本当のrootまで登る
+static Node *layer_root(Node *root) {
+    while (!root->getIsRoot() && root->getParent() != nullptr) root = root->getParent();
+    return root;
+}
+
+// レイヤの中のノードを全て辿り、BorderNodeごとにvisitを呼ぶ(下位レイヤにも降りる)
+// prefixにはnodeのレイヤまでのsliceが、lower/upperには降りてきたInteriorNodeのseparatorで決まるnodeの担当範囲が入っている
+template <typename Visit>
+static void visit_borders(Node *node, std::vector<uint64_t> &prefix, uint64_t lower, std::optional<uint64_t> upper, const Visit &visit) {
+    if (node->getIsBorder()) {
+        BorderNode *border = reinterpret_cast<BorderNode *>(node);
+        std::vector<ScanEntry> entries;
+        BorderNode *next = nullptr;
+        Version version = read_entries(border, entries, next);
+        if (version.deleted) return;
+        visit(border, entries, lower, upper, prefix);
+        for (const ScanEntry &entry : entries) {
+            if (entry.key_len != BorderNode::key_len_layer || entry.lv.next_layer == nullptr) continue;
+            prefix.push_back(entry.slice);
+            visit_borders(layer_root(entry.lv.next_layer), prefix, 0, std::nullopt, visit);
+            prefix.pop_back();
+        }
+        return;
+    }
+    std::vector<uint64_t> slices;
+    std::vector<Node *> children;
+    Version version = read_interior(reinterpret_cast<InteriorNode *>(node), slices, children);
+    if (version.deleted) return;
+    // children[i]はslices[i - 1]以上slices[i]未満を担当する(両端は親から受け取った範囲)
+    for (size_t i = 0; i < children.size(); i++) {
+        if (children[i] == nullptr) continue;
+        uint64_t child_lower = i == 0 ? lower : slices[i - 1];
+        std::optional<uint64_t> child_upper = i < slices.size() ? std::optional<uint64_t>(slices[i]) : upper;
+        visit_borders(children[i], prefix, child_lower, child_upper, visit);
+    }
+}
+
+std::vector<HotLeaf> masstree_hottest_leaves(Node *root, size_t k) {
+    std::vector<HotLeaf> leaves;
+    if (root == nullptr || k == 0) return leaves;
+    std::vector<uint64_t> prefix;
+    visit_borders(layer_root(root), prefix, 0, std::nullopt, [&](BorderNode *border, const std::vector<ScanEntry> &entries, uint64_t lower, std::optional<uint64_t> upper, const std::vector<uint64_t> &prefix_) {
+        uint32_t lock_samples = border->getLockSamples();
+        if (lock_samples == 0) return;
+        HotLeaf leaf{};
+        leaf.node = border;
+        leaf.prefix = prefix_;
+        leaf.lowest_slice = lower;
+        leaf.next_slice = upper;
+        leaf.num_keys = entries.size();
+        leaf.lock_samples = lock_samples;
+        leaf.contended_samples = border->getContendedSamples();
+        leaves.push_back(std::move(leaf));
+    });
+    // 待たされた回数が多いものを優先したいので、lock_samplesが同じならcontended_samplesで比べる
+    auto hotter = [](const HotLeaf &a, const HotLeaf &b) {
+        if (a.lock_samples != b.lock_samples) return a.lock_samples > b.lock_samples;
+        return a.contended_samples > b.contended_samples;
+    };
+    if (leaves.size() > k) {
+        std::partial_sort(leaves.begin(), leaves.begin() + static_cast<std::ptrdiff_t>(k), leaves.end(), hotter);
+        leaves.resize(k);
+    } else {
+        std::sort(leaves.begin(), leaves.end(), hotter);
+    }
+    return leaves;
+}
+
+void masstree_reset_lock_samples(Node *root) {
+    if (root == nullptr) return;
+    std::vector<uint64_t> prefix;
+    visit_borders(layer_root(root), prefix, 0, std::nullopt, [](BorderNode *border, const std::vector<ScanEntry> &, uint64_t, std::optional<uint64_t>, const std::vector<uint64_t> &) {
+        border->resetLockSamples();
+    });
+}
@@ -1,34 +1,50 @@
 #include "include/masstree_node.h"
 
-std::pair<BorderNode*, Version> findBorder(Node *root, const Key &key) {
+std::pair<BorderNode*, Version> findBorder(Node *root, const Key &key, OperationStats *stats) {
+    std::optional<uint64_t> upper_bound{};
+    return findBorder(root, key, upper_bound, stats);
+}
+
+std::pair<BorderNode*, Version> findBorder(Node *root, const Key &key, std::optional<uint64_t> &upper_bound, OperationStats *stats) {
+    std::optional<uint64_t> node_upper_bound{};     // nodeが担当するsliceの上限(親までのseparatorで決まる)
 RETRY:
     Node *node = root;
     Version version = node->stableVersion();
+    node_upper_bound.reset();
 
     if (!version.is_root) {
         root = root->getParent();
         goto RETRY;
     }
 DESCEND:
-    if (node->getIsBorder()) return std::pair<BorderNode*, Version>(reinterpret_cast<BorderNode *>(node), version);
+    if (node->getIsBorder()) {
+        upper_bound = node_upper_bound;
+        return std::pair<BorderNode*, Version>(reinterpret_cast<BorderNode *>(node), version);
+    }
     InteriorNode *interior_node = reinterpret_cast<InteriorNode*>(node);
-    Node *next_node = interior_node->findChild(key.getCurrentSlice().slice);
+    // 子ノードの上限は、子ノードの右にseparatorがあればそれ、無ければnodeの上限と同じ
+    std::optional<uint64_t> child_upper_bound = node_upper_bound;
+    Node *next_node = interior_node->findChild(key.getCurrentSlice().slice, child_upper_bound);
     Version next_version;
     if (next_node != nullptr) {
         next_version = next_node->stableVersion();
     } else {
-        next_version = Version();   // CHECK: ここなんでコンストラクタ呼んでるんだ？先の条件で未定義を回避するためか？
+        next_version = Version();   // split中のInteriorNodeを読むとnullptrが返ってくることがあるので、下のvalidationに回す
     }
-    // nodeがロックされていないならそのまま下のノードに降下していく
-    if ((next_node->getVersion() ^ next_version) <= Version::has_locked) {
-        assert(next_node != nullptr);
+    // findChildしている間にnode(親)が更新されていないならそのまま下のノードに降下していく
+    // NOTE: ここで確認するのはnext_nodeではなくnodeのversion、nodeが変わっていたらfindChildの結果が信用できない
+    if (next_node != nullptr && (node->getVersion() ^ version) <= Version::has_locked) {
         node = next_node;
         version = next_version;
+        node_upper_bound = child_upper_bound;
         goto DESCEND;
     }
     // validationを挟んでversionが更新されていないか確認、されてたらRootからRETRY
     Version validation_version = node->stableVersion();
-    if (validation_version.v_split != version.v_split) goto RETRY;
+    if (validation_version.v_split != version.v_split) {
+        countStats(stats, StatsCounter::FindBorderRetry);
+        goto RETRY;
+    }
     version = validation_version;
     goto DESCEND;
 }
\ No newline at end of file
@@ -0,0 +1,173 @@
+#include "include/masstree_order.h"
+
+#include <limits>
+#include <random>
+
+// 推定に使う乱数(スレッドごと)
+static std::mt19937_64 &order_rng() {
+    thread_local std::mt19937_64 rng{std::random_device{}()};
+    return rng;
+}
+
+// node以下の[lo, hi)のキーの数を数える、rngがnullptrなら全て数え、そうでなければサンプリングで推定する
+// 範囲に全て含まれる部分木(lo/hiが両方nullptr)はKnuthの推定量で、各段で子を1つだけ選んで子の数を掛けながら降りる
+// 範囲と一部だけ重なるノードでは、lo/hiを含む子は範囲付きでそれぞれ降り、間の子は1つ選んで全て含まれる部分木として推定する
+// currentにはこのレイヤまでのスライスが入っている(lo/hiと比較するためにキーを組み立てる)
+// lo/hiはこのレイヤまでのスライスがcurrentと一致していて、このレイヤのスライスを持っている場合だけ渡される
+static double count_node(Node *node, const Key *lo, const Key *hi, Key &current, std::mt19937_64 *rng) {
+    size_t depth = current.slices.size();
+    uint64_t lo_slice = (lo != nullptr) ? lo->slices[depth] : 0;
+    uint64_t hi_slice = (hi != nullptr) ? hi->slices[depth] : std::numeric_limits<uint64_t>::max();
+
+    if (!node->getIsBorder()) {
+        std::vector<uint64_t> slices;
+        std::vector<Node *> children;
+        if (read_interior(reinterpret_cast<InteriorNode *>(node), slices, children).deleted) return 0;
+        if (rng != nullptr && lo == nullptr && hi == nullptr) {
+            std::uniform_int_distribution<size_t> pick(0, children.size() - 1);
+            return static_cast<double>(children.size()) * count_node(children[pick(*rng)], nullptr, nullptr, current, rng);
+        }
+        // child(i)が担当するのは[slices[i - 1], slices[i])なので、[lo_slice, hi_slice]と重なる子だけ見る
+        // lo_slice/hi_sliceを含む子だけ範囲付きで降り、間の子は範囲に全て含まれるので推定なら1つだけ選んで数を掛ける
+        // 範囲の端の最下段(子がBorderNode)は全て数える(高々ORDER個で、BorderNodeごとのキーの数のばらつきが推定の誤差の大部分なので)
+        bool sample = rng != nullptr && !children[0]->getIsBorder();
+        std::vector<Node *> middle;
+        double total = 0;
+        for (size_t i = 0; i < children.size(); i++) {
+            bool below_hi = (i == 0) || slices[i - 1] <= hi_slice;
+            bool above_lo = (i == slices.size()) || lo_slice < slices[i];
+            if (!below_hi || !above_lo) continue;
+            bool has_lo = lo != nullptr && (i == 0 || slices[i - 1] <= lo_slice);
+            bool has_hi = hi != nullptr && (i == slices.size() || hi_slice < slices[i]);
+            if (has_lo || has_hi || !sample) {
+                total += count_node(children[i], has_lo ? lo : nullptr, has_hi ? hi : nullptr, current, rng);
+            } else {
+                middle.push_back(children[i]);
+            }
+        }
+        if (!middle.empty()) {
+            std::uniform_int_distribution<size_t> pick(0, middle.size() - 1);
+            total += static_cast<double>(middle.size()) * count_node(middle[pick(*rng)], nullptr, nullptr, current, rng);
+        }
+        return total;
+    }
+
+    std::vector<ScanEntry> entries;
+    BorderNode *next = nullptr;
+    if (read_entries(reinterpret_cast<BorderNode *>(node), entries, next).deleted) return 0;
+    double total = 0;
+    if (rng != nullptr && lo == nullptr && hi == nullptr) {
+        // 全て含まれる場合はこのレイヤのキーだけ数え、下位レイヤへのリンクも1つだけ選んでリンクの数を掛ける
+        std::vector<const ScanEntry *> layers;
+        for (const ScanEntry &entry : entries) {
+            if (entry.key_len == BorderNode::key_len_layer) {
+                layers.push_back(&entry);
+            } else {
+                total += 1;
+            }
+        }
+        if (!layers.empty()) {
+            std::uniform_int_distribution<size_t> pick(0, layers.size() - 1);
+            const ScanEntry &entry = *layers[pick(*rng)];
+            current.slices.resize(depth);
+            current.slices.push_back(entry.slice);
+            total += static_cast<double>(layers.size()) * count_node(entry.lv.next_layer, nullptr, nullptr, current, rng);
+            current.slices.resize(depth);
+        }
+        return total;
+    }
+    for (const ScanEntry &entry : entries) {
+        if (entry.slice < lo_slice || hi_slice < entry.slice) continue;
+        current.slices.resize(depth);
+        current.slices.push_back(entry.slice);
+        if (entry.key_len == BorderNode::key_len_layer) {
+            // lo/hiがこのスライスで終わっている場合、下位レイヤのキーは全てlo/hiより大きい
+            bool lo_continues = lo != nullptr && entry.slice == lo_slice && lo->slices.size() > depth + 1;
+            bool hi_continues = hi != nullptr && entry.slice == hi_slice && hi->slices.size() > depth + 1;
+            if (hi != nullptr && entry.slice == hi_slice && !hi_continues) continue;
+            total += count_node(entry.lv.next_layer, lo_continues ? lo : nullptr, hi_continues ? hi : nullptr, current, rng);
+            continue;
+        }
+        if (entry.key_len == BorderNode::key_len_has_suffix) {
+            entry.suffix->appendTo(current);
+        } else {
+            current.lastSliceSize = entry.key_len;
+        }
+        // 範囲の端のスライスだけキー全体で比較する
+        if (entry.slice == lo_slice && lo != nullptr && compare_keys(current, *lo) < 0) continue;
+        if (entry.slice == hi_slice && hi != nullptr && compare_keys(current, *hi) >= 0) continue;
+        total += 1;
+    }
+    current.slices.resize(depth);
+    return total;
+}
+
+static double count_subtree(Node *node, const Key *lo, const Key *hi, Key &current, bool exact, size_t samples) {
+    if (exact) return count_node(node, lo, hi, current, nullptr);
+    double total = 0;
+    for (size_t i = 0; i < samples; i++) total += count_node(node, lo, hi, current, &order_rng());
+    return total / static_cast<double>(samples);
+}
+
+double masstree_count_range(Node *root, const Key *lo, const Key *hi, bool exact) {
+    if (root == nullptr) return 0;
+    if (lo != nullptr && hi != nullptr && compare_keys(*lo, *hi) >= 0) return 0;
+    Key current({0}, 8);
+    current.slices.clear();
+    return count_subtree(root, lo, hi, current, exact, ORDER_STATS_SAMPLES);
+}
+
+// 各部分木のキーの数を数えながら(推定しながら)k番目のキーまで降りる
+// 推定の場合、各段で全ての子の大きさをKnuthの推定量で求めるので1回あたりO(ORDER * samples * log n)、段の数を掛けてO(log^2 n)
+// NOTE: 推定がずれてkが残った場合は、最後に見たキーを返す
+static std::optional<Key> select_node(Node *node, double &k, Key &current, bool exact) {
+    // 子ごとの推定は回数を減らす(子の数だけ推定するので)
+    constexpr size_t samples = (ORDER_STATS_SAMPLES + Node::ORDER - 1) / Node::ORDER;
+    size_t depth = current.slices.size();
+    if (!node->getIsBorder()) {
+        std::vector<uint64_t> slices;
+        std::vector<Node *> children;
+        if (read_interior(reinterpret_cast<InteriorNode *>(node), slices, children).deleted) return std::nullopt;
+        for (size_t i = 0; i < children.size(); i++) {
+            double size = count_subtree(children[i], nullptr, nullptr, current, exact, samples);
+            if (k < size || i + 1 == children.size()) return select_node(children[i], k, current, exact);
+            k -= size;
+        }
+        return std::nullopt;
+    }
+
+    std::vector<ScanEntry> entries;
+    BorderNode *next = nullptr;
+    if (read_entries(reinterpret_cast<BorderNode *>(node), entries, next).deleted) return std::nullopt;
+    std::optional<Key> last{};
+    for (const ScanEntry &entry : entries) {
+        current.slices.resize(depth);
+        current.slices.push_back(entry.slice);
+        if (entry.key_len == BorderNode::key_len_layer) {
+            double size = count_subtree(entry.lv.next_layer, nullptr, nullptr, current, exact, samples);
+            if (k < size) return select_node(entry.lv.next_layer, k, current, exact);
+            k -= size;
+            continue;
+        }
+        if (entry.key_len == BorderNode::key_len_has_suffix) {
+            entry.suffix->appendTo(current);
+        } else {
+            current.lastSliceSize = entry.key_len;
+        }
+        if (k < 1) return current;
+        k -= 1;
+        last = current;
+    }
+    if (!exact) return last;
+    return std::nullopt;
+}
+
+std::optional<Key> masstree_select(Node *root, size_t k, bool exact) {
+    if (root == nullptr) return std::nullopt;
+    Key current({0}, 8);
+    current.slices.clear();
+    double remaining = static_cast<double>(k);
+    std::optional<Key> key = select_node(root, remaining, current, exact);
+    if (key.has_value()) key->cursor = 0;
+    return key;
+}
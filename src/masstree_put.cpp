@@ -1,5 +1,7 @@
 #include "include/masstree_put.h"
 
+#include <thread>
+
 // Layer0がempty(Masstreeが空)の場合、新しいMasstreeを作る
 BorderNode *start_new_tree(const Key &key, Value *value) {
     BorderNode *root = new BorderNode();
@@ -51,7 +53,7 @@ ssize_t check_break_invariant(BorderNode *const borderNode, const Key &key) {
 }
 
 // invariantを検知した時の処理, §4.6.3
-void handle_break_invariant(BorderNode *node, Key &key, size_t old_index, GarbageCollector &gc) {
+void handle_break_invariant(BorderNode *node, Key &key, size_t old_index, GarbageCollector &gc, OperationStats *stats) {
     assert(node->isLocked());
     if (node->getKeyLen(old_index) == BorderNode::key_len_has_suffix) { // [1] 競合するkey(k2)を含むBorderNodeにkey(k1)をinsertする際に新しいレイヤを作成する
         /*
@@ -59,10 +61,17 @@ void handle_break_invariant(BorderNode *node, Key &key, size_t old_index, Garbag
          * [2] It allocates a new empty border node n′, [3] inserts k2’s current value into it under the appropriate key slice, [4] and then replaces k2’s value in n with the next_layer pointer n′.
          * Finally, it unlocks n and continues the attempt to insert k1, now using the newly created layer n′.
          */
+        /*
+         * Since this process only affects a single key, there is no need to update n’s version or permutation.
+         * However, readers must reliably distinguish true values from next_layer pointers. Since the pointer and the layer marker are stored separately, this requires a sequence of writes.
+         * [5] First, the writer marks the key as UNSTABLE; readers seeing this marker will retry.
+         * [6] It then writes the next_layer pointer, and finally marks the key as a LAYER.
+         */
+        node->setKeyLen(old_index, BorderNode::key_len_unstable);       // [5] next_layerをいじる前にUNSTABLEにしてreaderが観測した際にretryさせる
         BorderNode *n1 = new BorderNode{};                              // [2] 新しいBorderNodeの作成
         n1->setIsRoot(true);
         n1->setUpperLayer(node);
-        Value *k2_value = node->getLV(old_index).value;
+        Value *k2_value = node->takeLV(old_index).value;               // lock-freeなupdateに上書きされないようにスロットから取り出す
         BigSuffix *k2_suffix_copy = new BigSuffix(*node->getKeySuffixes().get(old_index));
         if (k2_suffix_copy->hasNext()) {                                // [3] 適切なkey sliceの下にk2をinsertする
             n1->setKeyLen(0, BorderNode::key_len_has_suffix);
@@ -75,17 +84,11 @@ void handle_break_invariant(BorderNode *node, Key &key, size_t old_index, Garbag
             n1->setKeySlice(0, k2_suffix_copy->getCurrentSlice().slice);
             n1->setLV(0, LinkOrValue(k2_value));
         }
-        /*
-         * Since this process only affects a single key, there is no need to update n’s version or permutation.
-         * However, readers must reliably distinguish true values from next_layer pointers. Since the pointer and the layer marker are stored separately, this requires a sequence of writes.
-         * [5] First, the writer marks the key as UNSTABLE; readers seeing this marker will retry.
-         * [6] It then writes the next_layer pointer, and finally marks the key as a LAYER.
-         */
-        node->setKeyLen(old_index, BorderNode::key_len_unstable);       // [5] next_layerをいじる前にUNSTABLEにしてreaderが観測した際にretryさせる
         node->setLV(old_index, LinkOrValue(n1));                        // [4] node内のk2_valueを次のレイヤへのポインタn1に置き換える
         node->setKeyLen(old_index, BorderNode::key_len_layer);          // [6] next_layerをいじってLAYERに変える
         gc.add(node->getKeySuffixes().get(old_index));
         node->getKeySuffixes().unreferenced(old_index);
+        countStats(stats, StatsCounter::LayerCreate);
     } else {
         // 次のLayerでinsertを行う
         assert(node->getKeyLen(old_index) == BorderNode::key_len_layer);
@@ -117,7 +120,9 @@ void insert_to_border(BorderNode *border, const Key &key, Value *value, GarbageC
         border->setInserting(true);
         BigSuffix *suffix = border->getKeySuffixes().get(insertion_point_trueIndex);
         if (suffix != nullptr) gc.add(suffix);  // ぬるぽじゃないならgcに投げておく
-        gc.add(border->getLV(insertion_point_trueIndex).value);
+        // removeでValueは取り出し済みのはずだが、残っていればgcに投げておく
+        Value *old_value = border->takeLV(insertion_point_trueIndex).value;
+        if (old_value != nullptr) gc.add(old_value);
     }
     border->getKeySuffixes().set(insertion_point_trueIndex, nullptr);   // suffixをclearしておく
 
@@ -183,28 +188,30 @@ void split_keys_among(InteriorNode *parent, InteriorNode *parent1, uint64_t slic
     temp_key_slice[node_index] = slice;
 
     // parentとparent1を初期化する、本当はpermutationのnkeysを0にすれば良いけどバグが怖いので一応全部初期化しておく
-    parent->setNumKeys(0);
-    parent->resetKeySlices();
-    parent->resetChildren();
+    // parentとparent1はsplittingが立っているので、ここからはrelaxedで書いてunlockのreleaseでまとめて公開する
+    Node::beginLockedWrites();
+    parent->setNumKeys(0, LOCKED_WRITE_ORDER);
+    parent->resetKeySlices(LOCKED_WRITE_ORDER);
+    parent->resetChildren(LOCKED_WRITE_ORDER);
 
     size_t split = (Node::ORDER%2 == 0) ? Node::ORDER/2 : Node::ORDER/2 + 1;    // InteriorNodeはバランスの関係上ORDERの半分がsplit pointになる、関数で定義されていたけど参照しているのがここしかなかった
     size_t i = 0, j = 0;
     for (i = 0; i < split - 1; i++) {
-        parent->setChild(i, temp_child[i]);
-        parent->getChild(i)->setParent(parent);
-        parent->setKeySlice(i, temp_key_slice[i]);
-        parent->incNumKeys();
+        parent->setChild(i, temp_child[i], LOCKED_WRITE_ORDER);
+        temp_child[i]->setParent(parent);
+        parent->setKeySlice(i, temp_key_slice[i], LOCKED_WRITE_ORDER);
+        parent->incNumKeys(LOCKED_WRITE_ORDER);
     }
-    parent->setChild(i, temp_child[i]);
+    parent->setChild(i, temp_child[i], LOCKED_WRITE_ORDER);
     temp_child[i]->setParent(parent);
     k_prime = temp_key_slice[split - 1];
     for (i++, j = 0; i < Node::ORDER; i++, j++) {
-        parent1->setChild(j, temp_child[i]);
-        parent1->getChild(j)->setParent(parent1);
-        parent1->setKeySlice(j, temp_key_slice[i]);
-        parent1->incNumKeys();
+        parent1->setChild(j, temp_child[i], LOCKED_WRITE_ORDER);
+        temp_child[i]->setParent(parent1);
+        parent1->setKeySlice(j, temp_key_slice[i], LOCKED_WRITE_ORDER);
+        parent1->incNumKeys(LOCKED_WRITE_ORDER);
     }
-    parent1->setChild(j, temp_child[i]);
+    parent1->setChild(j, temp_child[i], LOCKED_WRITE_ORDER);
     temp_child[i]->setParent(parent1);
 
     // for (auto &node : temp_child) {
@@ -282,7 +289,7 @@ void split_keys_among(BorderNode *node, BorderNode *node1, const Key &key, Value
         if (j == insertion_index) j++;  // keyをinsertする場所だけ開けておく ([10,20,30]で15をinsertするなら[10,__,20,30]みたいな感じ)
         temp_key_len[j] = node->getKeyLen(i);
         temp_key_slice[j] = node->getKeySlice(i);
-        temp_lv[j] = node->getLV(i);
+        temp_lv[j] = node->takeLV(i);
         temp_suffix[j] = node->getKeySuffixes().get(i);
     }
     // insertion_indexだけあけてあるtempにinsertする
@@ -296,7 +303,7 @@ void split_keys_among(BorderNode *node, BorderNode *node1, const Key &key, Value
         if (key.hasNext()) {
             // キーが9byte以上の場合残りはSuffixに保存されるため、キースライスが全て使用されていてもノードを分割する必要がない -> splitは発生しない
             // CHECK: っていう話らしいんだけど、Suffixに保存されるからSplitされないっていうのはわかる、その処理はどこで書いているんだ？
-            temp_key_slice[insertion_index] = cursor.size;
+            temp_key_slice[insertion_index] = cursor.slice;
             temp_key_len[insertion_index] = BorderNode::key_len_has_suffix;
             temp_suffix[insertion_index] = BigSuffix::from(key, key.cursor + 1);
             temp_lv[insertion_index].value = value;
@@ -312,35 +319,38 @@ void split_keys_among(BorderNode *node, BorderNode *node1, const Key &key, Value
     create_slice_table(node, table, found);
     size_t split = split_point(cursor.slice, table, found);
     // nodeとnode1を初期化する
-    node->resetKeyLen();
-    node->resetKeySlice();
-    node->resetLVs();
+    // nodeとnode1はsplittingが立っているので、ここからはrelaxedで書いてsetPermutationとunlockのreleaseでまとめて公開する
+    // (新しく作ったBigSuffixもここのfenceで公開される)
+    Node::beginLockedWrites();
+    node->resetKeyLen(LOCKED_WRITE_ORDER);
+    node->resetKeySlice(LOCKED_WRITE_ORDER);
+    node->resetLVs(LOCKED_WRITE_ORDER);
     node->getKeySuffixes().reset();
 
-    node1->resetKeyLen();
-    node1->resetKeySlice();
-    node1->resetLVs();
+    node1->resetKeyLen(LOCKED_WRITE_ORDER);
+    node1->resetKeySlice(LOCKED_WRITE_ORDER);
+    node1->resetLVs(LOCKED_WRITE_ORDER);
     node1->getKeySuffixes().reset();
 
     // tempとsplit pointから各ノードにコピーする
     for (size_t i = 0; i < split; i++) {
-        node->setKeyLen(i, temp_key_len[i]);
-        node->setKeySlice(i, temp_key_slice[i]);
-        node->setLV(i, temp_lv[i]);
+        node->setKeyLen(i, temp_key_len[i], LOCKED_WRITE_ORDER);
+        node->setKeySlice(i, temp_key_slice[i], LOCKED_WRITE_ORDER);
+        node->setLV(i, temp_lv[i], LOCKED_WRITE_ORDER);
         node->getKeySuffixes().set(i, temp_suffix[i]);
         if (temp_key_len[i] == BorderNode::key_len_layer) {
-            node->getLV(i).next_layer->setUpperLayer(node); // BorderNodeがvalueじゃなくてnextLayerを持っている場合はそれを設定する
+            temp_lv[i].next_layer->setUpperLayer(node); // BorderNodeがvalueじゃなくてnextLayerを持っている場合はそれを設定する
         }
     }
     node->setPermutation(Permutation::fromSorted(split));
 
     for (size_t i = split, j = 0; i < Node::ORDER; i++, j++) {
-        node1->setKeyLen(j, temp_key_len[i]);
-        node1->setKeySlice(j, temp_key_slice[i]);
-        node1->setLV(j, temp_lv[i]);
+        node1->setKeyLen(j, temp_key_len[i], LOCKED_WRITE_ORDER);
+        node1->setKeySlice(j, temp_key_slice[i], LOCKED_WRITE_ORDER);
+        node1->setLV(j, temp_lv[i], LOCKED_WRITE_ORDER);
         node1->getKeySuffixes().set(j, temp_suffix[i]);
-        if (node1->getKeyLen(j) == BorderNode::key_len_layer) {
-            node1->getLV(j).next_layer->setUpperLayer(node1);
+        if (temp_key_len[i] == BorderNode::key_len_layer) {
+            temp_lv[i].next_layer->setUpperLayer(node1);
         }
     }
     node1->setPermutation(Permutation::fromSorted(Node::ORDER - split));
@@ -393,31 +403,39 @@ void insert_into_parent(InteriorNode *parent, Node *node1, uint64_t slice, size_
     assert(parent->getInserting());
     assert(node1->isLocked());
 
+    // parentはinsertingが立っているので、relaxedで書いてunlockのreleaseでまとめて公開する
+    // (node1の中身はsplit_keys_amongで書き終わっているので、ここのfenceで一緒に公開される)
+    Node::beginLockedWrites();
     // node1をinsertするスペースを作るために1つ右にずらす
     for (size_t i = parent->getNumKeys(); i > node_index; i--) {
-        parent->setChild(i + 1, parent->getChild(i));
-        parent->setKeySlice(i, parent->getKeySlice(i - 1));
+        parent->setChild(i + 1, parent->getChild(i), LOCKED_WRITE_ORDER);
+        parent->setKeySlice(i, parent->getKeySlice(i - 1), LOCKED_WRITE_ORDER);
     }
-    parent->setChild(node_index + 1, node1);
-    parent->setKeySlice(node_index, slice);
-    parent->incNumKeys();
+    parent->setChild(node_index + 1, node1, LOCKED_WRITE_ORDER);
+    parent->setKeySlice(node_index, slice, LOCKED_WRITE_ORDER);
+    parent->incNumKeys(LOCKED_WRITE_ORDER);
 
     node1->setParent(parent);
     // assert(!parent->debug_has_skip());
 }
 
-Node *split(Node *node, const Key &key, Value *value) {
+Node *split(Node *node, const Key &key, Value *value, OperationStats *stats) {
     assert(node->isLocked());
+    countStats(stats, StatsCounter::BorderSplit);
     Node *node1 = new BorderNode{};
     node->setSplitting(true);
     node1->setVersion(node->getVersion());
     split_keys_among(reinterpret_cast<BorderNode *>(node), reinterpret_cast<BorderNode *>(node1), key, value);  // nodeとnode1でsplitする
+    return insert_split_sibling(node, node1, stats);
+}
+
+Node *insert_split_sibling(Node *node, Node *node1, OperationStats *stats) {
     std::optional<uint64_t> pull_up = std::nullopt; // CHECK: 本当は使いたくないけどuint64_tでエラーを回収するの大変そうだからこっちにしておく  TODO: pairとかでoptionalを回避する
 ASCEND:
     // 親ノードが一杯かどうかを調べて、一杯ならsplitしてその親ノードに再帰的にアクセスしに行く
     assert(node->isLocked());
     assert(node1->isLocked());
-    InteriorNode *parent = node->lockedParent();
+    InteriorNode *parent = node->lockedParent(stats);
     // if (parent != nullptr) assert(parent->debug_contain_child(node));    // NOTE: debugなので実装してない、必要になったら実装する
     if (parent == nullptr) {
         // nodeがRoot nodeの場合
@@ -449,6 +467,7 @@ ASCEND:
     } else {
         // parentに空きがない場合
         assert(parent->isFull());
+        countStats(stats, StatsCounter::InteriorSplit);
         parent->setSplitting(true);
         size_t node_index = parent->findChildIndex(node);
         node->unlock();
@@ -470,28 +489,208 @@ ASCEND:
     }
 }
 
-std::pair<PutResult, Node*> masstree_put(Node *root, Key &key, Value *value, GarbageCollector &gc) {
+bool split_leaf(BorderNode *node, Node *&new_root, OperationStats *stats) {
+    new_root = nullptr;
+    node->lock();
+    Permutation permutation = node->getPermutation();
+    size_t num_keys = permutation.getNumKeys();
+    if (node->getDeleted() || num_keys < 2) {
+        node->unlock();
+        return false;
+    }
+    // 同じsliceのキーは同じBorderNodeに置く必要があるので、sliceが変わる位置のうち真ん中に一番近いところで分ける
+    auto distance = [num_keys](size_t i) { return (2 * i > num_keys) ? 2 * i - num_keys : num_keys - 2 * i; };
+    size_t cut = 0;
+    for (size_t i = 1; i < num_keys; i++) {
+        if (node->getKeySlice(permutation(i)) == node->getKeySlice(permutation(i - 1))) continue;
+        if (cut == 0 || distance(i) < distance(cut)) cut = i;
+    }
+    if (cut == 0) {
+        node->unlock();
+        return false;
+    }
+
+    countStats(stats, StatsCounter::BorderSplit);
+    BorderNode *node1 = new BorderNode{};
+    node->setSplitting(true);
+    node1->setVersion(node->getVersion());
+    // nodeとnode1はsplittingが立っているので、relaxedで書いてsetPermutationとunlockのreleaseでまとめて公開する
+    Node::beginLockedWrites();
+    for (size_t i = cut, j = 0; i < num_keys; i++, j++) {
+        uint8_t trueIndex = permutation(i);
+        uint8_t len = node->getKeyLen(trueIndex);
+        LinkOrValue lv = node->takeLV(trueIndex);
+        node1->setKeyLen(j, len, LOCKED_WRITE_ORDER);
+        node1->setKeySlice(j, node->getKeySlice(trueIndex), LOCKED_WRITE_ORDER);
+        node1->setLV(j, lv, LOCKED_WRITE_ORDER);
+        node1->getKeySuffixes().set(j, node->getKeySuffixes().get(trueIndex));
+        if (len == BorderNode::key_len_layer) lv.next_layer->setUpperLayer(node1);
+        // 移したスロットは未使用(key_len = 0)に戻す
+        node->getKeySuffixes().set(trueIndex, nullptr);
+        node->setKeyLen(trueIndex, 0, LOCKED_WRITE_ORDER);
+        node->setKeySlice(trueIndex, 0, LOCKED_WRITE_ORDER);
+    }
+    node1->setPermutation(Permutation::fromSorted(num_keys - cut));
+    permutation.setNumKeys(cut);
+    node->setPermutation(permutation);
+
+    // nodeとnode1をつないでから親に入れる
+    node1->setNext(node->getNext());
+    node1->setPrev(node);
+    node->setNext(node1);
+    if (node1->getNext() != nullptr) node1->getNext()->setPrev(node1);
+    new_root = insert_split_sibling(node, node1, stats);
+    return true;
+}
+
+size_t put_batch_to_border(Node *root, std::vector<Key> &keys, const std::vector<Value *> &values, size_t begin, GarbageCollector &gc, OperationStats *stats) {
+    assert(root != nullptr);
+    assert(begin < keys.size());
+    assert(keys.size() == values.size());
+RETRY:
+    // 先頭のkeyでBorderNodeを探してロックする、nodeが担当するsliceの上限も降りる途中のseparatorから取っておく
+    // NOTE: nextの最小のキーはremoveで大きくなるので上限には使えない(nextに入るべきキーをnodeに入れてしまう)
+    std::optional<uint64_t> upper_bound{};
+    std::pair<BorderNode *, Version> node_version = findBorder(root, keys[begin], upper_bound, stats);
+    BorderNode *node = node_version.first;
+    Version version  = node_version.second;
+    node->lock(stats);
+    Version locked_version = node->getVersion();
+    if (locked_version.deleted) {
+        node->unlock();
+        if (locked_version.is_root) return begin;   // Layer0が消えているので1件ずつのputに任せる
+        countStats(stats, StatsCounter::PutRetry);
+        goto RETRY;
+    }
+    if (Version::splitHappened(version, locked_version)) {
+        // findBorder -> lockの間にsplitされた場合は上限も変わっているので、右に移動せずに探し直す
+        countStats(stats, StatsCounter::PutRetry);
+        node->unlock();
+        goto RETRY;
+    }
+
+    // nodeのlockを持っている間はnodeのsplitは起きないので、nodeが担当する範囲はupper_bound未満から狭くならない
+    size_t i = begin;
+    for (; i < keys.size(); i++) {
+        Key &key = keys[i];
+        if (upper_bound.has_value() && key.getCurrentSlice().slice >= upper_bound.value()) break;  // 次のBorderNodeのキー
+
+        std::tuple<SearchResult, LinkOrValue, size_t> result_lv_index = node->searchLinkOrValueWithIndex(key);
+        SearchResult result = std::get<0>(result_lv_index);
+        size_t index        = std::get<2>(result_lv_index);
+        if (result == VALUE) {
+            // lock-freeなupdateと競合しないように取り出してから置き換える
+            Value *old_value = node->takeLV(index).value;
+            if (old_value != values[i]) gc.add(old_value);
+            node->setLV(index, LinkOrValue(values[i]));
+        } else if (result == NOTFOUND
+                   && node->getPermutation().isNotFull()
+                   && !node->getInserting()     // スロットの再利用はunlockでv_insertを更新するまで1回だけ
+                   && check_break_invariant(node, key) == -1) {
+            insert_to_border(node, key, values[i], gc);
+        } else {
+            // レイヤの作成・下位レイヤ・splitが必要なキーは1件ずつのputに任せる
+            break;
+        }
+    }
+    node->unlock();
+    return i;
+}
+
+bool update_in_place(Node *root, Key &key, Value *value, Value *&old_value, OperationStats *stats) {
+    assert(root != nullptr);
+    size_t cursor = key.cursor;     // 失敗した場合にkeyを元のレイヤに戻すため
+RETRY:
+    std::pair<BorderNode*, Version> node_version = findBorder(root, key, stats);
+    BorderNode *node = node_version.first;
+    Version version  = node_version.second;
+FORWARD:
+    if (version.deleted) {
+        if (version.is_root) {
+            key.cursor = cursor;    // レイヤが消えている場合はlockを取る方で上位レイヤからやり直す
+            return false;
+        }
+        goto RETRY;
+    }
+    std::tuple<SearchResult, LinkOrValue, size_t> result_lv_index = node->searchLinkOrValueWithIndex(key);
+    SearchResult result = std::get<0>(result_lv_index);
+    LinkOrValue lv      = std::get<1>(result_lv_index);
+    size_t index        = std::get<2>(result_lv_index);
+    if ((node->getVersion() ^ version) > Version::has_locked) {
+        // getと同じく、読んでいる間にinsert/splitが起きた場合は読み直す
+        version = node->stableVersion();
+        BorderNode *next = node->getNext();
+        while (!version.deleted && next != nullptr && key.getCurrentSlice().slice >= next->lowestKey()) {
+            node    = next;
+            version = node->stableVersion();
+            next    = node->getNext();
+        }
+        goto FORWARD;
+    } else if (result == LAYER) {
+        root = lv.next_layer;
+        key.next();
+        goto RETRY;
+    } else if (result == VALUE) {
+        if (lv.value == value) {
+            // 同じValueのputなので何もしなくていい
+            old_value = nullptr;
+            return true;
+        }
+        // versionで確認した時点のValueのままならCASで置き換える
+        // スロットのValueを移動・破棄するwriterはtakeLVで取り出すので、その後のCASは必ず失敗する
+        if (node->compareExchangeLV(index, lv, LinkOrValue(value))) {
+            old_value = lv.value;
+            countStats(stats, StatsCounter::PutInPlace);
+            return true;
+        }
+    }
+    // NOTFOUND(insertが必要) or UNSTABLE or CASの失敗はlockを取る方に任せる
+    key.cursor = cursor;
+    return false;
+}
+
+std::pair<PutResult, Node*> masstree_put(Node *root, Key &key, Value *value, GarbageCollector &gc, OperationStats *stats) {
+    Value *old_value = nullptr;
+    std::pair<PutResult, Node*> pair = masstree_put(root, key, value, old_value, gc, stats);
+    if (old_value != nullptr) gc.add(old_value);
+    return pair;
+}
+
+std::pair<PutResult, Node*> masstree_put(Node *root, Key &key, Value *value, Value *&old_value, GarbageCollector &gc, OperationStats *stats) {
+    assert(value != nullptr);
+    old_value = nullptr;
     // Layer0がemptyの場合
     if (root == nullptr) return std::make_pair(DONE, start_new_tree(key, value));
+    // 既存キーのupdateはlockを取らずに済ませる
+    if (update_in_place(root, key, value, old_value, stats)) return std::make_pair(DONE, root);
+    // putは既存のValueに関係なくvalueで上書きするupsert
+    return masstree_upsert(root, key, [value](Value *) { return value; }, old_value, gc, stats);
+}
+
+std::pair<PutResult, Node*> masstree_upsert(Node *root, Key &key, const UpsertFunction &fn, Value *&old_value, GarbageCollector &gc, OperationStats *stats) {
+    assert(root != nullptr);
+    old_value = nullptr;
 RETRY:
     // BorderNodeを探してロックする
-    std::pair<BorderNode *, Version> node_version = findBorder(root, key);
+    std::pair<BorderNode *, Version> node_version = findBorder(root, key, stats);
     BorderNode *node = node_version.first;
     Version version  = node_version.second;
-    node->lock();   // お目当てのnodeを見つけたら即ロック
-    // lockした上で最新のversionを取得する、findBorder→lockの間で更新されている可能性があるから
-    version = node->getVersion();
+    node->lock(stats);  // お目当てのnodeを見つけたら即ロック
 FORWARD:
     assert(node->isLocked());
     Permutation permutation = node->getPermutation();
-    if (version.deleted) {
+    // lockした上で最新のversionを取得する、findBorder→lockの間で更新されている可能性があるから
+    // NOTE: versionを上書きするとfindBorder→lockの間に起きたsplitを検知できなくなるので別で持っておく
+    Version locked_version = node->getVersion();
+    if (locked_version.deleted) {
         node->unlock();
-        if (version.is_root) {
+        if (locked_version.is_root) {
             // Layer0がempty or keyが下位ノードに移動した場合
             // Root nodeが消去されている場合その親ノードが新しいRoot nodeを指している可能性があるから
             // NOTE: is_rootなら上位レイヤからやり直した方がいいのは効率がいいからっていうのは分かる、ただis_rootだけなんで上位レイヤからやり直すの？って言われたらわからん；；
             return std::make_pair(RetryFromUpperLayer, nullptr);
         } else {
+            countStats(stats, StatsCounter::PutRetry);
             goto RETRY;
         }
     }
@@ -500,10 +699,12 @@ FORWARD:
     SearchResult result = std::get<0>(result_lv_index);
     LinkOrValue lv      = std::get<1>(result_lv_index);
     size_t index        = std::get<2>(result_lv_index);
-    if (Version::splitHappened(version, node->getVersion())) {
+    if (Version::splitHappened(version, locked_version)) {
         // findBorder -> lockの間に他スレッドによってsplit処理が起きた場合
-        BorderNode *next = node->getNext();
+        countStats(stats, StatsCounter::PutForward);
         node->unlock();
+        version = node->stableVersion();    // 移動しなかった場合に同じsplitを再検知しないように更新しておく
+        BorderNode *next = node->getNext();
         assert(next != nullptr);    // splitが発生した後だからNextは必ず存在するはず
 
         // BorderNodeが正しい順番で並んでいるんだったらkey.getCurrentSlice().slice < next->lowestKey()になる、それはそう
@@ -515,40 +716,55 @@ FORWARD:
             version = node->stableVersion();
             next    = node->getNext();
         }
-        node->lock();
+        node->lock(stats);
         goto FORWARD;
     } else if (result == NOTFOUND) {    // Keyに対応するValueがないのでinsertする
         ssize_t check = check_break_invariant(node, key);
         if (check != -1) {  // BorderNodeにinsertすると違反(競合)が発生する場合
             size_t old_index = check;   // check != -1なのでsize_tとして扱っても問題ない
-            handle_break_invariant(node, key, old_index, gc);
+            handle_break_invariant(node, key, old_index, gc, stats);
             Node *next_layer = node->getLV(old_index).next_layer;
             node->unlock();
             key.next();
-            std::pair<PutResult, Node *> pair = masstree_put(next_layer, key, value, gc);
+            std::pair<PutResult, Node *> pair = masstree_upsert(next_layer, key, fn, old_value, gc, stats);
             if (pair.first == RetryFromUpperLayer) {
+                countStats(stats, StatsCounter::PutRetryFromUpperLayer);
                 key.back();
                 goto RETRY;
             }
         } else {    // BorderNodeにinsertすると違反が発生しない場合
-            if (permutation.isNotFull()) {
+            // ここから先はやり直しが発生しないので、lockを持ったままfnを呼ぶ
+            Value *value = fn(nullptr);
+            if (value == nullptr) {
+                // fnがinsertしないことを選んだ場合
+                node->unlock();
+            } else if (permutation.isNotFull()) {
                 insert_to_border(node, key, value, gc);
                 node->unlock();
             } else {    // permutationが一杯の状態
-                Node *may_new_root = split(node, key, value);
+                Node *may_new_root = split(node, key, value, stats);
                 if (may_new_root != nullptr) return std::make_pair(DONE, may_new_root);
             }
         }
     } else if (result == VALUE) {       // Keyに対応するValueがあるのでupdateする
-        // updateを行う
-        gc.add(node->getLV(index).value);
-        node->setLV(index, LinkOrValue(value));
+        // fnを呼んでいる間にlock-freeなupdateが割り込まないようにスロットから取り出しておく(その間readerはUNSTABLEでretryする)
+        Value *current = node->takeLV(index).value;
+        assert(current != nullptr);
+        Value *value = fn(current);
+        // fnがnullptrか同じValueを返した場合は元に戻すだけ
+        if (value != nullptr && value != current) {
+            old_value = current;    // 置き換えたValueの扱いは呼び出し側が決める
+            node->setLV(index, LinkOrValue(value));
+        } else {
+            node->setLV(index, LinkOrValue(current));
+        }
         node->unlock();
     } else if (result == LAYER) {
         node->unlock();
         key.next();
-        std::pair<PutResult, Node*> pair = masstree_put(lv.next_layer, key, value, gc);
+        std::pair<PutResult, Node*> pair = masstree_upsert(lv.next_layer, key, fn, old_value, gc, stats);
         if (pair.first == RetryFromUpperLayer) {
+            countStats(stats, StatsCounter::PutRetryFromUpperLayer);
             key.back();
             goto RETRY;
         }
@@ -557,4 +773,111 @@ FORWARD:
         assert(false);
     }
     return std::make_pair(DONE, root);
-}
\ No newline at end of file
+}
+Node *combine_puts(BorderNode *node, GarbageCollector &gc, OperationStats *stats) {
+    assert(node->isLocked());
+    // 後から積まれたものが先頭なので、積まれた順に並べ直す
+    CombiningRequest *head = nullptr;
+    for (CombiningRequest *request = node->takeCombining(); request != nullptr;) {
+        CombiningRequest *following = request->next;
+        request->next = head;
+        head = request;
+        request = following;
+    }
+
+    // 依頼した側がfindBorderした後にnodeがsplitされていなければ、キーはまだnodeの担当範囲にある
+    // NOTE: nextの最小のキーはremoveで大きくなるので、担当範囲の上限には使えない
+    Version locked_version = node->getVersion();
+
+    CombiningRequest *split_request = nullptr;  // 空きが無くてsplitが必要なリクエスト(最初の1件だけ)
+    for (CombiningRequest *request = head; request != nullptr;) {
+        // stateを書いた後は依頼した側がrequestを破棄するので、先にnextを読んでおく
+        CombiningRequest *following = request->next;
+        Key &key = *request->key;
+        CombiningState state = CombiningState::Retry;
+        if (!locked_version.deleted && !Version::splitHappened(request->version, locked_version)) {
+            std::tuple<SearchResult, LinkOrValue, size_t> result_lv_index = node->searchLinkOrValueWithIndex(key);
+            SearchResult result = std::get<0>(result_lv_index);
+            size_t index        = std::get<2>(result_lv_index);
+            if (result == VALUE) {
+                // lock-freeなupdateと競合しないように取り出してから置き換える
+                Value *current = node->takeLV(index).value;
+                node->setLV(index, LinkOrValue(request->value));
+                request->old_value = (current != request->value) ? current : nullptr;
+                state = CombiningState::Done;
+            } else if (result == NOTFOUND && check_break_invariant(node, key) == -1) {
+                if (node->getPermutation().isNotFull()) {
+                    if (!node->getInserting()) {    // スロットの再利用はunlockでv_insertを更新するまで1回だけ
+                        insert_to_border(node, key, request->value, gc);
+                        state = CombiningState::Done;
+                    }
+                } else if (split_request == nullptr) {
+                    split_request = request;        // 他のリクエストを全て処理してから最後にsplitして入れる
+                    request = following;
+                    continue;
+                }
+            }
+        }
+        request->state.store(state, std::memory_order_release);
+        request = following;
+    }
+
+    if (split_request == nullptr) {
+        node->unlock();
+        return nullptr;
+    }
+    if (node->getInserting()) {
+        // スロットを再利用したinsertと同じlockの中でsplitはできない(unlockでv_insertとv_splitの両方は更新できない)
+        node->unlock();
+        split_request->state.store(CombiningState::Retry, std::memory_order_release);
+        return nullptr;
+    }
+    // splitはnodeとsplitで作ったノードのlockを全て外してから返る
+    Node *may_new_root = split(node, *split_request->key, split_request->value, stats);
+    split_request->old_value = nullptr;
+    split_request->state.store(CombiningState::Done, std::memory_order_release);
+    return may_new_root;
+}
+
+std::pair<PutResult, Node*> masstree_put_combining(Node *root, Key &key, Value *value, Value *&old_value, GarbageCollector &gc, OperationStats *stats) {
+    assert(value != nullptr);
+    old_value = nullptr;
+    if (root == nullptr) return std::make_pair(DONE, start_new_tree(key, value));
+    if (update_in_place(root, key, value, old_value, stats)) return std::make_pair(DONE, root);
+
+    // 先にリクエストを積んでからlockを取りに行くので、lockを取れた時点で自分のリクエストは処理済みか、まだ積まれているかのどちらか
+    std::pair<BorderNode *, Version> node_version = findBorder(root, key, stats);
+    BorderNode *node = node_version.first;
+    CombiningRequest request{};
+    request.key     = &key;
+    request.value   = value;
+    request.version = node_version.second;
+    node->publishCombining(&request);
+    Node *new_root = nullptr;
+    bool combined_by_self = false;
+    CombiningState state;
+    size_t spins = 0;
+    while ((state = request.state.load(std::memory_order_acquire)) == CombiningState::Pending) {
+        // lockが空くまでは読むだけで待つ(CASでcache lineを奪い合わないように)
+        // しばらく空かなければ(lockの持ち主がsplitしている、コアよりスレッドが多いなど)、持ち主が進めるようにCPUを譲る
+        if (node->isLocked() || !node->tryLock()) {
+            if (++spins >= COMBINING_SPINS) std::this_thread::yield();
+            continue;
+        }
+        Node *may_new_root = combine_puts(node, gc, stats);
+        if (may_new_root != nullptr) new_root = may_new_root;
+        combined_by_self = true;
+    }
+
+    if (state == CombiningState::Retry) {
+        // 範囲外やレイヤの作成が必要なキーは通常のputでやり直す
+        // 自分がsplitして新しいrootを作っていた場合はそこから始める(新しいrootはInteriorNodeなのでRetryFromUpperLayerにはならない)
+        countStats(stats, StatsCounter::PutCombineRetry);
+        Node *start = (new_root != nullptr) ? new_root : root;
+        std::pair<PutResult, Node*> pair = masstree_upsert(start, key, [value](Value *) { return value; }, old_value, gc, stats);
+        return pair;
+    }
+    if (!combined_by_self) countStats(stats, StatsCounter::PutCombined);
+    old_value = request.old_value;
+    return std::make_pair(DONE, (new_root != nullptr) ? new_root : root);
+}
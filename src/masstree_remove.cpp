@@ -5,9 +5,10 @@
  *        §4.6.3と同じように、下のレイヤを消してから、hand-over-handの要領で上のレイヤの消去処理に移動する。
  * @param borderNode 削除されるBorderNodeへのポインタ。
  * @param gc ガベージコレクタへの参照。
+ * @param stats 操作カウンタ(nullptrなら数えない)。
  * @note 指定したBorderNodeが特定のプロパティ(ルートノードであること、単一キーのみを保有していること)を持っていることを前提としている。
  */
-void handle_delete_layer_in_remove(BorderNode *borderNode, GarbageCollector &gc) {
+void handle_delete_layer_in_remove(BorderNode *borderNode, GarbageCollector &gc, OperationStats *stats) {
     Permutation permutation = borderNode->getPermutation();
     assert(borderNode->getParent() == nullptr);
     assert(permutation.getNumKeys() == 1);
@@ -27,7 +28,7 @@ void handle_delete_layer_in_remove(BorderNode *borderNode, GarbageCollector &gc)
         upper_suffix = new BigSuffix({borderNode->getKeySlice(permutation(0))}, borderNode->getKeyLen(permutation(0)));
     }
     // hand-over-handの要領で、下から上に処理を行う
-    BorderNode *upper = borderNode->lockedUpperNode();
+    BorderNode *upper = borderNode->lockedUpperNode(stats);
     // [1] upperをkey_len_unstableにする
     // [2] upper_suffixとして回収したsuffixをupperのsuffixにセットする
     // [3] upperのLinkOrValueを書き換える
@@ -37,14 +38,14 @@ void handle_delete_layer_in_remove(BorderNode *borderNode, GarbageCollector &gc)
     upper->setKeyLen(nextLayerIndex, BorderNode::key_len_unstable);     // [1]
     assert(upper->getKeySuffixes().get(nextLayerIndex) == nullptr);
     upper->getKeySuffixes().set(nextLayerIndex, upper_suffix);          // [2]
-    upper->setLV(nextLayerIndex, borderNode->getLV(permutation(0)));    // [3]
+    upper->setLV(nextLayerIndex, borderNode->takeLV(permutation(0)));   // [3] takeLVで取り出すのでborderNode側のLinkOrValueは空になる
     upper->setKeyLen(nextLayerIndex, BorderNode::key_len_has_suffix);   // [4]
     // [5]
-    borderNode->setLV(permutation(0), LinkOrValue{});   // NOTE: これ実体なのが気に食わないな
     borderNode->getKeySuffixes().set(permutation(0), nullptr);
     // GarbageCollectorに渡す
     borderNode->setDeleted(true);
     gc.add(borderNode);
+    countStats(stats, StatsCounter::LayerDelete);
     // 処理が終わったので下からunlockする
     borderNode->unlock();
     upper->unlock();
@@ -156,31 +157,35 @@ std::pair<RootChange, Node*> delete_borderNode_in_remove(BorderNode *borderNode,
  * @param root Masstreeのルートノード
  * @param key 削除するキー。
  * @param gc ガベージコレクタへの参照。
+ * @param stats 操作カウンタ(nullptrなら数えない)。
+ * @param taken nullptrでなければ、消したValueをgcに渡さずにここに返す(キーが無ければ書き込まない)。
  * @return ツリーのルートが変更された場合は新しいルートを、変更されなかった場合はnullptrを返す。
  *         RootChange列挙型で判断する。
  */
-std::pair<RootChange, Node*> remove(Node *root, Key &key, GarbageCollector &gc) {
+std::pair<RootChange, Node*> remove(Node *root, Key &key, GarbageCollector &gc, OperationStats *stats, Value **taken) {
     if (root == nullptr) {
         // 無いもんは消せねえ(´・ω・`)
         assert(key.cursor == 0);
         return std::make_pair(NotChange, nullptr);
     }
 RETRY:
-    std::pair<BorderNode*, Version> borderNode_version = findBorder(root, key);
+    std::pair<BorderNode*, Version> borderNode_version = findBorder(root, key, stats);
     BorderNode *borderNode = borderNode_version.first;
     Version version = borderNode_version.second;
-    borderNode->lock();
-    version = borderNode->getVersion();
+    borderNode->lock(stats);
     // 該当するborderNodeを見つけたら速攻Lockを取得することで、同一キーに対するremoveとかの事故を防いでいる
 FORWARD:
     assert(borderNode->isLocked());
-    if (version.deleted) {
+    // NOTE: versionを上書きするとfindBorder→lockの間に起きたsplitを検知できなくなるので別で持っておく
+    Version locked_version = borderNode->getVersion();
+    if (locked_version.deleted) {
         borderNode->unlock();
-        if (version.is_root) {
+        if (locked_version.is_root) {
             // 並列で走っていた同じキーに対するremove処理が代わりに消してくれた(RETRYに戻ったところで、borderNodeがRootなら処理は同じな)ので、終わり
             return std::make_pair(NotChange, root);
         } else {
             // Rootじゃないなら再走する必要がある
+            countStats(stats, StatsCounter::RemoveRetry);
             goto RETRY;
         }
     }
@@ -188,17 +193,19 @@ FORWARD:
     SearchResult result = std::get<0>(result_lv_index);
     LinkOrValue lv      = std::get<1>(result_lv_index);
     size_t index        = std::get<2>(result_lv_index);
-    if (Version::splitHappened(version, borderNode->getVersion())) {
+    if (Version::splitHappened(version, locked_version)) {
         // findBorderとlockの間でsplit処理が起きた場合
-        BorderNode *next = borderNode->getNext();
+        countStats(stats, StatsCounter::RemoveForward);
         borderNode->unlock();
+        version = borderNode->stableVersion();
+        BorderNode *next = borderNode->getNext();
         assert(next != nullptr);    // splitが発生したのならnextが必ずあるはず
         while (!version.deleted && next != nullptr && key.getCurrentSlice().slice >= next->lowestKey()) {
             borderNode  = next;
             version     = borderNode->stableVersion();
             next        = borderNode->getNext();
         }
-        borderNode->lock();
+        borderNode->lock(stats);
         goto FORWARD;
     } else if (result == NOTFOUND) {
         // 無いもんは消せねえ(´・ω・`)
@@ -229,13 +236,20 @@ FORWARD:
         // [1]
         if (borderNode->getIsRoot() && permutation.getNumKeys() == 1 && key.cursor != 0) {
             // Layer0の時以外で、BorderNodeがRootで要素が1つだけの場合は、要素数は変化しない
-            handle_delete_layer_in_remove(borderNode, gc);
+            handle_delete_layer_in_remove(borderNode, gc, stats);
             return std::make_pair(LayerDeleted, nullptr);
         }
         // [2]
         borderNode->markKeyRemoved(index);
         permutation.removeIndex(index);
         borderNode->setPermutation(permutation);
+        // lock-freeなupdateが消したキーに書き込まないようにスロットを空にして、取り出したValueはgcに渡す(takenがあればそちらに返す)
+        Value *removed_value = borderNode->takeLV(index).value;
+        if (taken != nullptr) {
+            *taken = removed_value;
+        } else if (removed_value != nullptr) {
+            gc.add(removed_value);
+        }
         // [3]
         uint8_t currentNumKeys = permutation.getNumKeys();
         if (currentNumKeys == 0) {
@@ -250,7 +264,7 @@ FORWARD:
     } else if (result == LAYER) {
         borderNode->unlock();
         key.next();
-        std::pair<RootChange, Node*> pair = remove(lv.next_layer, key, gc);
+        std::pair<RootChange, Node*> pair = remove(lv.next_layer, key, gc, stats, taken);
         if (pair.first == LayerDeleted) {   // すでに消えているのであればカーソルを一個戻してRETRY
             key.back();
             goto RETRY;
@@ -262,6 +276,6 @@ FORWARD:
     return std::make_pair(NotChange, root);
 }
 
-Node *remove_at_layer0(Node *root, Key &key, GarbageCollector &gc) {
-    return remove(root, key, gc).second;
+Node *remove_at_layer0(Node *root, Key &key, GarbageCollector &gc, OperationStats *stats) {
+    return remove(root, key, gc, stats).second;
 }
\ No newline at end of file
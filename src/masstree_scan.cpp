@@ -1,83 +1,257 @@
-#include "include/masstree_scan.h"
-
-void masstree_scan(Node* root,
-                   Status &scan_status,
-                   Key &current_key,
-                   Key &left_key,
-                   bool l_exclusive,
-                   Key &right_key,
-                   bool r_exclusive,
-                   std::vector<std::pair<Key, Value*>> &result) {
-
-    // RootがnullptrまたはステータスがOKでない場合は処理を中断
-    if (root == nullptr || scan_status != Status::OK) {
-        scan_status = Status::ERROR_CONCURRENT_WRITE_OR_DELETE;
-        return;
-    }
-
-    // Rootからleft_keyに関連するBorderNodeを探す
-    std::pair<BorderNode*, Version> node_version = findBorder(root, left_key);
-    BorderNode *border = node_version.first;
-    Version version = node_version.second;
-
-    // BorderNode内を走査し、指定された範囲の値を探索する
-    while (border != nullptr) {
-        Permutation perm = border->getPermutation();
-        for (size_t i = 0; i < perm.getNumKeys(); i++) {
-            uint8_t trueIndex = perm(i);
-
-            // 削除されたキーは無視する
-            if (border->isKeyRemoved(trueIndex)) continue;
-
-            // レイヤが変わるタイミングで不必要なデータが残っている可能性があるので、cursor以降のスライスを削除する
-            current_key.slices.resize(current_key.cursor + 1);
-
-            // 新しいスライスとキーの長さを取得
-            uint64_t new_slice = border->getKeySlice(trueIndex);
-            uint8_t key_len = border->getKeyLen(trueIndex);
-
-            // current_keyのカーソル位置に新しいスライスを設定し、lastSliceSizeを更新
-            current_key.slices[current_key.cursor] = new_slice;
-            if (key_len == BorderNode::key_len_has_suffix || key_len == BorderNode::key_len_layer) {
-                current_key.lastSliceSize = 8;
-            } else if (key_len < BorderNode::key_len_has_suffix) {
-                current_key.lastSliceSize = key_len;
-            }
-
-            // Suffixの処理
-            if (key_len == BorderNode::key_len_has_suffix) {
-                BigSuffix* suffix = border->getKeySuffixes().get(trueIndex);
-                if (suffix != nullptr) {
-                    size_t suffixIndex = 0;
-                    while (suffix->hasNext()) {
-                        current_key.slices.push_back(suffix->getCurrentSlice().slice);
-                        suffix->next();
-                        suffixIndex++;
-                    }
-                    // 最後のスライスを追加
-                    current_key.slices.push_back(suffix->getCurrentSlice().slice);
-                    current_key.lastSliceSize = suffix->getCurrentSlice().size;
-                }
-            }
-
-            // 範囲外のキーは無視する
-            if (current_key < left_key || (l_exclusive && current_key == left_key)) continue;
-            if (right_key < current_key || (r_exclusive && current_key == right_key)) return;
-
-            LinkOrValue lv = border->getLV(trueIndex);
-
-            if (lv.value) {
-                // Valueを見つけた場合はresultに追加
-                result.emplace_back(current_key, lv.value);
-            } else if (lv.next_layer) {
-                // Linkを見つけた場合は再帰的に探索
-                current_key.next(); // レイヤを降下するためカーソルを進める
-                masstree_scan(lv.next_layer, scan_status, current_key, left_key, l_exclusive, right_key, r_exclusive, result);
-                current_key.back(); // DFSから戻ってきたのでカーソルを戻す
-            }
-        }
-
-        // 次のBorderNodeへ移動
-        border = border->getNext();
-    }
-}
\ No newline at end of file
+#include "include/masstree_scan.h"
+
+#include <atomic>
+#include <limits>
+#include <thread>
+
+// NOTE: レイヤの作成はversionを変えずにkey_lenとlvを書き換えるので、lvを読んだ後にkey_lenが変わっていないかも確認する
+Version read_entries(BorderNode *node, std::vector<ScanEntry> &entries, BorderNode *&next) {
+RETRY:
+    entries.clear();
+    Version version = node->stableVersion();
+    if (version.deleted) return version;
+    Permutation permutation = node->getPermutation();
+    for (size_t i = 0; i < permutation.getNumKeys(); i++) {
+        uint8_t trueIndex = permutation(i);
+        uint8_t key_len = node->getKeyLen(trueIndex);
+        LinkOrValue lv = node->getLV(trueIndex);
+        BigSuffix *suffix = node->getKeySuffixes().get(trueIndex);
+        if (key_len == BorderNode::key_len_unstable || key_len != node->getKeyLen(trueIndex) || lv.value == nullptr) goto RETRY;
+        if (key_len == BorderNode::key_len_has_suffix && suffix == nullptr) goto RETRY;
+        entries.push_back({node->getKeySlice(trueIndex), key_len, lv, suffix});
+    }
+    next = node->getNext();
+    if ((node->getVersion() ^ version) > Version::has_locked) goto RETRY;
+    std::sort(entries.begin(), entries.end(), [](const ScanEntry &a, const ScanEntry &b) {
+        return a.slice != b.slice ? a.slice < b.slice : a.key_len < b.key_len;
+    });
+    return version;
+}
+
+BorderNode *find_entries(Node *root, uint64_t slice, std::vector<ScanEntry> &entries, BorderNode *&next, OperationStats *stats) {
+    Key probe({slice}, 8);
+RETRY:
+    BorderNode *node = findBorder(root, probe, stats).first;
+FORWARD:
+    Version version = read_entries(node, entries, next);
+    if (version.deleted) {
+        if (version.is_root) return nullptr;
+        goto RETRY;
+    }
+    // findBorderの後にsplitされてsliceが右のノードに移っていた場合
+    if (next != nullptr && slice >= next->lowestKey()) {
+        node = next;
+        goto FORWARD;
+    }
+    return node;
+}
+
+// 1つのレイヤの中でsliceが[lo, hi]のキーを昇順に訪問する、visitorがfalseを返したらfalseを返す
+// min_len未満の長さでこのレイヤに終わるキーは訪問しない(prefixの最後のスライスより短いキーを除くため)
+static bool scan_layer(Node *root, uint64_t lo, uint64_t hi, uint8_t min_len, Key &current, const ScanVisitor &visitor, OperationStats *stats) {
+    std::vector<ScanEntry> entries;
+    BorderNode *next = nullptr;
+    size_t depth = current.slices.size();
+    std::optional<uint64_t> visited{};     // 訪問済みの最大のslice(ノードを読み直した場合に同じキーを二度訪問しないため)
+    BorderNode *node = find_entries(root, lo, entries, next, stats);
+    while (node != nullptr) {
+        for (const ScanEntry &entry : entries) {
+            if (entry.slice < lo || (visited.has_value() && entry.slice < visited.value())) continue;
+            if (entry.slice > hi) return true;
+            visited = entry.slice;
+            current.slices.resize(depth);
+            current.slices.push_back(entry.slice);
+            if (entry.key_len == BorderNode::key_len_layer) {
+                if (!scan_layer(entry.lv.next_layer, 0, std::numeric_limits<uint64_t>::max(), 1, current, visitor, stats)) return false;
+                continue;
+            }
+            if (entry.key_len == BorderNode::key_len_has_suffix) {
+                entry.suffix->appendTo(current);
+            } else {
+                if (entry.key_len < min_len) continue;
+                current.lastSliceSize = entry.key_len;
+            }
+            if (!visitor(current, entry.lv.value)) return false;
+        }
+        // 同じsliceのキーは全て同じBorderNodeにあるので、次のノードは訪問済みのsliceより後から見ればいい
+        if (visited.has_value()) {
+            if (visited.value() == std::numeric_limits<uint64_t>::max()) return true;
+            visited = visited.value() + 1;
+        }
+        if (next == nullptr) return true;
+        node = next;
+        if (read_entries(node, entries, next).deleted) {
+            // 辿っている途中でノードが消えた場合は、続きのsliceから探し直す
+            node = find_entries(root, visited.value_or(lo), entries, next, stats);
+        }
+    }
+    return true;
+}
+
+// NOTE: BorderNodeを直接読むと、lock-freeなupdateやsplitが値を移している途中の空のスロットを「キーが無い」と取り違えるので、
+// scan_prefixと同じscan_layer(read_entriesで安定したエントリだけを読む)で辿る
+void masstree_scan(Node* root,
+                   Status &scan_status,
+                   Key &current_key,
+                   Key &left_key,
+                   bool l_exclusive,
+                   Key &right_key,
+                   bool r_exclusive,
+                   std::vector<std::pair<Key, Value*>> &result,
+                   OperationStats *stats) {
+
+    // RootがnullptrまたはステータスがOKでない場合は処理を中断
+    if (root == nullptr || scan_status != Status::OK) {
+        scan_status = Status::ERROR_CONCURRENT_WRITE_OR_DELETE;
+        return;
+    }
+
+    // current_keyは走査中のキーのバッファとして使う
+    current_key.slices.clear();
+    current_key.cursor = 0;
+    scan_layer(root, left_key.slices[0], right_key.slices[0], 1, current_key, [&](const Key &key, Value *value) {
+        // 範囲外のキーは無視する
+        int lower = compare_keys(key, left_key);
+        if (lower < 0 || (l_exclusive && lower == 0)) return true;
+        int upper = compare_keys(key, right_key);
+        if (upper > 0 || (r_exclusive && upper == 0)) return false;
+        result.emplace_back(key, value);
+        return true;
+    }, stats);
+}
+
+// keyがprefixで始まるかを確認する
+static bool has_prefix(const Key &key, const Key &prefix) {
+    if (key.remainLength(0) < prefix.remainLength(0)) return false;
+    size_t last = prefix.slices.size() - 1;
+    for (size_t i = 0; i < last; i++) {
+        if (key.slices[i] != prefix.slices[i]) return false;
+    }
+    uint64_t mask = (prefix.lastSliceSize == 8) ? ~0ULL : ~(~0ULL >> (prefix.lastSliceSize * 8));
+    return (key.slices[last] & mask) == (prefix.slices[last] & mask);
+}
+
+bool masstree_scan_prefix(Node *root, const Key &prefix, const ScanVisitor &visitor, OperationStats *stats) {
+    Key current({0}, 8);
+    current.slices.clear();
+    std::vector<ScanEntry> entries;
+    BorderNode *next = nullptr;
+
+    // prefixの最後のスライスの手前までは、そのスライスのレイヤへのリンクを辿って直接降りる
+    size_t last = prefix.slices.size() - 1;
+    for (size_t depth = 0; depth < last; depth++) {
+        if (root == nullptr) return true;
+        uint64_t slice = prefix.slices[depth];
+        if (find_entries(root, slice, entries, next, stats) == nullptr) return true;
+        root = nullptr;
+        for (const ScanEntry &entry : entries) {
+            if (entry.slice != slice) continue;
+            if (entry.key_len == BorderNode::key_len_layer) {
+                root = entry.lv.next_layer;
+                break;
+            }
+            if (entry.key_len == BorderNode::key_len_has_suffix) {
+                // このsliceで始まるキーが1つしかなくsuffixに入っている場合
+                current.slices.assign(prefix.slices.begin(), prefix.slices.begin() + depth + 1);
+                entry.suffix->appendTo(current);
+                return !has_prefix(current, prefix) || visitor(current, entry.lv.value);
+            }
+        }
+        current.slices.push_back(slice);
+    }
+    if (root == nullptr) return true;
+
+    // 最後のスライスは上位lastSliceSize byteが一致するsliceの範囲になる
+    uint64_t mask = (prefix.lastSliceSize == 8) ? 0 : (~0ULL >> (prefix.lastSliceSize * 8));
+    uint64_t lo = prefix.slices[last] & ~mask;
+    return scan_layer(root, lo, lo | mask, prefix.lastSliceSize, current, visitor, stats);
+}
+
+// NOTE: Key::operator<は長さの違うキーの順序がバイト列の順序と一致しないので使わない
+int compare_keys(const Key &a, const Key &b) {
+    size_t n = std::min(a.slices.size(), b.slices.size());
+    for (size_t i = 0; i < n; i++) {
+        if (a.slices[i] != b.slices[i]) return a.slices[i] < b.slices[i] ? -1 : 1;
+    }
+    // 共通部分が同じなら(足りない部分は0埋めなので)短い方が小さい
+    size_t a_len = a.remainLength(0);
+    size_t b_len = b.remainLength(0);
+    return (a_len < b_len) ? -1 : (a_len > b_len ? 1 : 0);
+}
+
+Version read_interior(InteriorNode *node, std::vector<uint64_t> &slices, std::vector<Node *> &children) {
+RETRY:
+    slices.clear();
+    children.clear();
+    Version version = node->stableVersion();
+    size_t num_keys = node->getNumKeys();
+    for (size_t i = 0; i < num_keys; i++) slices.push_back(node->getKeySlice(i));
+    for (size_t i = 0; i <= num_keys; i++) children.push_back(node->getChild(i));
+    if ((node->getVersion() ^ version) > Version::has_locked) goto RETRY;
+    return version;
+}
+
+std::vector<uint64_t> scan_partitions(Node *root, uint64_t lo, uint64_t hi, size_t parts) {
+    // 上から1段ずつInteriorNodeを展開して、[lo, hi]に入るseparatorがparts個以上になるまで集める
+    // 同じ深さのノードはだいたい同じ数のキーを持つので、その境界で分ければ各区間の大きさが揃う
+    std::vector<uint64_t> separators;
+    std::vector<Node *> level{root};
+    std::vector<uint64_t> slices;
+    std::vector<Node *> children;
+    while (separators.size() + 1 < parts && !level.empty()) {
+        std::vector<Node *> next_level;
+        for (Node *node : level) {
+            if (node->getIsBorder()) continue;
+            if (read_interior(reinterpret_cast<InteriorNode *>(node), slices, children).deleted) continue;
+            for (size_t i = 0; i < children.size(); i++) {
+                // child(i)が担当するのは[slices[i - 1], slices[i])
+                bool below_hi = (i == 0) || slices[i - 1] <= hi;
+                bool above_lo = (i == slices.size()) || lo < slices[i];
+                if (below_hi && above_lo) next_level.push_back(children[i]);
+                if (i < slices.size() && lo < slices[i] && slices[i] <= hi) separators.push_back(slices[i]);
+            }
+        }
+        level = std::move(next_level);
+    }
+    std::sort(separators.begin(), separators.end());
+    separators.erase(std::unique(separators.begin(), separators.end()), separators.end());
+
+    // 集めたseparatorから等間隔にparts - 1個選ぶ
+    std::vector<uint64_t> starts{lo};
+    for (size_t k = 1; k < parts && !separators.empty(); k++) {
+        uint64_t separator = separators[k * separators.size() / parts];
+        if (separator > starts.back()) starts.push_back(separator);
+    }
+    return starts;
+}
+
+bool masstree_parallel_scan(Node *root, const Key &lo, const Key &hi, size_t nthreads, const ScanVisitor &visitor) {
+    assert(nthreads >= 1);
+    if (root == nullptr || compare_keys(lo, hi) >= 0) return true;
+    std::vector<uint64_t> starts = scan_partitions(root, lo.slices[0], hi.slices[0], nthreads);
+    std::atomic<bool> stopped{false};   // どれかのworkerでvisitorがfalseを返したら全workerを止める
+
+    auto worker = [&](size_t part) {
+        uint64_t from = starts[part];
+        uint64_t to = (part + 1 < starts.size()) ? starts[part + 1] - 1 : hi.slices[0];
+        Key current({0}, 8);
+        current.slices.clear();
+        // 区間の両端のsliceにはlo/hiの範囲外のキーも含まれるので、キー単位で弾く
+        scan_layer(root, from, to, 1, current, [&](const Key &key, Value *value) {
+            if (stopped.load(std::memory_order_relaxed)) return false;
+            if (compare_keys(key, lo) < 0) return true;
+            if (compare_keys(key, hi) >= 0) return false;
+            if (!visitor(key, value)) {
+                stopped.store(true, std::memory_order_relaxed);
+                return false;
+            }
+            return true;
+        }, nullptr);   // OperationStatsは持ち主のスレッドしか書けないのでworkerでは数えない
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t part = 1; part < starts.size(); part++) threads.emplace_back(worker, part);
+    worker(0);
+    for (auto &thread : threads) thread.join();
+    return !stopped.load();
+}
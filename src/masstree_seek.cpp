@@ -0,0 +1,113 @@
+#include "include/masstree_seek.h"
+
+#include <limits>
+
+// 1つのレイヤの中でtargetより大きい(inclusiveならtarget以上の)最小のキーを探してcurrentとvalueに入れる
+// currentにはこのレイヤまでのスライスが入っている、targetがnullptrならこのレイヤの最小のキー
+// targetはこのレイヤまでのスライスがcurrentと一致していて、このレイヤのスライスを持っている場合だけ渡される
+static bool seek_layer(Node *root, const Key *target, bool inclusive, Key &current, Value *&value, OperationStats *stats) {
+    std::vector<ScanEntry> entries;
+    BorderNode *next = nullptr;
+    size_t depth = current.slices.size();
+    uint64_t lo = (target != nullptr) ? target->slices[depth] : 0;
+    std::optional<uint64_t> visited{};     // 見終わった最大のslice(ノードを読み直した場合に同じsliceを二度見ないため)
+    BorderNode *node = find_entries(root, lo, entries, next, stats);
+    while (node != nullptr) {
+        for (const ScanEntry &entry : entries) {
+            if (entry.slice < lo || (visited.has_value() && entry.slice < visited.value())) continue;
+            visited = entry.slice;
+            current.slices.resize(depth);
+            current.slices.push_back(entry.slice);
+            // targetと同じsliceのキーだけはtargetと比較する必要がある
+            bool bounded = (target != nullptr && entry.slice == lo);
+            if (entry.key_len == BorderNode::key_len_layer) {
+                // targetがこのsliceで終わるなら、レイヤのキーは全てtargetより長く、targetより大きい
+                const Key *sub_target = (bounded && target->slices.size() > depth + 1) ? target : nullptr;
+                if (seek_layer(entry.lv.next_layer, sub_target, inclusive, current, value, stats)) return true;
+                continue;
+            }
+            if (entry.key_len == BorderNode::key_len_has_suffix) {
+                entry.suffix->appendTo(current);
+            } else {
+                current.lastSliceSize = entry.key_len;
+            }
+            if (bounded) {
+                int cmp = compare_keys(current, *target);
+                if (cmp < 0 || (cmp == 0 && !inclusive)) continue;
+            }
+            value = entry.lv.value;
+            return true;
+        }
+        // 同じsliceのキーは全て同じBorderNodeにあるので、次のノードは見終わったsliceより後から見ればいい
+        if (visited.has_value()) {
+            if (visited.value() == std::numeric_limits<uint64_t>::max()) return false;
+            visited = visited.value() + 1;
+        }
+        if (next == nullptr) return false;
+        node = next;
+        if (read_entries(node, entries, next).deleted) {
+            node = find_entries(root, visited.value_or(lo), entries, next, stats);
+        }
+    }
+    return false;
+}
+
+// 1つのレイヤの中で最大のキーを探してcurrentとvalueに入れる
+static bool seek_last_layer(Node *root, Key &current, Value *&value, OperationStats *stats) {
+    std::vector<ScanEntry> entries;
+    BorderNode *next = nullptr;
+    size_t depth = current.slices.size();
+    std::optional<uint64_t> visited{};     // 見終わった最小のslice
+    BorderNode *node = find_entries(root, std::numeric_limits<uint64_t>::max(), entries, next, stats);
+    while (node != nullptr) {
+        for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+            const ScanEntry &entry = *it;
+            if (visited.has_value() && entry.slice > visited.value()) continue;
+            visited = entry.slice;
+            current.slices.resize(depth);
+            current.slices.push_back(entry.slice);
+            if (entry.key_len == BorderNode::key_len_layer) {
+                if (seek_last_layer(entry.lv.next_layer, current, value, stats)) return true;
+                continue;
+            }
+            if (entry.key_len == BorderNode::key_len_has_suffix) {
+                entry.suffix->appendTo(current);
+            } else {
+                current.lastSliceSize = entry.key_len;
+            }
+            value = entry.lv.value;
+            return true;
+        }
+        if (visited.has_value()) {
+            if (visited.value() == 0) return false;
+            visited = visited.value() - 1;
+        }
+        BorderNode *prev = node->getPrev();
+        if (prev == nullptr) return false;
+        // prevを読んだ後にprevがsplitされたり消えたりしていたら、nextがnodeを指さなくなるので探し直す
+        if (read_entries(prev, entries, next).deleted || next != node) {
+            node = find_entries(root, visited.value_or(std::numeric_limits<uint64_t>::max()), entries, next, stats);
+        } else {
+            node = prev;
+        }
+    }
+    return false;
+}
+
+SeekResult masstree_seek(Node *root, const Key *target, bool inclusive, OperationStats *stats) {
+    if (root == nullptr) return std::nullopt;
+    Key current({0}, 8);
+    current.slices.clear();
+    Value *value = nullptr;
+    if (!seek_layer(root, target, inclusive, current, value, stats)) return std::nullopt;
+    return std::make_pair(std::move(current), value);
+}
+
+SeekResult masstree_seek_last(Node *root, OperationStats *stats) {
+    if (root == nullptr) return std::nullopt;
+    Key current({0}, 8);
+    current.slices.clear();
+    Value *value = nullptr;
+    if (!seek_last_layer(root, current, value, stats)) return std::nullopt;
+    return std::make_pair(std::move(current), value);
+}
@@ -0,0 +1,108 @@
+#include "include/masstree_tree_stats.h"
+
+// InteriorNodeから安定した状態の子ノード一覧を読み出す
+// NOTE: writerと並行して走るので、読んでいる間にversionが変わったら読み直す
+static size_t read_children(InteriorNode *node, std::array<Node *, Node::ORDER> &children, Version &version) {
+RETRY:
+    version = node->stableVersion();
+    size_t num_children = node->getNumKeys() + 1;
+    for (size_t i = 0; i < num_children; i++) children[i] = node->getChild(i);
+    if ((node->getVersion() ^ version) > Version::has_locked) goto RETRY;
+    return num_children;
+}
+
+// BorderNodeの中身(キーの数、各スロットのkey_lenとLinkOrValue)を安定した状態で読み出す
+struct BorderSnapshot {
+    Permutation permutation{};
+    std::array<uint8_t, Node::ORDER - 1> key_len{};
+    std::array<LinkOrValue, Node::ORDER - 1> lv{};
+    std::array<BigSuffix *, Node::ORDER - 1> suffix{};
+    bool suffix_table = false;
+};
+
+static Version read_border(BorderNode *node, BorderSnapshot &snapshot) {
+RETRY:
+    Version version = node->stableVersion();
+    snapshot.permutation = node->getPermutation();
+    snapshot.suffix_table = node->getKeySuffixes().isAllocated();
+    for (size_t i = 0; i < Node::ORDER - 1; i++) {
+        snapshot.key_len[i] = node->getKeyLen(i);
+        snapshot.lv[i] = node->getLV(i);
+        snapshot.suffix[i] = node->getKeySuffixes().get(i);
+    }
+    if ((node->getVersion() ^ version) > Version::has_locked) goto RETRY;
+    return version;
+}
+
+// 1つのレイヤの木を走査する、返り値はnode以下の高さ
+static size_t collect_node(Node *node, TreeStats &stats, size_t layer) {
+    if (node->getIsBorder()) {
+        BorderNode *border = reinterpret_cast<BorderNode *>(node);
+        BorderSnapshot snapshot;
+        Version version = read_border(border, snapshot);
+        if (version.deleted) return 0;
+
+        LayerStats &layer_stats = stats.layers[layer];
+        layer_stats.border_nodes++;
+        stats.border_bytes += sizeof(BorderNode);
+        if (snapshot.suffix_table) {
+            stats.suffix_tables++;
+            stats.suffix_table_bytes += KeySuffix::TABLE_BYTES;
+        }
+        stats.fill_histogram[snapshot.permutation.getNumKeys()]++;
+
+        // 消去済みのスロットはpermutationから外れているので、全スロットを見る
+        for (size_t i = 0; i < Node::ORDER - 1; i++) {
+            if (10 <= snapshot.key_len[i] && snapshot.key_len[i] <= 18) stats.tombstones++;
+        }
+        for (size_t i = 0; i < snapshot.permutation.getNumKeys(); i++) {
+            uint8_t trueIndex = snapshot.permutation(i);
+            uint8_t key_len = snapshot.key_len[trueIndex];
+            if (key_len == BorderNode::key_len_layer) {
+                Node *next_layer = snapshot.lv[trueIndex].next_layer;
+                if (next_layer != nullptr) collect_tree_stats(next_layer, stats, layer + 1);
+            } else if (key_len != BorderNode::key_len_unstable && snapshot.lv[trueIndex].value != nullptr) {
+                stats.keys++;
+                stats.value_bytes += sizeof(Value);
+                if (key_len == BorderNode::key_len_has_suffix && snapshot.suffix[trueIndex] != nullptr) {
+                    stats.suffixes++;
+                    stats.suffix_bytes += snapshot.suffix[trueIndex]->bytes();
+                }
+            }
+        }
+        return 1;
+    }
+
+    InteriorNode *interior = reinterpret_cast<InteriorNode *>(node);
+    std::array<Node *, Node::ORDER> children{};
+    Version version;
+    size_t num_children = read_children(interior, children, version);
+    if (version.deleted) return 0;
+
+    stats.layers[layer].interior_nodes++;
+    stats.interior_bytes += sizeof(InteriorNode);
+    size_t height = 0;
+    for (size_t i = 0; i < num_children; i++) {
+        if (children[i] == nullptr) continue;
+        height = std::max(height, collect_node(children[i], stats, layer));
+    }
+    return height + 1;
+}
+
+/**
+ * @brief rootから辿れる全てのノードを走査して、レイヤごとのノード数やメモリ使用量を集計する。
+ * @param root 走査を開始するレイヤのルートノード。
+ * @param stats 集計結果を加算するTreeStats。
+ * @param layer rootのレイヤ番号。
+ * @note writerと並行して呼び出せるが、ノード単位で一貫した値を読んでいるだけなので、全体としては近似値になる。
+ */
+void collect_tree_stats(Node *root, TreeStats &stats, size_t layer) {
+    if (root == nullptr) return;
+    // 古いrootを渡された場合は本当のrootまで登る
+    while (!root->getIsRoot() && root->getParent() != nullptr) root = root->getParent();
+    if (stats.layers.size() <= layer) stats.layers.resize(layer + 1);
+    size_t height = collect_node(root, stats, layer);
+    LayerStats &layer_stats = stats.layers[layer];
+    layer_stats.trees++;
+    layer_stats.max_height = std::max(layer_stats.max_height, height);
+}
@@ -176,4 +176,24 @@ TEST(BorderNodeTest, insertPoint) {
     // permutationIndex=7のpermutation slotが空なのでここを使う
     EXPECT_EQ(pair.first, 7);
     EXPECT_EQ(pair.second, false);
-}
\ No newline at end of file
+}
+TEST(BorderNodeTest, lazySuffixTable) {
+    // 8byte以下のキーしか持たないBorderNodeはSuffixTableを確保しないかのテスト
+    Node *root = nullptr;
+    GarbageCollector gc;
+    for (uint64_t i = 0; i < 10; i++) {
+        Key key({i}, 8);
+        root = masstree_put(root, key, new Value(i), gc).second;
+    }
+    BorderNode *border = reinterpret_cast<BorderNode *>(root);
+    EXPECT_FALSE(border->getKeySuffixes().isAllocated());
+    EXPECT_EQ(border->getKeySuffixes().get(0), nullptr);
+    // suffixを持つキーを入れた時点でSuffixTableが確保される
+    Key key({0x1111'1111'1111'1111, 0x0A0B'0000'0000'0000}, 2);
+    root = masstree_put(root, key, new Value(100), gc).second;
+    EXPECT_TRUE(border->getKeySuffixes().isAllocated());
+    key.reset();
+    Value *value = masstree_get(root, key);
+    ASSERT_NE(value, nullptr);
+    EXPECT_EQ(*value, 100);
+}
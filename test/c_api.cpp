@@ -0,0 +1,154 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../src/include/masstree_c.h"
+#include "gtest_util.h"
+
+TEST(CApiTest, getPutRemove) {
+    masstree_t *tree = masstree_open();
+    ASSERT_NE(tree, nullptr);
+    masstree_thread_t *thread = masstree_thread_register(tree);
+    ASSERT_NE(thread, nullptr);
+    // 8byteを超えるキーや、途中に0を含むキーも扱える
+    std::vector<std::string> keys{"apple", "banana", std::string("nul\0byte", 8), "a key longer than a single slice", "b"};
+    for (size_t i = 0; i < keys.size(); i++) {
+        EXPECT_EQ(masstree_put(thread, keys[i].data(), keys[i].size(), static_cast<int32_t>(i)), MASSTREE_OK);
+    }
+    for (size_t i = 0; i < keys.size(); i++) {
+        int32_t value = -1;
+        EXPECT_EQ(masstree_get(thread, keys[i].data(), keys[i].size(), &value), MASSTREE_OK);
+        EXPECT_EQ(value, static_cast<int32_t>(i));
+    }
+    // 置き換え
+    EXPECT_EQ(masstree_put(thread, "apple", 5, 100), MASSTREE_OK);
+    int32_t value = 0;
+    EXPECT_EQ(masstree_get(thread, "apple", 5, &value), MASSTREE_OK);
+    EXPECT_EQ(value, 100);
+
+    EXPECT_EQ(masstree_remove(thread, "banana", 6), MASSTREE_OK);
+    EXPECT_EQ(masstree_get(thread, "banana", 6, &value), MASSTREE_NOT_FOUND);
+    EXPECT_EQ(masstree_remove(thread, "banana", 6), MASSTREE_NOT_FOUND);
+    // prefixだけ一致するキーは別のキー
+    EXPECT_EQ(masstree_get(thread, "appl", 4, &value), MASSTREE_NOT_FOUND);
+
+    EXPECT_EQ(masstree_get(thread, "apple", 0, &value), MASSTREE_INVALID_ARGUMENT);
+    EXPECT_EQ(masstree_put(nullptr, "apple", 5, 1), MASSTREE_INVALID_ARGUMENT);
+
+    masstree_stats_t stats{};
+    EXPECT_EQ(masstree_get_stats(tree, &stats), MASSTREE_OK);
+    EXPECT_EQ(stats.keys, keys.size() - 1);
+    EXPECT_GE(stats.border_nodes, 1);
+    EXPECT_GT(stats.memory_bytes, 0);
+    // 置き換えたapple、消したbananaのValueがGCに残っている
+    EXPECT_GE(stats.retired_objects, 2);
+    uint64_t counter = 0;
+    EXPECT_EQ(masstree_get_counter(tree, "border_split", &counter), MASSTREE_OK);
+    EXPECT_EQ(masstree_get_counter(tree, "no_such_counter", &counter), MASSTREE_NOT_FOUND);
+    masstree_close(tree);
+}
+
+TEST(CApiTest, quiesce) {
+    // masstree_thread_quiesceで、置き換えや削除で外れたValueをmasstree_closeの前に解放できるかのテスト
+    masstree_t *tree = masstree_open();
+    masstree_thread_t *thread = masstree_thread_register(tree);
+    constexpr int num_rounds = 100;
+    for (int round = 0; round < num_rounds; round++) {
+        EXPECT_EQ(masstree_put(thread, "counter", 7, round), MASSTREE_OK);
+        EXPECT_EQ(masstree_put(thread, "removed", 7, round), MASSTREE_OK);
+        EXPECT_EQ(masstree_remove(thread, "removed", 7), MASSTREE_OK);
+    }
+    masstree_stats_t stats{};
+    EXPECT_EQ(masstree_get_stats(tree, &stats), MASSTREE_OK);
+    EXPECT_GE(stats.retired_objects, 2 * num_rounds - 1);
+
+    // バッファが足りずに返せなかったキーがあるcursorを開いたままでもいい(そのValueを置き換えて解放しても前の値を返す)
+    masstree_cursor_t *cursor = masstree_cursor_open(thread, nullptr, 0, nullptr, 0);
+    char buf[16];
+    size_t len = 0;
+    EXPECT_EQ(masstree_cursor_next(cursor, buf, 1, &len, nullptr), MASSTREE_BUFFER_TOO_SMALL);
+    EXPECT_EQ(masstree_put(thread, "counter", 7, num_rounds), MASSTREE_OK);
+
+    EXPECT_EQ(masstree_thread_quiesce(thread), MASSTREE_OK);
+    EXPECT_EQ(masstree_get_stats(tree, &stats), MASSTREE_OK);
+    EXPECT_EQ(stats.retired_objects, 0);
+    EXPECT_EQ(stats.keys, 1);
+    int32_t value = -1;
+    EXPECT_EQ(masstree_get(thread, "counter", 7, &value), MASSTREE_OK);
+    EXPECT_EQ(value, num_rounds);
+    EXPECT_EQ(masstree_cursor_next(cursor, buf, sizeof(buf), &len, &value), MASSTREE_OK);
+    EXPECT_EQ(std::string(buf, len), "counter");
+    EXPECT_EQ(value, num_rounds - 1);
+    EXPECT_EQ(masstree_thread_quiesce(nullptr), MASSTREE_INVALID_ARGUMENT);
+    masstree_cursor_close(cursor);
+    masstree_close(tree);
+}
+
+TEST(CApiTest, cursor) {
+    masstree_t *tree = masstree_open();
+    masstree_thread_t *thread = masstree_thread_register(tree);
+    constexpr int num_keys = 1000;
+    auto keyOf = [](int i) {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "key%05d", i);
+        return std::string(buf);
+    };
+    for (int i = 0; i < num_keys; i++) {
+        std::string key = keyOf(i);
+        ASSERT_EQ(masstree_put(thread, key.data(), key.size(), i), MASSTREE_OK);
+    }
+
+    // 全体を昇順に読む
+    masstree_cursor_t *cursor = masstree_cursor_open(thread, nullptr, 0, nullptr, 0);
+    ASSERT_NE(cursor, nullptr);
+    char buf[16];
+    size_t len = 0;
+    int32_t value = 0;
+    for (int i = 0; i < num_keys; i++) {
+        ASSERT_EQ(masstree_cursor_next(cursor, buf, sizeof(buf), &len, &value), MASSTREE_OK);
+        EXPECT_EQ(std::string(buf, len), keyOf(i));
+        EXPECT_EQ(value, i);
+    }
+    EXPECT_EQ(masstree_cursor_next(cursor, buf, sizeof(buf), &len, &value), MASSTREE_NOT_FOUND);
+    masstree_cursor_close(cursor);
+
+    // [key00100, key00200)、途中でバッファが足りなくても同じキーからやり直せる
+    std::string lo = keyOf(100), hi = keyOf(200);
+    cursor = masstree_cursor_open(thread, lo.data(), lo.size(), hi.data(), hi.size());
+    char small[4];
+    EXPECT_EQ(masstree_cursor_next(cursor, small, sizeof(small), &len, &value), MASSTREE_BUFFER_TOO_SMALL);
+    EXPECT_EQ(len, 8);
+    int count = 0;
+    while (masstree_cursor_next(cursor, buf, sizeof(buf), &len, &value) == MASSTREE_OK) {
+        EXPECT_EQ(std::string(buf, len), keyOf(100 + count));
+        count++;
+    }
+    EXPECT_EQ(count, 100);
+    masstree_cursor_close(cursor);
+    masstree_close(tree);
+}
+
+TEST(CApiTest, multipleThreads) {
+    masstree_t *tree = masstree_open();
+    constexpr size_t num_threads = 4;
+    constexpr int num_keys = 2000;
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; t++) {
+        threads.emplace_back([&, t] {
+            masstree_thread_t *thread = masstree_thread_register(tree);
+            for (int i = static_cast<int>(t); i < num_keys; i += num_threads) {
+                std::string key = "k" + std::to_string(i);
+                EXPECT_EQ(masstree_put(thread, key.data(), key.size(), i), MASSTREE_OK);
+                int32_t value = -1;
+                EXPECT_EQ(masstree_get(thread, key.data(), key.size(), &value), MASSTREE_OK);
+                EXPECT_EQ(value, i);
+            }
+        });
+    }
+    for (auto &thread : threads) thread.join();
+    masstree_stats_t stats{};
+    EXPECT_EQ(masstree_get_stats(tree, &stats), MASSTREE_OK);
+    EXPECT_EQ(stats.keys, num_keys);
+    masstree_close(tree);
+}
@@ -0,0 +1,94 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <limits>
+#include <thread>
+#include <vector>
+
+#include "../src/include/masstree_delegation.h"
+#include "gtest_util.h"
+
+TEST(DelegatedMasstreeTest, singleClient) {
+    DelegatedMasstree delegated({1000, 2000});
+    DelegatedMasstree::Client &client = delegated.registerClient();
+    EXPECT_EQ(delegated.numPartitions(), 3);
+    for (uint64_t i = 0; i < 3000; i++) {
+        Key key({i}, 8);
+        client.put(key, new Value(static_cast<int>(i)));
+    }
+    for (uint64_t i = 0; i < 3000; i++) {
+        Key key({i}, 8);
+        Value *value = client.get(key);
+        ASSERT_NE(value, nullptr);
+        EXPECT_EQ(value->getBody(), static_cast<int>(i));
+    }
+    // キーは担当するパーティションのMasstreeにだけ入る
+    for (size_t i = 0; i < delegated.numPartitions(); i++) {
+        EXPECT_EQ(delegated.partition(i).rank(Key({std::numeric_limits<uint64_t>::max()}, 8), true), 1000);
+    }
+    Key removed({1500}, 8);
+    client.remove(removed);
+    EXPECT_EQ(client.get(removed), nullptr);
+
+    std::vector<Key> keys;
+    for (uint64_t i = 0; i < 3000; i += 7) keys.emplace_back(std::vector<uint64_t>{i}, 8);
+    std::vector<Value *> values = client.multi_get(keys);
+    ASSERT_EQ(values.size(), keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (keys[i].slices[0] == 1500) {
+            EXPECT_EQ(values[i], nullptr);
+        } else {
+            ASSERT_NE(values[i], nullptr);
+            EXPECT_EQ(values[i]->getBody(), static_cast<int>(keys[i].slices[0]));
+        }
+    }
+}
+
+TEST(DelegatedMasstreeTest, multipleClients) {
+    // 複数のクライアントが同じキーに書き込んでも、ownerが順に処理するので失われないかのテスト
+    DelegatedMasstree delegated({1ULL << 63});
+    constexpr size_t num_threads = 4;
+    constexpr uint64_t num_keys = 2000;
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; t++) {
+        threads.emplace_back([&, t] {
+            DelegatedMasstree::Client &client = delegated.registerClient();
+            for (uint64_t i = 0; i < num_keys; i++) {
+                // 偏った書き込み: 全スレッドが同じキーの集合に書く
+                Key key({(i % 2 == 0) ? i : (1ULL << 63) + i}, 8);
+                client.put(key, new Value(static_cast<int>(t)));
+                Key check = key;
+                EXPECT_NE(client.get(check), nullptr);
+            }
+        });
+    }
+    for (auto &thread : threads) thread.join();
+    DelegatedMasstree::Client &client = delegated.registerClient();
+    for (uint64_t i = 0; i < num_keys; i++) {
+        Key key({(i % 2 == 0) ? i : (1ULL << 63) + i}, 8);
+        Value *value = client.get(key);
+        ASSERT_NE(value, nullptr);
+        EXPECT_LT(value->getBody(), static_cast<int>(num_threads));
+    }
+    EXPECT_GT(delegated.getStats()[StatsCounter::BorderSplit], 0);
+}
+
+TEST(DelegatedMasstreeTest, wakeParkedOwner) {
+    // キューが空の間にparkしたownerが、次のリクエストで起きて処理するかのテスト
+    DelegatedMasstree delegated({});
+    DelegatedMasstree::Client &client = delegated.registerClient();
+    for (uint64_t i = 0; i < 10; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        Key key({i}, 8);
+        client.put(key, new Value(static_cast<int>(i)));
+        Value *value = client.get(key);
+        ASSERT_NE(value, nullptr);
+        EXPECT_EQ(value->getBody(), static_cast<int>(i));
+    }
+    // multi_getは同じkeysで何度でも引ける(cursorが戻っている)
+    std::vector<Key> keys;
+    for (uint64_t i = 0; i < 10; i++) keys.emplace_back(std::vector<uint64_t>{i}, 8);
+    for (size_t n = 0; n < 2; n++) {
+        std::vector<Value *> values = client.multi_get(keys);
+        for (size_t i = 0; i < keys.size(); i++) ASSERT_NE(values[i], nullptr);
+    }
+}
@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+#include <vector>
+
+#include "../src/include/masstree_gc.h"
+#include "gtest_util.h"
+
+TEST(GarbageCollectorTest, addAndContain) {
+    // chunkをまたいで追加しても全て保持され、種類ごとに数えられるかのテスト
+    GarbageCollector gc;
+    std::vector<Value *> values;
+    for (size_t i = 0; i < 3 * RETIRE_CHUNK_SIZE + 1; i++) {
+        values.push_back(new Value(static_cast<int>(i)));
+        gc.add(values.back());
+    }
+    BorderNode *border = new BorderNode;
+    border->lock();
+    border->setDeleted(true);
+    gc.add(border);
+    EXPECT_EQ(gc.size(), values.size() + 1);
+    for (Value *value : values) EXPECT_TRUE(gc.contain(value));
+    EXPECT_TRUE(gc.contain(border));
+    Value other(0);
+    EXPECT_FALSE(gc.contain(&other));
+    EXPECT_EQ(gc.getRetired(RetiredType::Value), values.size());
+    EXPECT_EQ(gc.getRetired(RetiredType::Border), 1);
+    EXPECT_EQ(gc.getRetired(RetiredType::Interior), 0);
+
+    gc.run();
+    EXPECT_TRUE(gc.empty());
+    EXPECT_EQ(gc.getFreed(RetiredType::Value), values.size());
+    EXPECT_EQ(gc.getFreed(RetiredType::Border), 1);
+    // 解放した後はcontainに出てこない
+    EXPECT_FALSE(gc.contain(border));
+}
+
+TEST(GarbageCollectorTest, runWithLimit) {
+    // 上限を付けたrunは指定した数だけ解放し、残りは保持したままかのテスト
+    GarbageCollector gc;
+    for (int i = 0; i < 300; i++) gc.add(new Value(i));
+    EXPECT_EQ(gc.size(), 300);
+    EXPECT_EQ(gc.bytes(), 300 * sizeof(Value));
+    EXPECT_EQ(gc.run(4), 4);
+    EXPECT_EQ(gc.size(), 296);
+    EXPECT_EQ(gc.run(200), 200);
+    EXPECT_EQ(gc.getFreed(RetiredType::Value), 204);
+    // 途中まで解放したchunkに追加しても数が合う
+    for (int i = 0; i < 10; i++) gc.add(new Value(i));
+    EXPECT_EQ(gc.run(1000), 106);
+    EXPECT_TRUE(gc.empty());
+    EXPECT_EQ(gc.getRetired(RetiredType::Value), 310);
+}
+
+TEST(GarbageCollectorTest, swap) {
+    // swapで中身だけが入れ替わり、カウンタは元のGarbageCollectorに残るかのテスト
+    GarbageCollector gc, other;
+    Value *value = new Value(1);
+    gc.add(value);
+    gc.swap(other);
+    EXPECT_TRUE(gc.empty());
+    EXPECT_FALSE(gc.contain(value));
+    EXPECT_TRUE(other.contain(value));
+    EXPECT_EQ(gc.getRetired(RetiredType::Value), 1);
+    EXPECT_EQ(other.getRetired(RetiredType::Value), 0);
+    // 入れ替えた後は同じポインタをもう一度addできる(解放されて再利用されたアドレスの場合)
+    other.run();
+    Value *reused = new Value(2);
+    gc.add(reused);
+    EXPECT_TRUE(gc.contain(reused));
+    gc.run();
+}
+
+#if MASSTREE_GC_DOUBLE_RETIRE_CHECK
+TEST(GarbageCollectorDeathTest, doubleRetire) {
+    GarbageCollector gc;
+    Value *value = new Value(1);
+    gc.add(value);
+    EXPECT_DEATH(gc.add(value), "retired twice");
+    gc.run();
+}
+#endif
@@ -0,0 +1,70 @@
+#include <gtest/gtest.h>
+#include <cstdint>
+
+#include "../src/include/masstree.h"
+#include "gtest_util.h"
+
+TEST(LatencyTest, bucketIndex) {
+    // 16未満はそのまま、それ以降はsub-bucketに分けられる
+    EXPECT_EQ(LatencyBuckets::indexOf(0), 0);
+    EXPECT_EQ(LatencyBuckets::indexOf(15), 15);
+    EXPECT_EQ(LatencyBuckets::indexOf(16), 16);
+    EXPECT_EQ(LatencyBuckets::indexOf(31), 31);
+    EXPECT_EQ(LatencyBuckets::indexOf(32), 32);
+    EXPECT_EQ(LatencyBuckets::indexOf(33), 32);   // 32~33は同じbucket
+    EXPECT_EQ(LatencyBuckets::indexOf(UINT64_MAX), LatencyBuckets::NUM_BUCKETS - 1);
+    // どの値もbucketの[lowerBound, upperBound]に収まる
+    for (uint64_t value : {1ULL, 17ULL, 100ULL, 12345ULL, 1'000'000'007ULL, 1ULL << 40}) {
+        size_t index = LatencyBuckets::indexOf(value);
+        EXPECT_LE(LatencyBuckets::lowerBound(index), value);
+        EXPECT_GE(LatencyBuckets::upperBound(index), value);
+    }
+}
+
+TEST(LatencyTest, percentileAndMerge) {
+    // 2つのhistogramをmergeして分位点を取る
+    LatencyHistogram h1, h2;
+    for (uint64_t i = 1; i <= 900; i++) h1.record(100);
+    for (uint64_t i = 1; i <= 100; i++) h2.record(10000);
+    LatencySnapshot s = h1.snapshot();
+    s.merge(h2.snapshot());
+    EXPECT_EQ(s.count, 1000);
+    EXPECT_EQ(s.max, 10000);
+    // p50は100ns付近、p99は10000ns付近(相対誤差は1/16以下)
+    EXPECT_GE(s.percentile(0.5), 100);
+    EXPECT_LE(s.percentile(0.5), 100 + 100 / 16);
+    EXPECT_GE(s.percentile(0.99), 10000 - 10000 / 16);
+    EXPECT_LE(s.percentile(0.99), 10000);
+}
+
+TEST(LatencyTest, export) {
+    // text/JSONで出力できるかのテスト
+    LatencyRecorder recorder;
+    recorder[LatencyOp::Put].record(42);
+    LatencyReport report = recorder.report();
+    EXPECT_EQ(report[LatencyOp::Put].count, 1);
+    EXPECT_EQ(report[LatencyOp::Get].count, 0);
+    EXPECT_NE(report.toText().find("put count=1"), std::string::npos);
+    EXPECT_NE(report.toJSON().find("\"put\":{\"count\":1"), std::string::npos);
+    EXPECT_NE(report.toJSON().find("\"buckets\":[[42,1]]"), std::string::npos);
+}
+
+#ifdef MASSTREE_LATENCY_HISTOGRAM
+TEST(LatencyTest, masstree) {
+    // Masstreeの各操作がhistogramに記録されるかのテスト
+    Masstree masstree;
+    ThreadContext &ctx = masstree.registerThread();
+    for (uint64_t i = 0; i < 100; i++) {
+        Key key({i}, 8);
+        masstree.put(key, new Value(i), ctx);
+        masstree.get(key, ctx);
+    }
+    Key key({0}, 8);
+    masstree.remove(key, ctx);
+    LatencyReport report = masstree.getLatency();
+    EXPECT_EQ(report[LatencyOp::Put].count, 100);
+    EXPECT_EQ(report[LatencyOp::Get].count, 100);
+    EXPECT_EQ(report[LatencyOp::Remove].count, 1);
+    EXPECT_EQ(report[LatencyOp::Scan].count, 0);
+}
+#endif
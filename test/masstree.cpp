@@ -0,0 +1,948 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../src/include/masstree.h"
+#include "gtest_util.h"
+
+// 文字列からKeyを作る(8byteごとにbig endianでスライスにする)
+static Key makeKey(const std::string &str) {
+    std::vector<uint64_t> slices;
+    size_t last = 0;
+    for (size_t index = 0; index < str.size(); index += 8) {
+        uint64_t slice = 0;
+        for (last = 0; last < 8 && index + last < str.size(); last++) {
+            slice |= static_cast<uint64_t>(static_cast<uint8_t>(str[index + last])) << ((7 - last) * 8);
+        }
+        slices.push_back(slice);
+    }
+    return Key(slices, last);
+}
+
+// Keyを文字列に戻す
+static std::string keyToString(const Key &key) {
+    std::string str;
+    for (size_t i = 0; i < key.slices.size(); i++) {
+        size_t len = (i + 1 == key.slices.size()) ? key.lastSliceSize : 8;
+        for (size_t j = 0; j < len; j++) str.push_back(static_cast<char>((key.slices[i] >> ((7 - j) * 8)) & 0xFF));
+    }
+    return str;
+}
+
+TEST(MasstreeTest, threadContext) {
+    // 複数スレッドがそれぞれThreadContextを登録してput/getできるかのテスト
+    Masstree masstree;
+    constexpr size_t num_threads = 4;
+    constexpr uint64_t num_keys = 1000;
+    std::vector<ThreadContext *> contexts;
+    for (size_t i = 0; i < num_threads; i++) contexts.push_back(&masstree.registerThread());
+    for (size_t i = 0; i < num_threads; i++) EXPECT_EQ(contexts[i]->getThreadId(), i);
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; t++) {
+        threads.emplace_back([&masstree, &contexts, t]() {
+            ThreadContext &ctx = *contexts[t];
+            // スレッドごとに重ならないキーをinsertする
+            for (uint64_t i = t; i < num_keys; i += num_threads) {
+                Key key({i}, 8);
+                masstree.put(key, new Value(i), ctx);
+            }
+        });
+    }
+    for (auto &thread : threads) thread.join();
+
+    ThreadContext &ctx = *contexts[0];
+    for (uint64_t i = 0; i < num_keys; i++) {
+        Key key({i}, 8);
+        Value *value = masstree.get(key, ctx);
+        ASSERT_NE(value, nullptr);
+        EXPECT_EQ(value->getBody(), i);
+    }
+}
+
+TEST(MasstreeTest, remove) {
+    // Masstree::removeで消したキーが取得できなくなるかのテスト
+    Masstree masstree;
+    ThreadContext &ctx = masstree.registerThread();
+    for (uint64_t i = 0; i < 100; i++) {
+        Key key({i}, 8);
+        masstree.put(key, new Value(i), ctx);
+    }
+    for (uint64_t i = 0; i < 100; i += 2) {
+        Key key({i}, 8);
+        masstree.remove(key, ctx);
+    }
+    for (uint64_t i = 0; i < 100; i++) {
+        Key key({i}, 8);
+        Value *value = masstree.get(key, ctx);
+        if (i % 2 == 0) {
+            EXPECT_EQ(value, nullptr);
+        } else {
+            ASSERT_NE(value, nullptr);
+            EXPECT_EQ(value->getBody(), i);
+        }
+    }
+}
+
+TEST(MasstreeTest, removeAndReuseSlot) {
+    // removeしたキーのValueがgcに渡され、そのスロットを再利用するinsertができるかのテスト
+    Masstree masstree;
+    GarbageCollector gc;
+    std::vector<Value *> values;
+    for (uint64_t i = 0; i < 5; i++) {
+        Key key({i}, 8);
+        values.push_back(new Value(i));
+        masstree.put(key, values.back(), gc);
+    }
+    for (uint64_t i = 0; i < 3; i++) {
+        Key key({i}, 8);
+        masstree.remove(key, gc);
+        EXPECT_TRUE(gc.contain(values[i]));
+    }
+    for (uint64_t i = 10; i < 13; i++) {
+        Key key({i}, 8);
+        masstree.put(key, new Value(i), gc);
+    }
+    for (uint64_t i = 3; i < 13; i++) {
+        Key key({i}, 8);
+        EXPECT_EQ(masstree.get(key) != nullptr, i < 5 || i >= 10);
+    }
+}
+
+TEST(MasstreeTest, operationStats) {
+    // split/layer作成/layer削除がカウンタに反映されるかのテスト
+    Masstree masstree;
+    ThreadContext &ctx1 = masstree.registerThread();
+    ThreadContext &ctx2 = masstree.registerThread();
+    for (uint64_t i = 0; i < 1000; i++) {
+        Key key({i}, 8);
+        masstree.put(key, new Value(i), ctx1);
+    }
+    EXPECT_GT(ctx1.getStats().get(StatsCounter::BorderSplit), 0);
+    EXPECT_GT(ctx1.getStats().get(StatsCounter::InteriorSplit), 0);
+    EXPECT_EQ(ctx1.getStats().get(StatsCounter::LayerCreate), 0);
+
+    // 同じスライスでsuffixが衝突するキーを入れるとレイヤが作られる
+    Key key1({0xFFFF'FFFF'FFFF'FFFF, 0x0A0B'0000'0000'0000}, 2);
+    Key key2({0xFFFF'FFFF'FFFF'FFFF, 0x0C0D'0000'0000'0000}, 2);
+    masstree.put(key1, new Value(1), ctx2);
+    masstree.put(key2, new Value(2), ctx2);
+    EXPECT_EQ(ctx2.getStats().get(StatsCounter::LayerCreate), 1);
+    // 下位レイヤの最後のキーを消すとレイヤが消える
+    masstree.remove(key1, ctx2);
+    EXPECT_EQ(ctx2.getStats().get(StatsCounter::LayerDelete), 0);
+    masstree.remove(key2, ctx2);
+    EXPECT_EQ(ctx2.getStats().get(StatsCounter::LayerDelete), 1);
+    EXPECT_EQ(masstree.get(key2, ctx2), nullptr);
+
+    // getStats()は全スレッドのカウンタを集計する
+    StatsSnapshot total = masstree.getStats();
+    EXPECT_EQ(total[StatsCounter::BorderSplit],
+              ctx1.getStats().get(StatsCounter::BorderSplit) + ctx2.getStats().get(StatsCounter::BorderSplit));
+    EXPECT_EQ(total[StatsCounter::LayerCreate], 1);
+    EXPECT_EQ(total[StatsCounter::LayerDelete], 1);
+}
+
+TEST(MasstreeTest, treeStats) {
+    // stats()で木の形とメモリ使用量が取れるかのテスト
+    Masstree masstree;
+    ThreadContext &ctx = masstree.registerThread();
+    TreeStats empty = masstree.stats();
+    EXPECT_EQ(empty.layers.size(), 0);
+    EXPECT_EQ(empty.totalBytes(), 0);
+
+    for (uint64_t i = 0; i < 1000; i++) {
+        Key key({i}, 8);
+        masstree.put(key, new Value(i), ctx);
+    }
+    // Layer1を作る(同じスライスでsuffixが衝突する2つのキー)と、suffixを持つキーを1つ
+    Key key1({0xFFFF'FFFF'FFFF'FFFF, 0x0A0B'0000'0000'0000}, 2);
+    Key key2({0xFFFF'FFFF'FFFF'FFFF, 0x0C0D'0000'0000'0000}, 2);
+    Key key3({0xFFFF'FFFF'FFFF'FFFE, 0x0A0B'0000'0000'0000}, 2);
+    masstree.put(key1, new Value(1), ctx);
+    masstree.put(key2, new Value(2), ctx);
+    masstree.put(key3, new Value(3), ctx);
+    for (uint64_t i = 0; i < 1000; i += 2) {
+        Key key({i}, 8);
+        masstree.remove(key, ctx);
+    }
+
+    TreeStats stats = masstree.stats();
+    ASSERT_EQ(stats.layers.size(), 2);
+    EXPECT_EQ(stats.layers[0].trees, 1);
+    EXPECT_GT(stats.layers[0].interior_nodes, 0);
+    EXPECT_GT(stats.layers[0].max_height, 1);
+    EXPECT_EQ(stats.layers[1].trees, 1);
+    EXPECT_EQ(stats.layers[1].border_nodes, 1);
+    EXPECT_EQ(stats.layers[1].max_height, 1);
+    EXPECT_EQ(stats.keys, 503);
+    EXPECT_EQ(stats.suffixes, 1);
+    EXPECT_GT(stats.tombstones, 0);
+    // fill_histogramのキーの総数は、Valueを持つキーとLayerへのリンクの合計と一致する
+    size_t slots = 0;
+    for (size_t n = 0; n < stats.fill_histogram.size(); n++) slots += n * stats.fill_histogram[n];
+    EXPECT_EQ(slots, stats.keys + 1);
+    EXPECT_EQ(stats.border_bytes, (stats.layers[0].border_nodes + stats.layers[1].border_nodes) * sizeof(BorderNode));
+    EXPECT_EQ(stats.value_bytes, stats.keys * sizeof(Value));
+    EXPECT_GT(stats.suffix_bytes, 0);
+    EXPECT_EQ(stats.totalBytes(), stats.border_bytes + stats.interior_bytes + stats.suffix_table_bytes + stats.suffix_bytes + stats.value_bytes);
+}
+
+TEST(MasstreeTest, upsert) {
+    // 複数スレッドが同じキーをupsertでインクリメントしても更新が失われないかのテスト
+    Masstree masstree;
+    constexpr size_t num_threads = 4;
+    constexpr uint64_t num_keys = 20;
+    constexpr uint64_t num_increments = 2000;
+    std::vector<ThreadContext *> contexts;
+    for (size_t i = 0; i < num_threads; i++) contexts.push_back(&masstree.registerThread());
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; t++) {
+        threads.emplace_back([&masstree, &contexts, t]() {
+            ThreadContext &ctx = *contexts[t];
+            for (uint64_t i = 0; i < num_increments; i++) {
+                // 9byte以上のキーも混ぜて下位レイヤでのupsertも確認する
+                Key key = ((i / num_keys) % 2 == 0) ? Key({i % num_keys}, 8) : Key({i % num_keys, 1}, 8);
+                masstree.upsert(key, [](Value *old_value) {
+                    return new Value(old_value == nullptr ? 1 : old_value->getBody() + 1);
+                }, ctx);
+            }
+        });
+    }
+    for (auto &thread : threads) thread.join();
+
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < num_keys; i++) {
+        for (Key key : {Key({i}, 8), Key({i, 1}, 8)}) {
+            Value *value = masstree.get(key);
+            ASSERT_NE(value, nullptr);
+            total += value->getBody();
+        }
+    }
+    EXPECT_EQ(total, num_threads * num_increments);
+
+    // nullptrを返すと何も書き込まない
+    GarbageCollector gc;
+    Key key({100}, 8);
+    masstree.upsert(key, [](Value *) -> Value * { return nullptr; }, gc);
+    EXPECT_EQ(masstree.get(key), nullptr);
+}
+
+TEST(MasstreeTest, compareAndPut) {
+    Masstree masstree;
+    GarbageCollector gc;
+    Key key({1, 2}, 8);
+    Value *v1 = new Value(1);
+    Value *v2 = new Value(2);
+
+    // expected == nullptrはkeyが無い場合のinsert
+    EXPECT_TRUE(masstree.compare_and_put(key, nullptr, v1, gc));
+    EXPECT_EQ(masstree.get(key), v1);
+    EXPECT_FALSE(masstree.compare_and_put(key, nullptr, v2, gc));
+    EXPECT_EQ(masstree.get(key), v1);
+
+    // 現在のValueと一致する場合だけ置き換わる
+    Value *other = new Value(1);
+    EXPECT_FALSE(masstree.compare_and_put(key, other, v2, gc));
+    EXPECT_EQ(masstree.get(key), v1);
+    EXPECT_TRUE(masstree.compare_and_put(key, v1, v2, gc));
+    EXPECT_EQ(masstree.get(key), v2);
+    delete other;
+}
+
+TEST(MasstreeTest, updateInPlace) {
+    // lock-freeなupdateとsplit・レイヤ作成を伴うinsertが並行しても更新が失われないかのテスト
+    Masstree masstree;
+    constexpr size_t num_updaters = 3;
+    constexpr uint64_t num_keys = 300;
+    constexpr uint64_t num_rounds = 50;
+    ThreadContext &main_ctx = masstree.registerThread();
+    // updaterが書き換えるキー{k, 1}を先に入れておく
+    for (uint64_t k = 0; k < num_keys; k++) {
+        Key key({k, 1}, 8);
+        masstree.put(key, new Value(0), main_ctx);
+    }
+    std::vector<ThreadContext *> contexts;
+    for (size_t i = 0; i <= num_updaters; i++) contexts.push_back(&masstree.registerThread());
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_updaters; t++) {
+        threads.emplace_back([&masstree, &contexts, t]() {
+            ThreadContext &ctx = *contexts[t];
+            for (uint64_t r = 1; r <= num_rounds; r++) {
+                for (uint64_t k = t; k < num_keys; k += num_updaters) {
+                    Key key({k, 1}, 8);
+                    masstree.put(key, new Value(r * num_keys + k), ctx);
+                }
+            }
+        });
+    }
+    // {k, 2}のinsertで{k, 1}のValueが下位レイヤに移動し、{k}のinsertでsplitが起きる
+    threads.emplace_back([&masstree, &contexts]() {
+        ThreadContext &ctx = *contexts[num_updaters];
+        for (uint64_t k = 0; k < num_keys; k++) {
+            Key layer_key({k, 2}, 8);
+            masstree.put(layer_key, new Value(k), ctx);
+            Key split_key({k}, 8);
+            masstree.put(split_key, new Value(k), ctx);
+        }
+    });
+    for (auto &thread : threads) thread.join();
+
+    for (uint64_t k = 0; k < num_keys; k++) {
+        Key key({k, 1}, 8);
+        Value *value = masstree.get(key);
+        ASSERT_NE(value, nullptr);
+        EXPECT_EQ(value->getBody(), num_rounds * num_keys + k);
+        Key layer_key({k, 2}, 8);
+        ASSERT_NE(masstree.get(layer_key), nullptr);
+        Key split_key({k}, 8);
+        ASSERT_NE(masstree.get(split_key), nullptr);
+    }
+    EXPECT_GT(masstree.getStats()[StatsCounter::PutInPlace], 0);
+}
+
+TEST(MasstreeTest, scanDuringUpdate) {
+    // 他スレッドが既存キーのValueを置き換えている間にscanしても、キーが抜け落ちないかのテスト
+    // (upsertやlock-freeなupdateはスロットを一瞬空にするので、それを「キーが無い」と読まないこと)
+    Masstree masstree;
+    constexpr uint64_t num_keys = 100;
+    constexpr size_t num_scans = 2000;
+    ThreadContext &main_ctx = masstree.registerThread();
+    ThreadContext &updater_ctx = masstree.registerThread();
+    for (uint64_t k = 0; k < num_keys; k++) {
+        // 9byte以上のキーも混ぜて下位レイヤのscanも確認する
+        Key key = (k % 4 == 0) ? Key({k, 1}, 8) : Key({k}, 8);
+        masstree.put(key, new Value(static_cast<int>(k)), main_ctx);
+    }
+
+    std::atomic<bool> done{false};
+    std::thread updater([&]() {
+        for (uint64_t i = 0; !done.load(); i++) {
+            uint64_t k = i % num_keys;
+            Key key = (k % 4 == 0) ? Key({k, 1}, 8) : Key({k}, 8);
+            if (i % 2 == 0) {
+                masstree.upsert(key, [](Value *current) { return current; }, updater_ctx);
+            } else {
+                masstree.put(key, new Value(static_cast<int>(k)), updater_ctx);
+            }
+        }
+    });
+    size_t short_scans = 0;
+    for (size_t i = 0; i < num_scans; i++) {
+        Key left({0}, 8);
+        Key right({std::numeric_limits<uint64_t>::max()}, 8);
+        std::vector<std::pair<Key, Value *>> result;
+        masstree.scan(left, false, right, false, result, main_ctx);
+        if (result.size() != num_keys) short_scans++;
+    }
+    done.store(true);
+    updater.join();
+    EXPECT_EQ(short_scans, 0);
+}
+
+TEST(MasstreeTest, insertAndExchange) {
+    Masstree masstree;
+    GarbageCollector gc;
+    Key key({1, 2}, 8);
+    Value *v1 = new Value(1);
+    Value *v2 = new Value(2);
+    Value *v3 = new Value(3);
+
+    // keyが無ければinsertしてnullptr、あれば既存のValueを返して何もしない
+    EXPECT_EQ(masstree.insert(key, v1, gc), nullptr);
+    EXPECT_EQ(masstree.insert(key, v2, gc), v1);
+    EXPECT_EQ(masstree.get(key), v1);
+
+    // exchangeは置き換えた元のValueをgcに入れずに返す
+    EXPECT_EQ(masstree.exchange(key, v2, gc), v1);
+    EXPECT_FALSE(gc.contain(v1));
+    EXPECT_EQ(masstree.get(key), v2);
+    Key other({3}, 8);
+    EXPECT_EQ(masstree.exchange(other, v3, gc), nullptr);
+    EXPECT_EQ(masstree.get(other), v3);
+    delete v1;
+}
+
+TEST(MasstreeTest, putBatch) {
+    // sortされたバッチのputで、split・レイヤ作成・既存キーのupdateが混ざっても全てのキーが入るかのテスト
+    Masstree masstree;
+    constexpr size_t num_threads = 2;
+    constexpr uint64_t num_keys = 3000;
+    std::vector<ThreadContext *> contexts;
+    for (size_t i = 0; i < num_threads; i++) contexts.push_back(&masstree.registerThread());
+    // 既存キーのupdateになるものを先に入れておく
+    for (uint64_t i = 0; i < num_keys; i += 7) {
+        Key key({i}, 8);
+        masstree.put(key, new Value(0), *contexts[0]);
+    }
+
+    // スレッドごとに交互のキーをバッチでputする(同じBorderNodeを取り合う)
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; t++) {
+        threads.emplace_back([&masstree, &contexts, t]() {
+            std::vector<Key> keys;
+            std::vector<Value *> values;
+            for (uint64_t i = t; i < num_keys; i += num_threads) {
+                keys.emplace_back(std::vector<uint64_t>{i}, 8);
+                values.push_back(new Value(i));
+                if (i % 5 == 0) {
+                    // 9byte以上のキーで下位レイヤへのputも混ぜる
+                    keys.emplace_back(std::vector<uint64_t>{i, 1}, 8);
+                    values.push_back(new Value(i + 1));
+                    keys.emplace_back(std::vector<uint64_t>{i, 2}, 8);
+                    values.push_back(new Value(i + 2));
+                }
+            }
+            masstree.put_batch(keys, values, *contexts[t]);
+        });
+    }
+    for (auto &thread : threads) thread.join();
+
+    for (uint64_t i = 0; i < num_keys; i++) {
+        Key key({i}, 8);
+        Value *value = masstree.get(key);
+        ASSERT_NE(value, nullptr);
+        EXPECT_EQ(value->getBody(), i);
+        if (i % 5 == 0) {
+            for (uint64_t s = 1; s <= 2; s++) {
+                Key long_key({i, s}, 8);
+                Value *long_value = masstree.get(long_key);
+                ASSERT_NE(long_value, nullptr);
+                EXPECT_EQ(long_value->getBody(), i + s);
+            }
+        }
+    }
+}
+
+TEST(MasstreeTest, putBatchAfterRemove) {
+    // 右のBorderNodeの最小のキーを消した後でも、put_batchが担当外のBorderNodeにキーを入れないかのテスト
+    // (nextの最小のキーは大きくなるので、それより小さくても右のBorderNodeに入るべきキーがある)
+    Masstree masstree;
+    GarbageCollector gc;
+    for (uint64_t i = 1; i <= 30; i++) {
+        Key key({i}, 8);
+        masstree.put(key, new Value(static_cast<int>(i)), gc);
+    }
+    for (uint64_t i = 9; i <= 16; i++) {
+        Key key({i}, 8);
+        masstree.remove(key, gc);
+    }
+    std::vector<Key> keys;
+    std::vector<Value *> values;
+    for (uint64_t i : {1, 16}) {
+        keys.emplace_back(std::vector<uint64_t>{i}, 8);
+        values.push_back(new Value(static_cast<int>(i) + 100));
+    }
+    masstree.put_batch(keys, values, gc);
+    for (uint64_t i = 1; i <= 30; i++) {
+        Key key({i}, 8);
+        Value *value = masstree.get(key);
+        if (i == 1 || i == 16) {
+            ASSERT_NE(value, nullptr) << i;
+            EXPECT_EQ(value->getBody(), static_cast<int>(i) + 100);
+        } else {
+            EXPECT_EQ(value != nullptr, i < 9 || 16 < i) << i;
+        }
+    }
+}
+
+TEST(MasstreeTest, putBatchUnsorted) {
+    // sortされていないバッチでも、担当外のBorderNodeにキーを入れずに全て入るかのテスト
+    Masstree masstree;
+    GarbageCollector gc;
+    for (uint64_t i = 1; i <= 30; i++) {
+        Key key({i}, 8);
+        masstree.put(key, new Value(static_cast<int>(i)), gc);
+    }
+    for (uint64_t i = 9; i <= 16; i++) {
+        Key key({i}, 8);
+        masstree.remove(key, gc);
+    }
+    std::vector<Key> keys;
+    std::vector<Value *> values;
+    for (uint64_t i : {25, 12, 3, 16, 1, 40}) {
+        keys.emplace_back(std::vector<uint64_t>{i}, 8);
+        values.push_back(new Value(static_cast<int>(i) + 100));
+    }
+    masstree.put_batch(keys, values, gc);
+    for (uint64_t i : {25, 12, 3, 16, 1, 40}) {
+        Key key({i}, 8);
+        Value *value = masstree.get(key);
+        ASSERT_NE(value, nullptr) << i;
+        EXPECT_EQ(value->getBody(), static_cast<int>(i) + 100);
+    }
+    EXPECT_EQ(masstree.rank(Key({std::numeric_limits<uint64_t>::max()}, 8), true), 22 + 3);     // 16, 12, 40が増える
+}
+
+TEST(MasstreeTest, multiGet) {
+    // 順番がばらばらで、重複や存在しないキーや長いキーを含んでも、keysと同じ順に結果が返るかのテスト
+    Masstree masstree;
+    ThreadContext &ctx = masstree.registerThread();
+    for (uint64_t i = 0; i < 1000; i += 2) {
+        Key key({i}, 8);
+        masstree.put(key, new Value(static_cast<int>(i)), ctx);
+    }
+    Key long_key({10, 20}, 3);
+    masstree.put(long_key, new Value(-1), ctx);
+
+    std::vector<Key> keys;
+    for (uint64_t i : {998, 3, 10, 0, 10, 501, 500}) keys.emplace_back(std::vector<uint64_t>{i}, 8);
+    keys.emplace_back(std::vector<uint64_t>{10, 20}, 3);
+    std::vector<Value *> values;
+    masstree.multi_get(keys, values, ctx);
+    ASSERT_EQ(values.size(), keys.size());
+    for (size_t i = 0; i + 1 < keys.size(); i++) {
+        uint64_t slice = keys[i].slices[0];
+        if (slice % 2 == 0) {
+            ASSERT_NE(values[i], nullptr) << slice;
+            EXPECT_EQ(values[i]->getBody(), static_cast<int>(slice));
+        } else {
+            EXPECT_EQ(values[i], nullptr) << slice;
+        }
+        EXPECT_EQ(keys[i].cursor, 0);
+    }
+    ASSERT_NE(values.back(), nullptr);
+    EXPECT_EQ(values.back()->getBody(), -1);
+}
+
+TEST(MasstreeTest, scanPrefix) {
+    Masstree masstree;
+    GarbageCollector gc;
+    std::set<std::string> keys = {
+        "ten", "tenant:12", "tenant:123", "tenant:123:", "tenant:123:a", "tenant:123:bb", "tenant:1234",
+        "tenant:124:x", "tenant:123:a very long key that spans several layers",
+        "tenant:123:a very long key that spans several layers too", "tenant:123:zzzzzzzzzzzzzzzzzz", "tenants", "u",
+    };
+    for (uint64_t i = 0; i < 200; i++) keys.insert("tenant:" + std::to_string(i) + ":item");
+    for (const std::string &str : keys) {
+        Key key = makeKey(str);
+        masstree.put(key, new Value(0), gc);
+    }
+
+    std::vector<std::string> prefixes{"t", "ten", "tenant:", "tenant:123", "tenant:123:", "tenant:123:a very long key",
+                                      "tenant:123:a very long key that spans several layers too", "tenant:9", "v"};
+    for (const std::string &prefix : prefixes) {
+        std::vector<std::string> expected;
+        for (const std::string &str : keys) {
+            if (str.compare(0, prefix.size(), prefix) == 0) expected.push_back(str);
+        }
+        std::vector<std::string> visited;
+        EXPECT_TRUE(masstree.scan_prefix(makeKey(prefix), [&](const Key &key, Value *value) {
+            EXPECT_NE(value, nullptr);
+            visited.push_back(keyToString(key));
+            return true;
+        }));
+        EXPECT_EQ(visited, expected) << "prefix: " << prefix;
+    }
+
+    // visitorがfalseを返したらそこで止まる
+    size_t count = 0;
+    EXPECT_FALSE(masstree.scan_prefix(makeKey("tenant:"), [&](const Key &, Value *) { return ++count < 3; }));
+    EXPECT_EQ(count, 3);
+
+    // 既存のscanがsuffixを壊さないこと
+    Key left = makeKey("tenant:123:");
+    Key right = makeKey("tenant:123:zzzzzzzzzzzzzzzzzzzz");
+    std::vector<std::pair<Key, Value *>> result;
+    masstree.scan(left, false, right, false, result);
+    for (const std::string &str : keys) {
+        Key key = makeKey(str);
+        EXPECT_NE(masstree.get(key), nullptr) << str;
+    }
+}
+
+TEST(MasstreeTest, parallelScan) {
+    Masstree masstree;
+    GarbageCollector gc;
+    constexpr uint64_t num_keys = 20000;
+    for (uint64_t i = 0; i < num_keys; i++) {
+        Key key({i * 2}, 8);
+        masstree.put(key, new Value(i * 2), gc);
+        if (i % 10 == 0) {
+            // 下位レイヤのキーも混ぜる
+            Key long_key({i * 2, 1}, 8);
+            masstree.put(long_key, new Value(i * 2), gc);
+        }
+    }
+
+    // [lo, hi)のキーがちょうど1回ずつ訪問されるか
+    Key lo({101}, 8);
+    Key hi({30000, 1}, 8);
+    std::mutex mutex;
+    std::vector<std::pair<uint64_t, size_t>> visited;     // (先頭のslice, スライス数)
+    std::set<std::thread::id> workers;
+    EXPECT_TRUE(masstree.parallel_scan(lo, hi, 4, [&](const Key &key, Value *value) {
+        EXPECT_EQ(value->getBody(), key.slices[0]);
+        std::lock_guard<std::mutex> lock(mutex);
+        visited.emplace_back(key.slices[0], key.slices.size());
+        workers.insert(std::this_thread::get_id());
+        return true;
+    }));
+    std::sort(visited.begin(), visited.end());
+    std::vector<std::pair<uint64_t, size_t>> expected;
+    for (uint64_t i = 0; i < num_keys; i++) {
+        uint64_t slice = i * 2;
+        if (slice < 101 || slice > 30000) continue;
+        expected.emplace_back(slice, 1);
+        // {30000, 1}はhiそのものなので含まない
+        if (i % 10 == 0 && slice != 30000) expected.emplace_back(slice, 2);
+    }
+    EXPECT_EQ(visited, expected);
+    EXPECT_GT(workers.size(), 1);
+
+    // visitorがfalseを返したら全スレッドが止まる
+    std::atomic<size_t> count{0};
+    EXPECT_FALSE(masstree.parallel_scan(Key({0}, 8), Key({num_keys * 2}, 8), 4, [&](const Key &, Value *) {
+        return ++count < 10;
+    }));
+    EXPECT_LT(count.load(), num_keys);
+}
+
+TEST(MasstreeTest, orderStatistics) {
+    Masstree masstree;
+    GarbageCollector gc;
+    constexpr uint64_t num_keys = 20000;
+    // sliceが3の倍数のキーと、そのうち一部に下位レイヤのキーを足す
+    std::vector<std::pair<uint64_t, uint64_t>> keys;   // (slice, 下位のslice or 0)
+    for (uint64_t i = 0; i < num_keys; i++) {
+        Key key({i * 3}, 8);
+        masstree.put(key, new Value(i), gc);
+        keys.emplace_back(i * 3, 0);
+        if (i % 50 == 0) {
+            for (uint64_t j = 1; j <= 3; j++) {
+                Key long_key({i * 3, j}, 8);
+                masstree.put(long_key, new Value(i), gc);
+                keys.emplace_back(i * 3, j);
+            }
+        }
+    }
+    std::sort(keys.begin(), keys.end());
+    auto toKey = [](const std::pair<uint64_t, uint64_t> &pair) {
+        return pair.second == 0 ? Key({pair.first}, 8) : Key({pair.first, pair.second}, 8);
+    };
+
+    // exactは全て数えた結果と一致する
+    Key lo({3000}, 8);
+    Key hi({3000 * 10, 2}, 8);
+    size_t expected = 0;
+    for (const auto &pair : keys) {
+        Key key = toKey(pair);
+        if (!(key.slices[0] < 3000) && (key.slices[0] < 30000 || (key.slices[0] == 30000 && key.slices.size() == 1) || (key.slices[0] == 30000 && key.slices[1] < 2))) expected++;
+    }
+    EXPECT_EQ(masstree.count_range(lo, hi, true), expected);
+    EXPECT_EQ(masstree.count_range(hi, lo, true), 0);
+    EXPECT_EQ(masstree.rank(Key({0}, 8), true), 0);
+    EXPECT_EQ(masstree.rank(Key({num_keys * 3}, 8), true), keys.size());
+
+    for (size_t k : {size_t(0), size_t(1), size_t(777), keys.size() / 2, keys.size() - 1}) {
+        std::optional<Key> key = masstree.select(k, true);
+        ASSERT_TRUE(key.has_value());
+        EXPECT_EQ(*key, toKey(keys[k]));
+        EXPECT_EQ(masstree.rank(*key, true), k);
+    }
+    EXPECT_FALSE(masstree.select(keys.size(), true).has_value());
+
+    // 近似はだいたい合っている
+    double approx = static_cast<double>(masstree.count_range(lo, hi));
+    EXPECT_NEAR(approx, static_cast<double>(expected), expected * 0.25);
+    size_t total = keys.size();
+    EXPECT_NEAR(static_cast<double>(masstree.rank(Key({num_keys * 3}, 8))), static_cast<double>(total), total * 0.25);
+    std::optional<Key> middle = masstree.select(total / 2);
+    ASSERT_TRUE(middle.has_value());
+    EXPECT_NEAR(static_cast<double>(masstree.rank(*middle, true)), static_cast<double>(total / 2), total * 0.25);
+}
+
+TEST(MasstreeTest, seek) {
+    Masstree masstree;
+    GarbageCollector gc;
+    EXPECT_FALSE(masstree.min().has_value());
+    EXPECT_FALSE(masstree.max().has_value());
+    EXPECT_FALSE(masstree.lower_bound(makeKey("a")).has_value());
+
+    // 長さの違うキー、suffixを持つキー、下位レイヤに入るキーを混ぜる
+    std::set<std::string> expected;
+    for (int i = 0; i < 3000; i++) {
+        std::string str = "k" + std::to_string(i * 7 % 1000);
+        if (i % 3 == 1) str += "/suffix" + std::to_string(i % 13);
+        if (i % 3 == 2) str = str.substr(0, 1 + i % 4);
+        Key key = makeKey(str);
+        masstree.put(key, new Value(i), gc);
+        expected.insert(str);
+    }
+    EXPECT_EQ(keyToString(masstree.min()->first), *expected.begin());
+    EXPECT_EQ(keyToString(masstree.max()->first), *expected.rbegin());
+
+    std::vector<std::string> probes{"a", "k", "k1", "k10", "k100", "k100/", "k100/suffix", "k100/suffix99", "k5", "k999/suffix9", "z"};
+    for (const std::string &str : expected) probes.push_back(str);
+    for (const std::string &probe : probes) {
+        Key key = makeKey(probe);
+        auto lower = masstree.lower_bound(key);
+        auto it = expected.lower_bound(probe);
+        ASSERT_EQ(lower.has_value(), it != expected.end()) << probe;
+        if (lower.has_value()) {
+            EXPECT_EQ(keyToString(lower->first), *it) << probe;
+            Key found = makeKey(*it);
+            EXPECT_EQ(lower->second, masstree.get(found));
+        }
+        auto upper = masstree.upper_bound(key);
+        it = expected.upper_bound(probe);
+        ASSERT_EQ(upper.has_value(), it != expected.end()) << probe;
+        if (upper.has_value()) {
+            EXPECT_EQ(keyToString(upper->first), *it) << probe;
+        }
+    }
+
+    // 最大のキーを取り出して消すのを繰り返すと降順に取り出せる(空になった右端のBorderNodeからprevを辿る)
+    for (size_t i = 0; i < expected.size() / 2; i++) {
+        auto largest = masstree.max();
+        ASSERT_TRUE(largest.has_value());
+        ASSERT_EQ(keyToString(largest->first), *expected.rbegin());
+        masstree.remove(largest->first, gc);
+        expected.erase(std::prev(expected.end()));
+    }
+    // 最小のキーを取り出して消すのを繰り返すと昇順に全て取り出せる
+    for (const std::string &str : expected) {
+        auto smallest = masstree.min();
+        ASSERT_TRUE(smallest.has_value());
+        ASSERT_EQ(keyToString(smallest->first), str);
+        masstree.remove(smallest->first, gc);
+    }
+    EXPECT_FALSE(masstree.min().has_value());
+    EXPECT_FALSE(masstree.max().has_value());
+}
+
+TEST(MasstreeTest, splitStormWithReaders) {
+    // BorderNodeとInteriorNodeのsplit(sort、split_keys_among、insert_into_parent)が続いている間に、
+    // readerが書き込み済みのキーを見失ったり、書きかけのノードを読んだりしないかのテスト(TSANでも回す)
+    Masstree masstree;
+    constexpr size_t num_writers = 4;
+    constexpr size_t num_readers = 2;
+    constexpr uint64_t keys_per_writer = 5000;
+    // writer tのi番目のキー: sliceが昇順に交互に並んでsplitが起き続けるようにし、3つに1つはsuffixを持つ長さにする
+    auto keyOf = [](size_t t, uint64_t i) {
+        uint64_t slice = (i * num_writers + t) << 8;
+        if (i % 3 == 0) return Key({slice, i}, 8);
+        return Key({slice}, 8);
+    };
+    std::array<std::atomic<uint64_t>, num_writers> progress{};   // writerごとのput済みのキーの数
+    std::atomic<size_t> finished{0};
+    std::atomic<uint64_t> missing{0};
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_writers; t++) {
+        threads.emplace_back([&, t] {
+            ThreadContext &ctx = masstree.registerThread();
+            for (uint64_t i = 0; i < keys_per_writer; i++) {
+                Key key = keyOf(t, i);
+                masstree.put(key, new Value(static_cast<int>(i)), ctx);
+                progress[t].store(i + 1, std::memory_order_release);
+            }
+            finished.fetch_add(1);
+        });
+    }
+    for (size_t r = 0; r < num_readers; r++) {
+        threads.emplace_back([&, r] {
+            ThreadContext &ctx = masstree.registerThread();
+            std::mt19937_64 rng{r};
+            while (finished.load() < num_writers) {
+                size_t t = rng() % num_writers;
+                uint64_t done = progress[t].load(std::memory_order_acquire);
+                if (done == 0) continue;
+                uint64_t i = rng() % done;
+                Key key = keyOf(t, i);
+                Value *value = masstree.get(key, ctx);
+                if (value == nullptr || value->getBody() != static_cast<int>(i)) missing.fetch_add(1);
+            }
+        });
+    }
+    for (auto &thread : threads) thread.join();
+    EXPECT_EQ(missing.load(), 0);
+
+    ThreadContext &ctx = masstree.registerThread();
+    for (size_t t = 0; t < num_writers; t++) {
+        for (uint64_t i = 0; i < keys_per_writer; i++) {
+            Key key = keyOf(t, i);
+            Value *value = masstree.get(key, ctx);
+            ASSERT_NE(value, nullptr);
+            EXPECT_EQ(value->getBody(), static_cast<int>(i));
+        }
+    }
+    EXPECT_GT(masstree.getStats()[StatsCounter::InteriorSplit], 0);
+}
+
+TEST(MasstreeTest, flatCombining) {
+    // 全スレッドが同じ右端のBorderNodeにinsertし、少数のキーを上書きし続けてもputが失われないかのテスト
+    Masstree masstree(PutMode::FlatCombining);
+    EXPECT_EQ(masstree.getPutMode(), PutMode::FlatCombining);
+    constexpr size_t num_threads = 8;
+    constexpr uint64_t num_keys = 4000;
+    constexpr uint64_t num_hot_keys = 8;
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; t++) {
+        threads.emplace_back([&, t] {
+            ThreadContext &ctx = masstree.registerThread();
+            for (uint64_t i = t; i < num_keys; i += num_threads) {
+                Key key({i}, 8);
+                masstree.put(key, new Value(static_cast<int>(i)), ctx);
+                Key hot({num_keys + i % num_hot_keys}, 8);
+                masstree.put(hot, new Value(static_cast<int>(t)), ctx);
+                // 長いキーはsuffixと下位レイヤを使うのでcombiningではRetryになり、通常のputでやり直す
+                Key long_key({num_keys * 2, i}, 8);
+                masstree.put(long_key, new Value(static_cast<int>(i)), ctx);
+            }
+        });
+    }
+    for (auto &thread : threads) thread.join();
+
+    for (uint64_t i = 0; i < num_keys; i++) {
+        Key key({i}, 8);
+        Value *value = masstree.get(key);
+        ASSERT_NE(value, nullptr);
+        EXPECT_EQ(value->getBody(), static_cast<int>(i));
+        Key long_key({num_keys * 2, i}, 8);
+        value = masstree.get(long_key);
+        ASSERT_NE(value, nullptr);
+        EXPECT_EQ(value->getBody(), static_cast<int>(i));
+    }
+    for (uint64_t i = 0; i < num_hot_keys; i++) {
+        Key hot({num_keys + i}, 8);
+        EXPECT_NE(masstree.get(hot), nullptr);
+    }
+    EXPECT_GT(masstree.getStats()[StatsCounter::BorderSplit], 0);
+}
+
+TEST(MasstreeTest, hotLeaves) {
+    // lockが集中するBorderNodeを見つけて、splitで分けられるかのテスト
+    Masstree masstree;
+    ThreadContext &ctx = masstree.registerThread();
+    EXPECT_TRUE(masstree.hottest_leaves(4).empty());
+    for (uint64_t i = 0; i < 2000; i++) {
+        Key key({i}, 8);
+        masstree.put(key, new Value(static_cast<int>(i)), ctx);
+    }
+    masstree.reset_lock_samples();
+    EXPECT_TRUE(masstree.hottest_leaves(4).empty());
+
+    // 既存キーのputはlockを取らないので、removeとinsertを繰り返してlockを取らせる
+    // 1000付近のLayer0のキーと、下位レイヤ(prefixが{5000})のキーの2箇所を熱くする
+    constexpr uint64_t layer_slice = 5000;
+    for (uint64_t i = 0; i < 3; i++) {
+        Key key({layer_slice, i}, 8);
+        masstree.put(key, new Value(static_cast<int>(i)), ctx);
+    }
+    for (size_t round = 0; round < 200; round++) {
+        for (uint64_t i = 1000; i < 1004; i++) {
+            Key key({i}, 8);
+            masstree.remove(key, ctx);
+            Key again({i}, 8);
+            masstree.put(again, new Value(static_cast<int>(i)), ctx);
+        }
+        if (round % 2 == 0) {
+            Key key({layer_slice, round % 3}, 8);
+            masstree.remove(key, ctx);
+            Key again({layer_slice, round % 3}, 8);
+            masstree.put(again, new Value(static_cast<int>(round % 3)), ctx);
+        }
+    }
+    std::vector<HotLeaf> leaves = masstree.hottest_leaves(2);
+    ASSERT_EQ(leaves.size(), 2);
+    const HotLeaf &hottest = leaves[0];
+    EXPECT_EQ(hottest.layer(), 0);
+    EXPECT_LE(hottest.lowest_slice, 1000);
+    ASSERT_TRUE(hottest.next_slice.has_value());
+    EXPECT_GT(hottest.next_slice.value(), 1003);
+    EXPECT_GE(hottest.lock_samples, 4 * 2 * 200 / LOCK_SAMPLE_INTERVAL - 1);
+    EXPECT_EQ(leaves[1].prefix, std::vector<uint64_t>{layer_slice});
+    EXPECT_GT(leaves[0].lock_samples, leaves[1].lock_samples);
+
+    // 担当範囲はseparatorで決まるので、右隣のBorderNodeの最小のキーを消しても上限は変わらない
+    uint64_t upper = hottest.next_slice.value();
+    Key right_lowest({upper}, 8);
+    Value *taken = masstree.take(right_lowest, ctx);
+    ASSERT_NE(taken, nullptr);
+    ctx.getGC().add(taken);
+    std::vector<HotLeaf> again = masstree.hottest_leaves(1);
+    ASSERT_EQ(again[0].node, hottest.node);
+    EXPECT_EQ(again[0].next_slice, std::optional<uint64_t>(upper));
+    EXPECT_EQ(again[0].lowest_slice, hottest.lowest_slice);
+    Key restored({upper}, 8);
+    masstree.put(restored, new Value(static_cast<int>(upper)), ctx);
+
+    // 一番熱いBorderNodeだけを分ける(min_samplesより少ない2番目は分けない)
+    size_t keys_before = hottest.num_keys;
+    EXPECT_EQ(masstree.split_hot_leaves(2, leaves[1].lock_samples + 1, &ctx.getStats()), 1);
+    std::vector<HotLeaf> after = masstree.hottest_leaves(2);
+    ASSERT_FALSE(after.empty());
+    EXPECT_EQ(after[0].prefix, std::vector<uint64_t>{layer_slice});
+    BorderNode *split_node = hottest.node;
+    EXPECT_LT(split_node->getPermutation().getNumKeys(), keys_before);
+    EXPECT_EQ(split_node->getLockSamples(), 0);
+    for (uint64_t i = 0; i < 2000; i++) {
+        Key key({i}, 8);
+        Value *value = masstree.get(key, ctx);
+        ASSERT_NE(value, nullptr);
+        EXPECT_EQ(value->getBody(), static_cast<int>(i));
+    }
+    for (uint64_t i = 0; i < 3; i++) {
+        Key key({layer_slice, i}, 8);
+        EXPECT_NE(masstree.get(key, ctx), nullptr);
+    }
+}
+
+TEST(MasstreeTest, splitHotLeavesWhileWriting) {
+    // writerがinsert/removeしている間にsplit_hot_leavesを繰り返してもキーが失われないかのテスト
+    Masstree masstree;
+    constexpr size_t num_threads = 4;
+    constexpr uint64_t num_keys = 4000;
+    std::atomic<size_t> finished{0};
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; t++) {
+        threads.emplace_back([&, t] {
+            ThreadContext &ctx = masstree.registerThread();
+            for (uint64_t i = t; i < num_keys; i += num_threads) {
+                Key key({i}, 8);
+                masstree.put(key, new Value(static_cast<int>(i)), ctx);
+                // 下位レイヤのキーも混ぜる
+                Key long_key({num_keys, i}, 8);
+                masstree.put(long_key, new Value(static_cast<int>(i)), ctx);
+                if (i % 3 == 0) {
+                    Key removed({num_keys, i}, 8);
+                    masstree.remove(removed, ctx);
+                }
+            }
+            finished.fetch_add(1);
+        });
+    }
+    size_t num_split = 0;
+    while (finished.load() < num_threads) num_split += masstree.split_hot_leaves(4, 1);
+    for (auto &thread : threads) thread.join();
+    // コアが1つだと上のループが回る前にwriterが終わることがあるので、終わった後にも1回分ける
+    num_split += masstree.split_hot_leaves(4, 1);
+
+    for (uint64_t i = 0; i < num_keys; i++) {
+        Key key({i}, 8);
+        Value *value = masstree.get(key);
+        ASSERT_NE(value, nullptr);
+        EXPECT_EQ(value->getBody(), static_cast<int>(i));
+        Key long_key({num_keys, i}, 8);
+        value = masstree.get(long_key);
+        if (i % 3 == 0) {
+            EXPECT_EQ(value, nullptr);
+        } else {
+            ASSERT_NE(value, nullptr);
+            EXPECT_EQ(value->getBody(), static_cast<int>(i));
+        }
+    }
+    EXPECT_GT(num_split, 0);
+}
@@ -1,4 +1,7 @@
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <random>
+#include <vector>
 
 #include "../src/include/masstree.h"
 #include "sample.h"
@@ -91,4 +94,62 @@ TEST(PermutationTest, removeIndex) {
 	EXPECT_EQ(permutation(0), 4);
 	EXPECT_EQ(permutation(1), 0);
 	EXPECT_EQ(permutation.getNumKeys(), 3);
-}
\ No newline at end of file
+}
+// insert/removeIndex/indexOfはconstexprなのでコンパイル時にも確認できる
+static constexpr Permutation constexprInsertAndRemove() {
+	Permutation permutation = Permutation::fromSorted(3);	// [0, 1, 2]
+	permutation.insert(1, 7);								// [0, 7, 1, 2]
+	permutation.insert(4, 9);								// [0, 7, 1, 2, 9]
+	permutation.removeIndex(1);								// [0, 7, 2, 9]
+	return permutation;
+}
+static_assert(constexprInsertAndRemove().getNumKeys() == 4);
+static_assert(constexprInsertAndRemove()(0) == 0 && constexprInsertAndRemove()(1) == 7);
+static_assert(constexprInsertAndRemove()(2) == 2 && constexprInsertAndRemove()(3) == 9);
+static_assert(constexprInsertAndRemove().indexOf(9) == 3);
+static_assert(constexprInsertAndRemove().indexOf(1) == 4);	// 無ければgetNumKeys()
+static_assert(Permutation::fromSorted(15).indexOf(14) == 14);
+
+TEST(PermutationTest, indexOf) {
+	Permutation permutation = Permutation::from({3, 4, 5, 0, 1});
+	EXPECT_EQ(permutation.indexOf(3), 0);
+	EXPECT_EQ(permutation.indexOf(0), 3);
+	EXPECT_EQ(permutation.indexOf(1), 4);
+	// keysより後ろのnibbleやkeys自体(5)とは一致しない
+	EXPECT_EQ(permutation.indexOf(2), 5);
+	permutation.removeIndex(5);
+	EXPECT_EQ(permutation.indexOf(5), 4);
+	EXPECT_EQ(permutation.indexOf(0), 2);
+}
+
+TEST(PermutationTest, insertAndRemoveMatchReference) {
+	// ランダムなinsert/removeIndexの結果が、vectorで同じ操作をした結果と一致するかのテスト
+	std::mt19937 rng{12345};
+	for (int round = 0; round < 2000; round++) {
+		Permutation permutation{};
+		std::vector<size_t> expected;
+		std::vector<size_t> unused;
+		for (size_t i = 0; i < 15; i++) unused.push_back(i);
+		for (int step = 0; step < 40; step++) {
+			bool do_insert = expected.empty() || (expected.size() < 15 && rng() % 2 == 0);
+			if (do_insert) {
+				size_t position = rng() % (expected.size() + 1);
+				size_t pick = rng() % unused.size();
+				size_t trueIndex = unused[pick];
+				unused.erase(unused.begin() + pick);
+				permutation.insert(position, trueIndex);
+				expected.insert(expected.begin() + position, trueIndex);
+			} else {
+				size_t trueIndex = expected[rng() % expected.size()];
+				permutation.removeIndex(trueIndex);
+				expected.erase(std::find(expected.begin(), expected.end(), trueIndex));
+				unused.push_back(trueIndex);
+			}
+			ASSERT_EQ(permutation.getNumKeys(), expected.size());
+			for (size_t i = 0; i < expected.size(); i++) {
+				ASSERT_EQ(permutation(i), expected[i]);
+				ASSERT_EQ(permutation.indexOf(expected[i]), i);
+			}
+		}
+	}
+}
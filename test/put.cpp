@@ -1,5 +1,7 @@
 #include <gtest/gtest.h>
 #include <cstdint>
+#include <memory>
+#include <vector>
 
 #include "../src/include/masstree.h"
 #include "gtest_util.h"
@@ -407,4 +409,144 @@ TEST(PutTest, update_and_gc) {
     node = masstree_put(node, key, new Value(2), gc).second;
     // valueが上書きされるのでこのアイテムはgcに渡されているはず
     EXPECT_TRUE(gc.contain(value));
-}
\ No newline at end of file
+}
+TEST(PutTest, combine_puts) {
+    // lockの持ち主がBorderNodeに積まれたputのリクエストをまとめて処理するかのテスト
+    GarbageCollector gc;
+    Node *root = nullptr;
+    // suffixを持つキー1つを含めて14個のキーを入れておく(空きは1つ)
+    Key suffix_key({3, 9}, 8);
+    root = masstree_put(root, suffix_key, new Value(3), gc).second;
+    suffix_key.reset();
+    for (uint64_t i = 1; i <= 14; i++) {
+        if (i == 3) continue;
+        Key key({i}, 8);
+        root = masstree_put(root, key, new Value(static_cast<int>(i)), gc).second;
+    }
+    ASSERT_TRUE(root->getIsBorder());
+    BorderNode *node = reinterpret_cast<BorderNode *>(root);
+    Key update({5}, 8);         // 既存のキーの置き換え
+    Value *old_five = masstree_get(root, update);
+    update.reset();
+    Key insert({20}, 8);        // 最後の空きにinsert
+    Key split_insert({21}, 8);  // 空きが無いのでsplitして入れる
+    Key full_insert({22}, 8);   // splitは1回だけなのでRetry
+    Key conflict({3, 8}, 8);    // suffixを持つキーと競合する(レイヤの作成が必要)のでRetry
+    std::vector<Key *> keys{&update, &insert, &split_insert, &full_insert, &conflict};
+    std::vector<Value *> values;
+    std::vector<std::unique_ptr<CombiningRequest>> requests;
+    node->lock();
+    for (size_t i = 0; i < keys.size(); i++) {
+        values.push_back(new Value(100 + static_cast<int>(i)));
+        requests.push_back(std::make_unique<CombiningRequest>());
+        requests.back()->key = keys[i];
+        requests.back()->value = values.back();
+        node->publishCombining(requests.back().get());
+    }
+    Node *new_root = combine_puts(node, gc);
+    EXPECT_FALSE(node->isLocked());
+    ASSERT_NE(new_root, nullptr);
+    EXPECT_FALSE(new_root->getIsBorder());
+
+    EXPECT_EQ(requests[0]->state.load(), CombiningState::Done);
+    EXPECT_EQ(requests[0]->old_value, old_five);
+    EXPECT_EQ(requests[1]->state.load(), CombiningState::Done);
+    EXPECT_EQ(requests[1]->old_value, nullptr);
+    EXPECT_EQ(requests[2]->state.load(), CombiningState::Done);
+    EXPECT_EQ(requests[3]->state.load(), CombiningState::Retry);
+    EXPECT_EQ(requests[4]->state.load(), CombiningState::Retry);
+    for (size_t i = 0; i < 3; i++) {
+        keys[i]->reset();
+        EXPECT_EQ(masstree_get(new_root, *keys[i]), values[i]);
+    }
+    full_insert.reset();
+    EXPECT_EQ(masstree_get(new_root, full_insert), nullptr);
+    conflict.reset();
+    EXPECT_EQ(masstree_get(new_root, conflict), nullptr);
+    suffix_key.reset();
+    EXPECT_NE(masstree_get(new_root, suffix_key), nullptr);
+}
+
+TEST(PutTest, combine_puts_after_split) {
+    // リクエストを積んだ後にnodeがsplitされていたら、nextの最小のキーより小さいキーでもRetryにするかのテスト
+    GarbageCollector gc;
+    Node *root = nullptr;
+    for (uint64_t i = 1; i <= 10; i++) {
+        Key key({i * 16}, 8);
+        root = masstree_put(root, key, new Value(static_cast<int>(i)), gc).second;
+    }
+    ASSERT_TRUE(root->getIsBorder());
+    BorderNode *left = reinterpret_cast<BorderNode *>(root);
+    Key stale_key({6 * 16}, 8);     // splitの後は右のノードに入るキー
+    Version stale_version = findBorder(root, stale_key).second;
+    Node *new_root = nullptr;
+    ASSERT_TRUE(split_leaf(left, new_root));
+    ASSERT_NE(new_root, nullptr);
+    // 右のノードの最小のキーを消すと、nextの最小のキーはstale_keyより大きくなる
+    Key lowest({6 * 16}, 8);
+    remove(new_root, lowest, gc);
+    ASSERT_GT(left->getNext()->lowestKey(), 6 * 16);
+
+    CombiningRequest stale{};
+    stale.key = &stale_key;
+    stale.value = new Value(100);
+    stale.version = stale_version;
+    Key fresh_key({2 * 16}, 8);
+    CombiningRequest fresh{};
+    fresh.key = &fresh_key;
+    fresh.value = new Value(200);
+    fresh.version = findBorder(new_root, fresh_key).second;
+    left->lock();
+    left->publishCombining(&stale);
+    left->publishCombining(&fresh);
+    EXPECT_EQ(combine_puts(left, gc), nullptr);
+    EXPECT_EQ(stale.state.load(), CombiningState::Retry);
+    EXPECT_EQ(fresh.state.load(), CombiningState::Done);
+    EXPECT_EQ(left->getPermutation().getNumKeys(), 5);
+    stale_key.reset();
+    EXPECT_EQ(masstree_get(new_root, stale_key), nullptr);
+    delete stale.value;
+}
+
+TEST(PutTest, split_leaf) {
+    // 満杯でないBorderNodeを半分に分けられるかのテスト
+    GarbageCollector gc;
+    Node *root = nullptr;
+    for (uint64_t i = 1; i <= 10; i++) {
+        Key key({i * 16}, 8);
+        root = masstree_put(root, key, new Value(static_cast<int>(i)), gc).second;
+    }
+    ASSERT_TRUE(root->getIsBorder());
+    BorderNode *left = reinterpret_cast<BorderNode *>(root);
+    Node *new_root = nullptr;
+    ASSERT_TRUE(split_leaf(left, new_root));
+    ASSERT_NE(new_root, nullptr);
+    EXPECT_FALSE(new_root->getIsBorder());
+    EXPECT_FALSE(left->isLocked());
+    BorderNode *right = left->getNext();
+    ASSERT_NE(right, nullptr);
+    EXPECT_EQ(left->getPermutation().getNumKeys(), 5);
+    EXPECT_EQ(right->getPermutation().getNumKeys(), 5);
+    EXPECT_EQ(right->lowestKey(), 6 * 16);
+    for (uint64_t i = 1; i <= 10; i++) {
+        Key key({i * 16}, 8);
+        Value *value = masstree_get(new_root, key);
+        ASSERT_NE(value, nullptr);
+        EXPECT_EQ(value->getBody(), static_cast<int>(i));
+    }
+    // 分けた後の空きスロットにinsertできる
+    Key key({3 * 16 + 1}, 8);
+    EXPECT_EQ(masstree_put(new_root, key, new Value(0), gc).second, new_root);
+    key.reset();
+    EXPECT_NE(masstree_get(new_root, key), nullptr);
+
+    // sliceが1種類しかない(長さだけが違う)キーは分けられない
+    Node *same = nullptr;
+    for (size_t len = 1; len <= 7; len++) {
+        Key short_key({0x4100'0000'0000'0000}, len);
+        same = masstree_put(same, short_key, new Value(static_cast<int>(len)), gc).second;
+    }
+    EXPECT_FALSE(split_leaf(reinterpret_cast<BorderNode *>(same), new_root));
+    EXPECT_EQ(new_root, nullptr);
+    EXPECT_FALSE(same->isLocked());
+}
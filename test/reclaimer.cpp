@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+#include "../src/include/masstree.h"
+#include "../src/include/masstree_reclaimer.h"
+#include "gtest_util.h"
+
+TEST(BackgroundReclaimerTest, retireAndFlush) {
+    BackgroundReclaimer reclaimer(ReclaimerOptions{0, 16});
+    GarbageCollector gc;
+    std::vector<Value *> values;
+    for (int i = 0; i < 100; i++) {
+        values.push_back(new Value(i));
+        gc.add(values.back());
+    }
+    reclaimer.retire(gc);
+    // 中身は解放スレッドに移り、gcは空になる
+    EXPECT_TRUE(gc.empty());
+    EXPECT_FALSE(gc.contain(values[0]));
+    reclaimer.flush();
+    EXPECT_EQ(reclaimer.getFreedObjects(), 100);
+    EXPECT_EQ(reclaimer.getFreed(RetiredType::Value), 100);
+    EXPECT_EQ(reclaimer.getPendingBytes(), 0);
+    // 空のgcを渡しても何もしない
+    reclaimer.retire(gc);
+    reclaimer.flush();
+    EXPECT_EQ(reclaimer.getFreedObjects(), 100);
+}
+
+TEST(BackgroundReclaimerTest, retireFromTree) {
+    // removeでgcに入ったノードや値を解放スレッドに渡して解放できるかのテスト
+    Masstree masstree;
+    ThreadContext &ctx = masstree.registerThread();
+    for (uint64_t i = 0; i < 1000; i++) {
+        Key key({i}, 8);
+        masstree.put(key, new Value(static_cast<int>(i)), ctx);
+    }
+    for (uint64_t i = 0; i < 1000; i++) {
+        Key key({i}, 8);
+        masstree.remove(key, ctx);
+    }
+    size_t retired = ctx.getGC().size();
+    EXPECT_GT(retired, 1000);
+    {
+        BackgroundReclaimer reclaimer;
+        reclaimer.retire(ctx.getGC());
+        EXPECT_TRUE(ctx.getGC().empty());
+        reclaimer.flush();
+        EXPECT_EQ(reclaimer.getFreedObjects(), retired);
+    }
+    Key key({0}, 8);
+    EXPECT_EQ(masstree.get(key), nullptr);
+}
+
+TEST(BackgroundReclaimerTest, highWaterMark) {
+    // 解放待ちが上限を超えるとretireが待たされ、それでも全て解放されるかのテスト
+    constexpr size_t num_threads = 4;
+    constexpr size_t num_batches = 50;
+    constexpr size_t batch_size = 100;
+    ReclaimerOptions options{};
+    options.high_water_bytes = 2 * batch_size * sizeof(Value);
+    options.burst_size = 10;
+    options.burst_pause = std::chrono::microseconds(100);
+    BackgroundReclaimer reclaimer(options);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; t++) {
+        threads.emplace_back([&] {
+            GarbageCollector gc;
+            for (size_t b = 0; b < num_batches; b++) {
+                for (size_t i = 0; i < batch_size; i++) gc.add(new Value(static_cast<int>(i)));
+                reclaimer.retire(gc);
+                // 同時に上限の確認を通ったスレッドの分を足しても、上限 + スレッド数分のbatchを超えない
+                EXPECT_LE(reclaimer.getPendingBytes(), options.high_water_bytes + num_threads * batch_size * sizeof(Value));
+            }
+        });
+    }
+    for (auto &thread : threads) thread.join();
+    reclaimer.flush();
+    EXPECT_GT(reclaimer.getThrottledRetires(), 0);
+    EXPECT_EQ(reclaimer.getFreedObjects(), num_threads * num_batches * batch_size);
+    EXPECT_EQ(reclaimer.getPendingBytes(), 0);
+}
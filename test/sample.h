@@ -151,5 +151,7 @@ static void makeSampleBorderNode(BorderNode *node) {
     node->setKeyLen(5, 8);
     // key_slice : [ 2| 2| 0| 1| 1| 1|__|__|__|__|__|__|__|__|__]
     // key_len   : [ 5| 7| 0| 1| 2| 8|__|__|__|__|__|__|__|__|__]
+    // 生きているキーのValueがnullptrだとUNSTABLE扱いになるのでValueも入れておく
+    for (size_t i : {0, 1, 3, 4, 5}) node->setLV(i, LinkOrValue(new Value(i)));
     node->setPermutation(Permutation::from({3, 4, 5, 0, 1}));
 }
\ No newline at end of file
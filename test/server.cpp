@@ -0,0 +1,183 @@
+#include <gtest/gtest.h>
+#include <arpa/inet.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "../server/kv_server.h"
+#include "gtest_util.h"
+
+static int connectUnix(const std::string &path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) return -1;
+    return fd;
+}
+
+static int connectTcp(uint16_t port) {
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) return -1;
+    return fd;
+}
+
+static bool sendAll(int fd, const std::vector<uint8_t> &buf) {
+    size_t pos = 0;
+    while (pos < buf.size()) {
+        ssize_t w = write(fd, buf.data() + pos, buf.size() - pos);
+        if (w <= 0) return false;
+        pos += static_cast<size_t>(w);
+    }
+    return true;
+}
+
+static std::vector<KVResponse> receive(int fd, size_t n) {
+    std::vector<KVResponse> responses(n);
+    auto *p = reinterpret_cast<uint8_t *>(responses.data());
+    size_t remaining = n * sizeof(KVResponse);
+    while (remaining > 0) {
+        ssize_t r = read(fd, p, remaining);
+        if (r <= 0) break;
+        p += r;
+        remaining -= static_cast<size_t>(r);
+    }
+    EXPECT_EQ(remaining, 0);
+    return responses;
+}
+
+static bool hasStatus(const KVResponse &response, KVStatus status) {
+    return response.status == static_cast<uint8_t>(status);
+}
+
+TEST(KVServerTest, pipelinedRequests) {
+    // 1回のwriteでまとめて送ったリクエストに、送った順でレスポンスが返るかのテスト
+    std::string path = "/tmp/masstree_test_" + std::to_string(getpid()) + ".sock";
+    KVServerOptions options{};
+    options.unix_path = path;
+    options.num_workers = 2;
+    options.pin_workers = false;
+    options.max_batch = 16;
+    KVServer server(options);
+    ASSERT_TRUE(server.start());
+    int fd = connectUnix(path);
+    ASSERT_GE(fd, 0);
+
+    constexpr int num_keys = 100;
+    std::vector<uint8_t> requests;
+    std::vector<std::string> keys;
+    for (int i = 0; i < num_keys; i++) keys.push_back("key" + std::to_string(i) + std::string(i % 20, 'x'));
+    for (int i = 0; i < num_keys; i++) appendKVRequest(requests, KVOp::Put, keys[i].data(), static_cast<uint16_t>(keys[i].size()), i);
+    // max_batchを超える数のGetが続く
+    for (int i = 0; i < num_keys; i++) appendKVRequest(requests, KVOp::Get, keys[i].data(), static_cast<uint16_t>(keys[i].size()));
+    appendKVRequest(requests, KVOp::Get, "missing", 7);
+    appendKVRequest(requests, KVOp::Remove, keys[0].data(), static_cast<uint16_t>(keys[0].size()));
+    // 同じ接続の中ではRemoveの後のGetは消えたキーを見る
+    appendKVRequest(requests, KVOp::Get, keys[0].data(), static_cast<uint16_t>(keys[0].size()));
+    appendKVRequest(requests, KVOp::Remove, keys[0].data(), static_cast<uint16_t>(keys[0].size()));
+    appendKVRequest(requests, static_cast<KVOp>(99), "bad", 3);
+    appendKVRequest(requests, KVOp::Get, "", 0);
+    appendKVRequest(requests, KVOp::Get, keys[1].data(), static_cast<uint16_t>(keys[1].size()));
+    ASSERT_TRUE(sendAll(fd, requests));
+
+    std::vector<KVResponse> responses = receive(fd, 2 * num_keys + 7);
+    for (int i = 0; i < num_keys; i++) EXPECT_TRUE(hasStatus(responses[i], KVStatus::OK)) << i;
+    for (int i = 0; i < num_keys; i++) {
+        ASSERT_TRUE(hasStatus(responses[num_keys + i], KVStatus::OK)) << i;
+        EXPECT_EQ(responses[num_keys + i].value, i);
+    }
+    size_t next = 2 * num_keys;
+    EXPECT_TRUE(hasStatus(responses[next++], KVStatus::NotFound));
+    EXPECT_TRUE(hasStatus(responses[next++], KVStatus::OK));
+    EXPECT_TRUE(hasStatus(responses[next++], KVStatus::NotFound));
+    EXPECT_TRUE(hasStatus(responses[next++], KVStatus::NotFound));
+    EXPECT_TRUE(hasStatus(responses[next++], KVStatus::BadRequest));
+    EXPECT_TRUE(hasStatus(responses[next++], KVStatus::BadRequest));
+    EXPECT_TRUE(hasStatus(responses[next], KVStatus::OK));
+    EXPECT_EQ(responses[next].value, 1);
+
+    // 1byteずつ送っても、揃ったところで処理される
+    requests.clear();
+    appendKVRequest(requests, KVOp::Get, keys[2].data(), static_cast<uint16_t>(keys[2].size()));
+    for (uint8_t byte : requests) ASSERT_TRUE(sendAll(fd, {byte}));
+    responses = receive(fd, 1);
+    EXPECT_EQ(responses[0].value, 2);
+    close(fd);
+
+    server.stop();
+    EXPECT_EQ(server.getTree().rank(Key({std::numeric_limits<uint64_t>::max()}, 8), true), num_keys - 1);
+    // stopでsocketファイルも消える
+    EXPECT_NE(access(path.c_str(), F_OK), 0);
+}
+
+TEST(KVServerTest, slowReader) {
+    // レスポンスを読むのが遅く送りきれない状態が続いても、溜まった分が順に全て届くかのテスト
+    KVServerOptions options{};
+    options.num_workers = 1;
+    options.pin_workers = false;
+    KVServer server(options);
+    ASSERT_TRUE(server.start());
+    int fd = connectTcp(server.port());
+    ASSERT_GE(fd, 0);
+
+    constexpr int num_requests = 300000;    // レスポンスはKV_MAX_PENDING_OUTPUTとsocketのbufferを超える
+    std::vector<uint8_t> requests;
+    uint64_t k = 1;
+    appendKVRequest(requests, KVOp::Put, &k, sizeof(k), 7);
+    for (int i = 1; i < num_requests; i++) appendKVRequest(requests, KVOp::Get, &k, sizeof(k));
+    // サーバはレスポンスが溜まると読むのを止めるので、送るのは別のスレッドで行う
+    std::thread writer([&] { EXPECT_TRUE(sendAll(fd, requests)); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    std::vector<KVResponse> responses = receive(fd, num_requests);
+    writer.join();
+    for (int i = 0; i < num_requests; i++) {
+        ASSERT_TRUE(hasStatus(responses[i], KVStatus::OK)) << i;
+        if (i > 0) ASSERT_EQ(responses[i].value, 7) << i;
+    }
+    close(fd);
+    server.stop();
+}
+
+TEST(KVServerTest, concurrentConnections) {
+    // 複数の接続から同じキーを上書きし続けても、置き換えたValueがgrace periodの後に解放されるかのテスト
+    KVServerOptions options{};
+    options.num_workers = 2;
+    options.pin_workers = false;
+    KVServer server(options);
+    ASSERT_TRUE(server.start());
+    ASSERT_NE(server.port(), 0);
+
+    constexpr size_t num_clients = 4;
+    constexpr int rounds = 200;
+    constexpr int num_keys = 64;
+    std::vector<std::thread> clients;
+    for (size_t c = 0; c < num_clients; c++) {
+        clients.emplace_back([&, c] {
+            int fd = connectTcp(server.port());
+            ASSERT_GE(fd, 0);
+            for (int round = 0; round < rounds; round++) {
+                std::vector<uint8_t> requests;
+                for (uint64_t k = 0; k < num_keys; k++) {
+                    appendKVRequest(requests, KVOp::Put, &k, sizeof(k), static_cast<int32_t>(c));
+                    appendKVRequest(requests, KVOp::Get, &k, sizeof(k));
+                }
+                ASSERT_TRUE(sendAll(fd, requests));
+                std::vector<KVResponse> responses = receive(fd, 2 * num_keys);
+                for (const KVResponse &response : responses) EXPECT_TRUE(hasStatus(response, KVStatus::OK));
+            }
+            close(fd);
+        });
+    }
+    for (auto &client : clients) client.join();
+    server.stop();
+    // Putの度に元のValueが置き換えられる(最初の1回を除く)
+    EXPECT_EQ(server.getFreedObjects(), num_clients * rounds * num_keys - num_keys);
+    for (uint64_t k = 0; k < num_keys; k++) {
+        Key key = Key::fromBytes(&k, sizeof(k));
+        EXPECT_NE(server.getTree().get(key), nullptr);
+    }
+}
@@ -0,0 +1,162 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <limits>
+#include <thread>
+#include <vector>
+
+#include "../src/include/masstree_sharded.h"
+#include "gtest_util.h"
+
+// 上位bitがshardごとに散らばるようにしたslice(i < 4096なら順序はiと同じ)
+static uint64_t spreadSlice(uint64_t i) {
+    return (i << 52) | i;
+}
+
+// shardの担当範囲と中のキーが一致しているかを確認する
+static void expectShardsConsistent(const ShardedMasstree &sharded) {
+    for (size_t i = 0; i < sharded.numShards(); i++) {
+        uint64_t lower = sharded.lower(i);
+        uint64_t upper = (i + 1 < sharded.numShards()) ? sharded.lower(i + 1) : std::numeric_limits<uint64_t>::max();
+        size_t in_range = sharded.shard(i).count_range(Key({lower}, 1), Key({upper}, 1), true);
+        size_t total = sharded.shard(i).rank(Key({std::numeric_limits<uint64_t>::max()}, 8), true);
+        EXPECT_EQ(in_range, total) << "shard " << i;
+    }
+}
+
+TEST(ShardedMasstreeTest, rangeMode) {
+    ShardedMasstree sharded(ShardingMode::Range, 4);
+    GarbageCollector gc;
+    constexpr uint64_t num_keys = 4000;
+    for (uint64_t i = 0; i < num_keys; i++) {
+        Key key({spreadSlice(i)}, 8);
+        sharded.put(key, new Value(static_cast<int>(i)), gc);
+    }
+    for (uint64_t i = 0; i < num_keys; i++) {
+        Key key({spreadSlice(i)}, 8);
+        Value *value = sharded.get(key);
+        ASSERT_NE(value, nullptr);
+        EXPECT_EQ(value->getBody(), static_cast<int>(i));
+    }
+    // sliceの上位byteで分かれるので全shardにキーが入る
+    for (size_t i = 0; i < sharded.numShards(); i++) {
+        EXPECT_GT(sharded.shard(i).rank(Key({std::numeric_limits<uint64_t>::max()}, 8), true), 0) << "shard " << i;
+    }
+    expectShardsConsistent(sharded);
+
+    // shardをまたぐscanは昇順につながる
+    Key left({spreadSlice(100)}, 8);
+    Key right({spreadSlice(3500)}, 8);
+    std::vector<std::pair<Key, Value *>> result;
+    sharded.scan(left, false, right, true, result);
+    ASSERT_EQ(result.size(), 3400);
+    for (size_t i = 0; i < result.size(); i++) EXPECT_EQ(result[i].first.slices[0], spreadSlice(100 + i));
+
+    Key removed({spreadSlice(42)}, 8);
+    sharded.remove(removed, gc);
+    EXPECT_EQ(sharded.get(removed), nullptr);
+}
+
+TEST(ShardedMasstreeTest, hashMode) {
+    ShardedMasstree sharded(ShardingMode::Hash, 4);
+    ThreadContext &ctx = sharded.registerThread();
+    constexpr uint64_t num_keys = 4000;
+    // 連番のキーでもハッシュで全shardに散らばる
+    for (uint64_t i = 0; i < num_keys; i++) {
+        Key key({i}, 8);
+        sharded.put(key, new Value(static_cast<int>(i)), ctx);
+    }
+    for (size_t i = 0; i < sharded.numShards(); i++) {
+        size_t count = sharded.shard(i).rank(Key({std::numeric_limits<uint64_t>::max()}, 8), true);
+        EXPECT_GT(count, num_keys / sharded.numShards() / 2) << "shard " << i;
+    }
+    for (uint64_t i = 0; i < num_keys; i++) {
+        Key key({i}, 8);
+        Value *value = sharded.get(key, ctx);
+        ASSERT_NE(value, nullptr);
+        EXPECT_EQ(value->getBody(), static_cast<int>(i));
+    }
+    // 全shardのscan結果がマージされてキー順に並ぶ
+    Key left({10}, 8);
+    Key right({20}, 8);
+    std::vector<std::pair<Key, Value *>> result;
+    sharded.scan(left, false, right, false, result, ctx);
+    ASSERT_EQ(result.size(), 11);
+    for (size_t i = 0; i < result.size(); i++) EXPECT_EQ(result[i].first.slices[0], 10 + i);
+    EXPECT_GT(sharded.getStats()[StatsCounter::BorderSplit], 0);
+}
+
+TEST(ShardedMasstreeTest, rebalance) {
+    ShardedMasstree sharded(std::vector<uint64_t>{1000, 2000});
+    GarbageCollector gc;
+    for (uint64_t i = 0; i < 3000; i++) {
+        Key key({i}, 8);
+        sharded.put(key, new Value(static_cast<int>(i)), gc);
+    }
+    // 範囲外の境界は拒否する
+    EXPECT_FALSE(sharded.rebalance(0, 0, gc));
+    EXPECT_FALSE(sharded.rebalance(0, 2000, gc));
+
+    // 左右に動かしてもキーは全て残り、担当範囲と中身が一致する
+    EXPECT_TRUE(sharded.rebalance(0, 500, gc));
+    EXPECT_EQ(sharded.lower(1), 500);
+    EXPECT_EQ(sharded.shard(1).rank(Key({std::numeric_limits<uint64_t>::max()}, 8), true), 1500);
+    EXPECT_TRUE(sharded.rebalance(1, 2500, gc));
+    EXPECT_EQ(sharded.shard(2).rank(Key({std::numeric_limits<uint64_t>::max()}, 8), true), 500);
+    expectShardsConsistent(sharded);
+    for (uint64_t i = 0; i < 3000; i++) {
+        Key key({i}, 8);
+        Value *value = sharded.get(key);
+        ASSERT_NE(value, nullptr);
+        EXPECT_EQ(value->getBody(), static_cast<int>(i));
+    }
+
+    // 偏ったshardはbalanceでだいたい半分ずつになる
+    ShardedMasstree skewed(std::vector<uint64_t>{1ULL << 63});
+    for (uint64_t i = 0; i < 10000; i++) {
+        Key key({i}, 8);
+        skewed.put(key, new Value(static_cast<int>(i)), gc);
+    }
+    EXPECT_TRUE(skewed.balance(0, gc));
+    size_t left = skewed.shard(0).rank(Key({std::numeric_limits<uint64_t>::max()}, 8), true);
+    EXPECT_NEAR(static_cast<double>(left), 5000.0, 2500.0);
+    expectShardsConsistent(skewed);
+}
+
+TEST(ShardedMasstreeTest, rebalanceWhileWriting) {
+    // 境界を動かしている間もput/getが失われないかのテスト
+    ShardedMasstree sharded(std::vector<uint64_t>{5000});
+    constexpr uint64_t num_keys = 10000;
+    constexpr size_t num_threads = 4;
+    std::atomic<bool> done{false};
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; t++) {
+        threads.emplace_back([&, t] {
+            ThreadContext &ctx = sharded.registerThread();
+            for (uint64_t i = t; i < num_keys; i += num_threads) {
+                Key key({i}, 8);
+                sharded.put(key, new Value(static_cast<int>(i)), ctx);
+                Key check({i}, 8);
+                Value *value = sharded.get(check, ctx);
+                EXPECT_NE(value, nullptr);
+            }
+        });
+    }
+    std::thread balancer([&] {
+        GarbageCollector gc;
+        uint64_t boundaries[] = {2000, 8000, 5000};
+        for (size_t round = 0; !done.load(); round++) {
+            sharded.rebalance(0, boundaries[round % 3], gc);
+        }
+    });
+    for (auto &thread : threads) thread.join();
+    done.store(true);
+    balancer.join();
+
+    expectShardsConsistent(sharded);
+    for (uint64_t i = 0; i < num_keys; i++) {
+        Key key({i}, 8);
+        Value *value = sharded.get(key);
+        ASSERT_NE(value, nullptr);
+        EXPECT_EQ(value->getBody(), static_cast<int>(i));
+    }
+}
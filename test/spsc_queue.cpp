@@ -0,0 +1,44 @@
+#include <gtest/gtest.h>
+#include <thread>
+
+#include "../src/include/spsc_queue.h"
+#include "gtest_util.h"
+
+TEST(SpscQueueTest, pushAndPop) {
+    // 容量いっぱいまで入り、FIFOの順で取り出せるかのテスト
+    SpscQueue<int, 4> queue;
+    int item = 0;
+    EXPECT_FALSE(queue.pop(item));
+    for (int i = 0; i < 4; i++) EXPECT_TRUE(queue.push(int(i)));
+    EXPECT_FALSE(queue.push(4));
+    EXPECT_EQ(queue.size(), 4);
+    for (int i = 0; i < 4; i++) {
+        ASSERT_TRUE(queue.pop(item));
+        EXPECT_EQ(item, i);
+    }
+    EXPECT_FALSE(queue.pop(item));
+    // 一周してもindexが正しく回る
+    for (int i = 0; i < 10; i++) {
+        EXPECT_TRUE(queue.push(int(i)));
+        ASSERT_TRUE(queue.pop(item));
+        EXPECT_EQ(item, i);
+    }
+}
+
+TEST(SpscQueueTest, producerConsumer) {
+    // 別スレッドのproducerとconsumerで全ての要素が順番通りに届くかのテスト
+    SpscQueue<uint64_t, 64> queue;
+    constexpr uint64_t num_items = 200000;
+    std::thread producer([&] {
+        for (uint64_t i = 0; i < num_items; i++) {
+            while (!queue.push(uint64_t(i))) std::this_thread::yield();
+        }
+    });
+    uint64_t item = 0;
+    for (uint64_t expected = 0; expected < num_items; expected++) {
+        while (!queue.pop(item)) std::this_thread::yield();
+        ASSERT_EQ(item, expected);
+    }
+    producer.join();
+    EXPECT_EQ(queue.size(), 0);
+}
@@ -1,20 +1,24 @@
 #include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
 
 #include "../src/include/masstree.h"
 
-//                                                                 ┌───── splitting
-//                                                                 │
-//                                                                 │   ┌───── inserting
-//                                                                 │   │
-//                   ┌───── v_split                                │   │   ┌───── locked
-//                   │                                             │   │   │
-//  version : [ 00 │ 0000'0000 │ 0000'0000'0000'0000 │ 0 │ 0 │ 0 │ 0 │ 0 │ 0 ]
-//              │                │                     │   │   │
-//              └───── unused    └───── v_insert       │   │   └───── deleted
-//                                                     │   │
-//                                                     │   └───── is_root
-//                                                     │
-//                                                     └───── is_border
+//                                                        ┌───── splitting
+//                                                        │
+//                                                        │   ┌───── inserting
+//                                                        │   │
+//                   ┌───── v_split (26bit)               │   │   ┌───── locked
+//                   │                                    │   │   │
+//  version : [ 0000'0000'0000'0000'0000'0000'00 │ 0000'0000'0000'0000'0000'0000'0000'0000 │ 0 │ 0 │ 0 │ 0 │ 0 │ 0 ]
+//                                                 │                                         │   │   │
+//                                                 └───── v_insert (32bit)                   │   │   └───── deleted
+//                                                                                           │   │
+//                                                                                           │   └───── is_root
+//                                                                                           │
+//                                                                                           └───── is_border
 
 TEST(VersionTest, bit) {
     // uint64_tのVersion.bodyが機能するかの確認
@@ -27,14 +31,90 @@ TEST(VersionTest, bit) {
 TEST(VersionTest, has_locked) {
     Version version{};
     Version before = version;
-    // before  : [ 00 │ 0000'0000 │ 0000'0000'0000'0000 │ 0 │ 0 │ 0 │ 0 │ 0 │ 0 ]
     version.locked = true;
     version.inserting = true;
-    // version : [ 00 │ 0000'0000 │ 0000'0000'0000'0000 │ 0 │ 0 │ 0 │ 0 │ 1 │ 1 ]
+    // locked, insertingだけが変わる
     EXPECT_TRUE((before ^ version) > 0);
     version.locked = false;
     version.inserting = false;
     version.v_insert++;
-    // version : [ 00 │ 0000'0000 │ 0000'0000'0000'0001 │ 0 │ 0 │ 0 │ 0 │ 0 │ 0 ]
+    // v_insertだけが変わる
     EXPECT_TRUE((before ^ version) > 0);
-}
\ No newline at end of file
+}
+
+TEST(VersionTest, layout) {
+    // v_insertはbit 6から32bit、v_splitはbit 38から26bitで、64bitを使い切る
+    Version version{};
+    version.v_insert = 1;
+    EXPECT_EQ(version.body, 1ULL << 6);
+    version.v_insert = 0;
+    version.v_split = 1;
+    EXPECT_EQ(version.body, 1ULL << 38);
+    version.v_split = (1ULL << Version::v_split_bits) - 1;
+    version.v_split++;
+    EXPECT_EQ(version.v_split, 0);
+    EXPECT_EQ(version.body, 0);
+}
+
+TEST(VersionTest, noABAAfterCounterWidth) {
+    // 8bit/16bitのカウンタだと、readerが止まっている間にちょうど256回split(65536回insert)されると元のversionに戻って見逃していた
+    BorderNode node;
+    Version before = node.stableVersion();
+    for (int i = 0; i < 256; i++) {
+        node.lock();
+        node.setSplitting(true);
+        node.unlock();
+    }
+    EXPECT_TRUE((node.getVersion() ^ before) > Version::has_locked);
+    EXPECT_TRUE(Version::splitHappened(before, node.getVersion()));
+
+    before = node.stableVersion();
+    for (int i = 0; i < 65536; i++) {
+        node.lock();
+        node.setInserting(true);
+        node.unlock();
+    }
+    EXPECT_TRUE((node.getVersion() ^ before) > Version::has_locked);
+    EXPECT_FALSE(Version::splitHappened(before, node.getVersion()));
+}
+
+TEST(VersionTest, splitStorm) {
+    // writerが同じノードを延々とsplitし続けている間に、長く止まるreaderが変更を見逃さないかのテスト
+    BorderNode node;
+    std::atomic<uint64_t> completed{0};     // 終わったsplitの数(unlockの後に増やす)
+    std::atomic<bool> done{false};
+    std::thread writer([&] {
+        while (!done.load(std::memory_order_relaxed)) {
+            node.lock();
+            node.setSplitting(true);
+            node.unlock();
+            completed.fetch_add(1, std::memory_order_release);
+        }
+    });
+    std::vector<std::thread> readers;
+    std::atomic<uint64_t> missed{0};
+    std::atomic<uint64_t> checked{0};
+    for (int r = 0; r < 2; r++) {
+        readers.emplace_back([&, r] {
+            for (int i = 0; i < 200; i++) {
+                Version before = node.stableVersion();
+                uint64_t before_count = completed.load(std::memory_order_acquire);
+                // 数十〜数百回splitされるくらいの間止まる
+                std::this_thread::sleep_for(std::chrono::microseconds(10 * ((i + r) % 16)));
+                Version after = node.getVersion();
+                uint64_t after_count = completed.load(std::memory_order_acquire);
+                // before_countはbeforeの時点のv_splitより高々1少なく、after_countはafterの時点のv_split以下なので、
+                // 2回以上増えていればbeforeとafterの間に必ずsplitがある
+                if (after_count - before_count >= 2) {
+                    checked.fetch_add(1);
+                    if (!((after ^ before) > Version::has_locked)) missed.fetch_add(1);
+                }
+            }
+        });
+    }
+    for (auto &reader : readers) reader.join();
+    done.store(true);
+    writer.join();
+    EXPECT_EQ(missed.load(), 0);
+    EXPECT_GT(checked.load(), 0);
+}